@@ -0,0 +1,288 @@
+/*
+ * Batching scheduler: one forward pass for the pictures of several streams
+ */
+
+#include "batcher.h"
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+/* one input waiting for its mask, on the stack of the submitting thread
+ * for infer_batcher_run, allocated for infer_batcher_submit */
+typedef struct BatchRequest {
+    torch::Tensor input;
+    torch::Tensor mask;
+    int64_t submitted;
+    int done;
+    int ret;
+    BatchDoneFunc done_func;
+    void *opaque;
+    struct BatchRequest *next;
+} BatchRequest;
+
+struct InferBatcher {
+    SDL_Thread *tid;
+    SDL_mutex *mutex;
+    SDL_cond *cond;         /* an input was submitted, or abort */
+    SDL_cond *done_cond;    /* a batch finished */
+    BatchRequest *first, *last;
+    int nb_pending;
+    int nb_clients;
+    int abort_request;
+
+    int max_batch;
+    int64_t max_wait;
+    int nb_threads;
+    BatchForwardFunc forward;
+    void *opaque;
+
+    int64_t nb_batches, nb_inputs;
+    int64_t wait_time;      /* microseconds the inputs spent waiting for a batch */
+};
+
+static int same_shape(const torch::Tensor &a, const torch::Tensor &b)
+{
+    return a.sizes() == b.sizes() && a.strides() == b.strides();
+}
+
+/* take up to max_batch inputs shaped like the oldest one, called with the
+ * mutex held */
+static void take_batch(InferBatcher *b, std::vector<BatchRequest *> &batch)
+{
+    BatchRequest **p = &b->first, *req;
+    torch::Tensor shape = b->first->input;
+
+    b->last = NULL;
+    while ((req = *p)) {
+        if ((int)batch.size() < b->max_batch && same_shape(req->input, shape)) {
+            *p = req->next;
+            batch.push_back(req);
+            b->nb_pending--;
+        } else {
+            b->last = req;
+            p = &req->next;
+        }
+    }
+}
+
+static int count_batch(InferBatcher *b)
+{
+    BatchRequest *req;
+    int n = 0;
+
+    for (req = b->first; req && n < b->max_batch; req = req->next)
+        n += same_shape(req->input, b->first->input);
+    return n;
+}
+
+static void run_batch(InferBatcher *b, std::vector<BatchRequest *> &batch)
+{
+    std::vector<torch::Tensor> inputs;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < batch.size(); i++)
+        inputs.push_back(batch[i]->input);
+    try {
+        auto out = b->forward(b->opaque, batch.size() > 1 ? torch::cat(inputs, 0) : inputs[0]);
+        if (out.dim() == 2)
+            out = out.unsqueeze(0);
+        for (i = 0; i < batch.size(); i++)
+            batch[i]->mask = out[i].contiguous();
+    } catch (const c10::Error &e) {
+        av_log(NULL, AV_LOG_ERROR, "Batched forward pass of %d inputs failed: %s\n",
+               (int)batch.size(), e.what_without_backtrace());
+        ret = AVERROR_EXTERNAL;
+    }
+    for (i = 0; i < batch.size(); i++)
+        batch[i]->ret = ret;
+}
+
+static int batcher_thread(void *arg)
+{
+    InferBatcher *b = (InferBatcher *)arg;
+    std::vector<BatchRequest *> batch, callbacks;
+    torch::NoGradGuard no_grad;
+    int64_t now, deadline;
+    size_t i;
+
+    if (b->nb_threads > 0)
+        at::set_num_threads(b->nb_threads);
+
+    SDL_LockMutex(b->mutex);
+    for (;;) {
+        while (!b->first && !b->abort_request)
+            SDL_CondWait(b->cond, b->mutex);
+        if (!b->first)
+            break;
+
+        /* wait for more inputs unless the batch is full, every client is
+         * already waiting, or the oldest input reached the latency cap */
+        now      = av_gettime_relative();
+        deadline = b->first->submitted + b->max_wait;
+        if (!b->abort_request && now < deadline && b->nb_pending < b->nb_clients &&
+            count_batch(b) < b->max_batch) {
+            SDL_CondWaitTimeout(b->cond, b->mutex, FFMAX(1, (deadline - now + 999) / 1000));
+            continue;
+        }
+
+        batch.clear();
+        take_batch(b, batch);
+        SDL_UnlockMutex(b->mutex);
+
+        run_batch(b, batch);
+
+        SDL_LockMutex(b->mutex);
+        b->nb_batches++;
+        b->nb_inputs += batch.size();
+        /* a waiting thread may free its request as soon as it is done, so
+         * only the requests with a callback are looked at afterwards */
+        callbacks.clear();
+        for (i = 0; i < batch.size(); i++) {
+            b->wait_time += now - batch[i]->submitted;
+            if (batch[i]->done_func)
+                callbacks.push_back(batch[i]);
+            else
+                batch[i]->done = 1;
+        }
+        batch.clear();
+        SDL_CondBroadcast(b->done_cond);
+        SDL_UnlockMutex(b->mutex);
+
+        for (i = 0; i < callbacks.size(); i++) {
+            callbacks[i]->done_func(callbacks[i]->opaque, callbacks[i]->ret, callbacks[i]->mask, now);
+            delete callbacks[i];
+        }
+        SDL_LockMutex(b->mutex);
+    }
+    SDL_UnlockMutex(b->mutex);
+    return 0;
+}
+
+int infer_batcher_open(InferBatcher **pb, int max_batch, int64_t max_wait,
+                       int nb_threads, BatchForwardFunc forward, void *opaque)
+{
+    InferBatcher *b = new InferBatcher();
+
+    *pb = NULL;
+    b->max_batch  = FFMAX(max_batch, 1);
+    b->max_wait   = FFMAX(max_wait, 0);
+    b->nb_threads = nb_threads;
+    b->forward    = forward;
+    b->opaque     = opaque;
+    b->mutex      = SDL_CreateMutex();
+    b->cond       = SDL_CreateCond();
+    b->done_cond  = SDL_CreateCond();
+    if (!b->mutex || !b->cond || !b->done_cond) {
+        infer_batcher_close(&b);
+        return AVERROR(ENOMEM);
+    }
+    if (!(b->tid = SDL_CreateThread(batcher_thread, "batcher", b))) {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        infer_batcher_close(&b);
+        return AVERROR(ENOMEM);
+    }
+    *pb = b;
+    return 0;
+}
+
+void infer_batcher_close(InferBatcher **pb)
+{
+    InferBatcher *b = *pb;
+
+    if (!b)
+        return;
+    if (b->tid) {
+        SDL_LockMutex(b->mutex);
+        b->abort_request = 1;
+        SDL_CondSignal(b->cond);
+        SDL_UnlockMutex(b->mutex);
+        SDL_WaitThread(b->tid, NULL);
+    }
+    if (b->nb_batches)
+        av_log(NULL, AV_LOG_INFO, "batcher: %"PRId64" inputs in %"PRId64" batches, %.2f per batch, "
+               "%.1f ms mean wait\n", b->nb_inputs, b->nb_batches, b->nb_inputs / (double)b->nb_batches,
+               b->wait_time / 1000.0 / b->nb_inputs);
+    SDL_DestroyCond(b->done_cond);
+    SDL_DestroyCond(b->cond);
+    SDL_DestroyMutex(b->mutex);
+    delete b;
+    *pb = NULL;
+}
+
+void infer_batcher_add_client(InferBatcher *b)
+{
+    SDL_LockMutex(b->mutex);
+    b->nb_clients++;
+    SDL_UnlockMutex(b->mutex);
+}
+
+void infer_batcher_remove_client(InferBatcher *b)
+{
+    SDL_LockMutex(b->mutex);
+    b->nb_clients--;
+    /* the others may all be waiting now */
+    SDL_CondSignal(b->cond);
+    SDL_UnlockMutex(b->mutex);
+}
+
+/* queue req for the next batches, called with the mutex held */
+static void enqueue(InferBatcher *b, BatchRequest *req)
+{
+    req->submitted = av_gettime_relative();
+    req->done      = 0;
+    req->ret       = 0;
+    req->next      = NULL;
+    if (b->last)
+        b->last->next = req;
+    else
+        b->first = req;
+    b->last = req;
+    b->nb_pending++;
+    SDL_CondSignal(b->cond);
+}
+
+int infer_batcher_run(InferBatcher *b, const torch::Tensor &input, torch::Tensor &mask)
+{
+    BatchRequest req;
+
+    req.input     = input;
+    req.done_func = NULL;
+    req.opaque    = NULL;
+
+    SDL_LockMutex(b->mutex);
+    enqueue(b, &req);
+    while (!req.done)
+        SDL_CondWait(b->done_cond, b->mutex);
+    SDL_UnlockMutex(b->mutex);
+
+    if (req.ret >= 0)
+        mask = req.mask;
+    return req.ret;
+}
+
+int infer_batcher_submit(InferBatcher *b, const torch::Tensor &input, BatchDoneFunc done, void *opaque)
+{
+    BatchRequest *req = new BatchRequest();
+
+    req->input     = input;
+    req->done_func = done;
+    req->opaque    = opaque;
+
+    SDL_LockMutex(b->mutex);
+    enqueue(b, req);
+    SDL_UnlockMutex(b->mutex);
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Batching scheduler: one forward pass for the pictures of several streams
+ *
+ * Every stream keeps its own inference threads for preprocessing, masks
+ * and ordering, but hands its network input to the batcher instead of
+ * running the model itself. The batcher thread stacks the inputs of the
+ * same shape that are waiting and runs them as one batch as soon as
+ * max_batch of them are there, every registered client has one waiting,
+ * or the oldest has waited max_wait microseconds.
+ */
+
+#ifndef BATCHER_H
+#define BATCHER_H
+
+#include <stdint.h>
+
+#include <torch/torch.h>
+
+/**
+ * Run the model on a batch of inputs, N x C x H x W, and return one GRAY8
+ * mask per input, N x H' x W' (or H' x W' for N = 1) uint8 on the CPU.
+ */
+typedef torch::Tensor (*BatchForwardFunc)(void *opaque, const torch::Tensor &batch);
+
+/**
+ * Called on the batcher thread when the mask of a submitted input is
+ * ready, ret < 0 if the forward pass failed. started is the
+ * av_gettime_relative() of the start of its batch.
+ */
+typedef void (*BatchDoneFunc)(void *opaque, int ret, const torch::Tensor &mask, int64_t started);
+
+typedef struct InferBatcher InferBatcher;
+
+/**
+ * Start the batcher thread. It sets nb_threads intra-op threads for the
+ * forward passes, 0 leaves the libtorch default.
+ */
+int infer_batcher_open(InferBatcher **b, int max_batch, int64_t max_wait,
+                       int nb_threads, BatchForwardFunc forward, void *opaque);
+
+/**
+ * Finish the pending batches, stop the thread and log how full the
+ * batches were.
+ */
+void infer_batcher_close(InferBatcher **b);
+
+/**
+ * Count a thread that will submit inputs. While every client has an input
+ * waiting, the batch does not wait for the latency cap.
+ */
+void infer_batcher_add_client(InferBatcher *b);
+void infer_batcher_remove_client(InferBatcher *b);
+
+/**
+ * Submit one input, 1 x C x H x W, and wait for its mask. The input is
+ * only read until the call returns.
+ *
+ * @return 0, or <0 if the forward pass failed
+ */
+int infer_batcher_run(InferBatcher *b, const torch::Tensor &input, torch::Tensor &mask);
+
+/**
+ * Submit one input without waiting; done is called with its mask. The
+ * data of input must stay valid until then.
+ */
+int infer_batcher_submit(InferBatcher *b, const torch::Tensor &input, BatchDoneFunc done, void *opaque);
+
+#endif /* BATCHER_H */
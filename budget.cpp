@@ -0,0 +1,113 @@
+/*
+ * Thread budget: one total thread count shared by the stages of the player
+ */
+
+#include "budget.h"
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+}
+
+/* a stage gives a thread away below LOW utilization, takes one above HIGH */
+#define BUDGET_LOW  0.5
+#define BUDGET_HIGH 0.85
+
+static const char * const stage_names[BUDGET_NB] = {
+    "decode", "filter", "infer", "convert",
+};
+
+static struct {
+    SDL_mutex *mutex;
+    int total;
+    int share[BUDGET_NB];
+} budget;
+
+int budget_init(int total)
+{
+    int rest;
+
+    if (total <= 0)
+        return 0;
+    if (!(budget.mutex = SDL_CreateMutex()))
+        return AVERROR(ENOMEM);
+    budget.total = total = FFMAX(total, BUDGET_NB);
+
+    /* the render thread converts, the graph mostly scales, the network
+     * takes most of the rest */
+    budget.share[BUDGET_CONVERT] = 1;
+    budget.share[BUDGET_FILTER]  = 1;
+    rest = total - 2;
+    budget.share[BUDGET_DECODE]  = FFMAX(1, rest / 4);
+    budget.share[BUDGET_INFER]   = rest - budget.share[BUDGET_DECODE];
+
+    av_log(NULL, AV_LOG_VERBOSE, "thread budget %d: decode %d, filter %d, infer %d, convert %d\n",
+           total, budget.share[BUDGET_DECODE], budget.share[BUDGET_FILTER],
+           budget.share[BUDGET_INFER], budget.share[BUDGET_CONVERT]);
+    return 0;
+}
+
+void budget_uninit(void)
+{
+    SDL_DestroyMutex(budget.mutex);
+    budget.mutex = NULL;
+    budget.total = 0;
+}
+
+int budget_active(void)
+{
+    return budget.total > 0;
+}
+
+int budget_get(enum BudgetStage stage)
+{
+    int n;
+
+    if (!budget.total)
+        return 0;
+    SDL_LockMutex(budget.mutex);
+    n = budget.share[stage];
+    SDL_UnlockMutex(budget.mutex);
+    return n;
+}
+
+int budget_rebalance(const double *util)
+{
+    int from = -1, to = -1, i;
+
+    if (!budget.total)
+        return 0;
+
+    /* the busiest stage takes a thread from the least busy one; convert
+     * runs on the render thread and stays at one */
+    for (i = 0; i < BUDGET_NB; i++) {
+        if (i == BUDGET_CONVERT || util[i] < 0)
+            continue;
+        if (util[i] > BUDGET_HIGH && (to < 0 || util[i] > util[to]))
+            to = i;
+    }
+    if (to < 0)
+        return 0;
+    SDL_LockMutex(budget.mutex);
+    for (i = 0; i < BUDGET_NB; i++) {
+        if (i == BUDGET_CONVERT || i == to || budget.share[i] <= 1)
+            continue;
+        /* a stage that did not run keeps its threads for when it does */
+        if (util[i] >= 0 && util[i] < BUDGET_LOW && (from < 0 || util[i] < util[from]))
+            from = i;
+    }
+    if (from >= 0) {
+        budget.share[from]--;
+        budget.share[to]++;
+        av_log(NULL, AV_LOG_VERBOSE, "thread budget: %s %.0f%% busy, %s %.0f%%, now %d and %d threads\n",
+               stage_names[to], 100.0 * util[to], stage_names[from], 100.0 * util[from],
+               budget.share[to], budget.share[from]);
+    }
+    SDL_UnlockMutex(budget.mutex);
+    return from >= 0;
+}
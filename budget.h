@@ -0,0 +1,54 @@
+/*
+ * Thread budget: one total thread count shared by the stages of the player
+ *
+ * Left alone, libavcodec, libavfilter and libtorch each start a thread per
+ * core. With a budget, every stage asks for its share instead. The shares
+ * follow the measured utilization: a stage that is mostly idle hands a
+ * thread to a busier one, one thread per period, never going below one.
+ *
+ * Inference applies its share before every picture. The decoder and the
+ * filtergraph size their thread pools when they are opened, so a change
+ * of their share applies to the next decoder or graph; until then the
+ * threads a stage gave away are the ones it leaves idle.
+ */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+enum BudgetStage {
+    BUDGET_DECODE,      /* libavcodec frame or slice threads of the video decoder */
+    BUDGET_FILTER,      /* libavfilter slice threads of the video graph */
+    BUDGET_INFER,       /* libtorch intra-op threads, over all replicas */
+    BUDGET_CONVERT,     /* swscale on the render thread, not resizable */
+    BUDGET_NB
+};
+
+/**
+ * Split total threads among the stages. 0 disables the budget, every
+ * stage then sizes itself as before.
+ */
+int budget_init(int total);
+
+void budget_uninit(void);
+
+/**
+ * @return 1 if a budget was set
+ */
+int budget_active(void);
+
+/**
+ * @return the current share of stage, at least 1, or 0 without a budget
+ */
+int budget_get(enum BudgetStage stage);
+
+/**
+ * Move threads between the stages from their utilization over the last
+ * period, util[stage] in 0..1 or negative when the stage did not run.
+ *
+ * @return 1 if a share changed
+ */
+int budget_rebalance(const double *util);
+
+#endif /* BUDGET_H */
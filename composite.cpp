@@ -0,0 +1,97 @@
+/*
+ * Blend a saliency mask into a YUV 4:2:0 picture
+ *
+ * Each row is one loop over contiguous bytes with 16 bit intermediates,
+ * left to the compiler to vectorize, this file is built with -O3 like
+ * preprocess.cpp.
+ */
+
+#include "composite.h"
+
+#include <string.h>
+
+/* keep a quarter of the luma where the mask is 0 */
+static void dim_row(uint8_t *y, const uint8_t *m, int w)
+{
+    int i;
+
+    for (i = 0; i < w; i++) {
+        int weight = 64 + (m[i] * 192 >> 8);
+        y[i] = 16 + ((y[i] - 16) * weight >> 8);
+    }
+}
+
+/* push Cr up and Cb down by up to a quarter of their range */
+static void tint_row(uint8_t *u, uint8_t *v, const uint8_t *m, int w)
+{
+    int i;
+
+    for (i = 0; i < w; i++) {
+        int shift = m[2 * i] >> 2;
+        int cb = u[i] - (shift >> 1);
+        int cr = v[i] + shift;
+        u[i] = cb < 16  ? 16  : cb;
+        v[i] = cr > 240 ? 240 : cr;
+    }
+}
+
+static void mask_row(uint8_t *y, const uint8_t *m, int w)
+{
+    int i;
+
+    for (i = 0; i < w; i++)
+        y[i] = 16 + (m[i] * 219 + 127) / 255;
+}
+
+void composite_yuv420(uint8_t * const data[3], const int linesize[3], int width, int height,
+                      const uint8_t *mask, int mask_linesize, enum CompositeMode mode)
+{
+    int cw = width >> 1, ch = height >> 1;
+    int j;
+
+    switch (mode) {
+    case COMPOSITE_DIM:
+        for (j = 0; j < height; j++)
+            dim_row(data[0] + j * linesize[0], mask + j * mask_linesize, width);
+        break;
+    case COMPOSITE_TINT:
+        /* chroma samples take the mask of their top left luma sample */
+        for (j = 0; j < ch; j++)
+            tint_row(data[1] + j * linesize[1], data[2] + j * linesize[2],
+                     mask + 2 * j * mask_linesize, cw);
+        break;
+    case COMPOSITE_MASK:
+        for (j = 0; j < height; j++)
+            mask_row(data[0] + j * linesize[0], mask + j * mask_linesize, width);
+        for (j = 0; j < ch; j++) {
+            memset(data[1] + j * linesize[1], 128, cw);
+            memset(data[2] + j * linesize[2], 128, cw);
+        }
+        break;
+    }
+}
+
+void composite_mask_argb(uint8_t *dst, int pitch, int width, int height,
+                         const uint8_t *mask, int mask_linesize, enum CompositeMode mode)
+{
+    int i, j;
+
+    for (j = 0; j < height; j++) {
+        uint32_t *out = (uint32_t *)(dst + j * pitch);
+        const uint8_t *m = mask + j * mask_linesize;
+        switch (mode) {
+        case COMPOSITE_DIM:     /* black, opaque enough to keep a quarter where m is 0 */
+            for (i = 0; i < width; i++)
+                out[i] = (uint32_t)(192 - (m[i] * 192 >> 8)) << 24;
+            break;
+        case COMPOSITE_TINT:    /* red, up to a quarter where m is 255 */
+            for (i = 0; i < width; i++)
+                out[i] = (uint32_t)(m[i] >> 2) << 24 | 0xff0000;
+            break;
+        case COMPOSITE_MASK:
+            for (i = 0; i < width; i++)
+                out[i] = 0xff000000 | m[i] * 0x010101u;
+            break;
+        }
+    }
+}
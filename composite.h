@@ -0,0 +1,32 @@
+/*
+ * Blend a saliency mask into a YUV 4:2:0 picture
+ *
+ * The picture is the display sized copy in the streaming texture, the mask
+ * has already been scaled to the same size. Width and height are even.
+ * Limited range samples are assumed, which is what swscale writes for
+ * yuv420p.
+ */
+
+#ifndef COMPOSITE_H
+#define COMPOSITE_H
+
+#include <stdint.h>
+
+enum CompositeMode {
+    COMPOSITE_DIM,      /* darken the picture where the mask is low */
+    COMPOSITE_TINT,     /* shift the color towards red where the mask is high */
+    COMPOSITE_MASK,     /* show the mask alone, as gray */
+};
+
+void composite_yuv420(uint8_t * const data[3], const int linesize[3], int width, int height,
+                      const uint8_t *mask, int mask_linesize, enum CompositeMode mode);
+
+/**
+ * Turn the mask into ARGB8888 pixels (native endian 32 bit words) that,
+ * alpha blended over the picture, give about the same look as
+ * composite_yuv420 with the same mode.
+ */
+void composite_mask_argb(uint8_t *dst, int pitch, int width, int height,
+                         const uint8_t *mask, int mask_linesize, enum CompositeMode mode);
+
+#endif /* COMPOSITE_H */
@@ -66,8 +66,28 @@ extern "C"
 #include <chrono>
 #include <time.h>
 #include "networks/poolnet.h"
+#include "networks/profiler.h"
+#include "mask_cache.h"
+#include "sidecar.h"
+#include "saliency_encoder.h"
+#include "preprocess.h"
+#include "composite.h"
+#include "vf_saliency.h"
+#include "placement.h"
+#include "budget.h"
+#include "spsc_ring.h"
+#include "batcher.h"
+#include "infer_ipc.h"
+#include "infer_daemon.h"
 
 #include <assert.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 // using namespace std;
 // using namespace std::chrono;
@@ -75,7 +95,6 @@ extern "C"
 const char program_name[] = "ffplay";
 const int program_birth_year = 2003;
 
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
 #define MIN_FRAMES 25
 #define EXTERNAL_CLOCK_MIN_FRAMES 2
 #define EXTERNAL_CLOCK_MAX_FRAMES 10
@@ -117,6 +136,12 @@ const int program_birth_year = 2003;
 
 #define CURSOR_HIDE_DELAY 1000000
 
+/* inputs played side by side in one process */
+#define MAX_INPUTS 16
+
+/* default batch of -infer_daemon, which does not know its clients yet */
+#define INFER_DAEMON_BATCH 8
+
 #define USE_ONEPASS_SUBTITLE_RENDER 1
 
 static unsigned sws_flags = SWS_BICUBIC;
@@ -127,8 +152,21 @@ typedef struct MyAVPacketList {
     int serial;
 } MyAVPacketList;
 
+/* nodes are allocated this many at a time and recycled until the queue
+ * is destroyed */
+#define PACKET_NODE_SLAB 64
+
+typedef struct PacketNodeSlab {
+    struct PacketNodeSlab *next;
+    MyAVPacketList nodes[PACKET_NODE_SLAB];
+} PacketNodeSlab;
+
 typedef struct PacketQueue {
     MyAVPacketList *first_pkt, *last_pkt;
+    MyAVPacketList *free_pkt;       /* unused nodes, under mutex */
+    PacketNodeSlab *slabs;
+    int64_t nb_puts;                /* nodes handed out */
+    int nb_slabs;
     int nb_packets;
     int size;
     int64_t duration;
@@ -138,7 +176,7 @@ typedef struct PacketQueue {
     SDL_cond *cond;
 } PacketQueue;
 
-#define VIDEO_PICTURE_QUEUE_SIZE 3
+#define VIDEO_PICTURE_QUEUE_SIZE 3    /* depth of pictq until inference latency is known */
 #define SUBPICTURE_QUEUE_SIZE 16
 #define SAMPLE_QUEUE_SIZE 9
 #define FRAME_QUEUE_SIZE FFMAX(SAMPLE_QUEUE_SIZE, FFMAX(VIDEO_PICTURE_QUEUE_SIZE, SUBPICTURE_QUEUE_SIZE))
@@ -162,9 +200,19 @@ typedef struct Clock {
     int *queue_serial;    /* pointer to the current packet queue serial, used for obsolete clock detection */
 } Clock;
 
+/* the stage that made a dropped picture late */
+enum {
+    DROP_DECODE,
+    DROP_FILTER,
+    DROP_INFER,
+    DROP_NB
+};
+
 /* Common struct for handling all types of decoded data and allocated render buffers. */
 typedef struct Frame {
     AVFrame *frame;
+    AVFrame *mask;        /* GRAY8 saliency mask attached by the inference stage */
+    AVFrame *analysis;    /* the picture at the network input size, from the analysis branch */
     AVSubtitle sub;
     int serial;
     double pts;           /* presentation timestamp for the frame */
@@ -176,27 +224,46 @@ typedef struct Frame {
     AVRational sar;
     int uploaded;
     int flip_v;
+    int drop_cause;       /* DROP_* blamed if the picture is dropped late */
 } Frame;
 
 typedef struct FrameQueue {
     Frame queue[FRAME_QUEUE_SIZE];
-    int rindex;
-    int windex;
-    int size;
+    SpscRing ring;          /* pushed and popped counts, no lock */
+    int rindex;             /* consumer side */
+    int windex;             /* producer side */
     int max_size;
     int keep_last;
     int rindex_shown;
-    SDL_mutex *mutex;
-    SDL_cond *cond;
+    SDL_mutex *mutex;       /* not used by the queue, callers update the clocks under it */
     PacketQueue *pktq;
 } FrameQueue;
 
+/* what the inference scheduler does with a picture */
+enum {
+    INFER_FULL,     /* PoolNet at the full network input size */
+    INFER_DOWN,     /* half the input size, about a quarter of the work */
+    INFER_SKIP,     /* no forward pass, reuse the last mask */
+    INFER_NB
+};
+
 enum {
     AV_SYNC_AUDIO_MASTER, /* default choice */
     AV_SYNC_VIDEO_MASTER,
     AV_SYNC_EXTERNAL_CLOCK, /* synchronize to an external clock */
 };
 
+/* a picture in the inference reorder buffer, released to pictq in decoding order */
+typedef struct InferSlot {
+    Frame f;
+    int64_t seq;          /* order in which the picture left infq */
+    int level;            /* INFER_FULL, INFER_DOWN or INFER_SKIP */
+    int done;             /* mask computed (or picture found obsolete) */
+    int dropped;          /* too late even before the network, not shown */
+} InferSlot;
+
+struct InferReplica;
+
 typedef struct Decoder {
     AVPacket pkt;
     PacketQueue *queue;
@@ -210,6 +277,7 @@ typedef struct Decoder {
     int64_t next_pts;
     AVRational next_pts_tb;
     SDL_Thread *decoder_tid;
+    int64_t wait_time;              /* microseconds spent waiting for packets */
 } Decoder;
 
 typedef struct VideoState {
@@ -232,6 +300,7 @@ typedef struct VideoState {
     Clock vidclk;
     Clock extclk;
 
+    FrameQueue infq;      /* decoded pictures waiting for the inference stage */
     FrameQueue pictq;
     FrameQueue subpq;
     FrameQueue sampq;
@@ -267,8 +336,8 @@ typedef struct VideoState {
 #endif
     struct AudioParams audio_tgt;
     struct SwrContext *swr_ctx;
-    int frame_drops_early;
-    int frame_drops_late;
+    int frame_drops_early[DROP_NB];
+    int frame_drops_late[DROP_NB];
 
     enum ShowMode {
         SHOW_MODE_NONE = -1, SHOW_MODE_VIDEO = 0, SHOW_MODE_WAVES, SHOW_MODE_RDFT, SHOW_MODE_NB
@@ -284,6 +353,7 @@ typedef struct VideoState {
     SDL_Texture *vis_texture;
     SDL_Texture *sub_texture;
     SDL_Texture *vid_texture;
+    SDL_Texture *mask_texture;      /* -mask_overlay */
 
     int subtitle_stream;
     AVStream *subtitle_st;
@@ -298,7 +368,43 @@ typedef struct VideoState {
     double max_frame_duration;      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
     struct SwsContext *img_convert_ctx;
     struct SwsContext *sub_convert_ctx;
+    struct SwsContext *mask_convert_ctx;
+    AVFrame *mask_scaled;           /* mask of the displayed picture at the composite size */
+    struct InferReplica *replicas;  /* PoolNet instances sharing the weights of model */
+    int nb_replicas;
+    struct InferReplica *filter_replica;    /* PoolNet of the saliency filters of -vf */
+    SaliencyPipeline *saliency_pipeline;    /* the -vf chain up to its last saliency filter */
+    int infer_width, infer_height;  /* network input at INFER_FULL */
+    enum PreprocessFit infer_fit;
+    int mask_width, mask_height;    /* full size masks of video_st, for the sidecar and -mask_out */
+    InferSlot *reorder;             /* reorder buffer, indexed by seq modulo reorder_size */
+    int reorder_size;               /* max pictures in flight between infq and pictq */
+    int64_t infer_next_seq;         /* seq of the next picture taken from infq */
+    int64_t infer_next_release;     /* seq of the next picture pushed to pictq */
+    int infer_taking;               /* a replica is waiting on infq */
+    int infer_releasing;            /* a replica is pushing the reorder buffer to pictq */
+    double infer_latency[INFER_SKIP];   /* running estimate of take-to-done time per level, in seconds */
+    double infer_latency_dev[INFER_SKIP];   /* running mean absolute deviation from it */
+    double video_min_duration;      /* seconds of video packets read_thread keeps queued, under pictq.mutex */
+    int infer_decisions[INFER_NB];
+    AVFrame *last_mask;             /* mask of the last picture released to pictq */
+    AVFrame *encode_frame, *encode_mask;    /* for the encoder, sent by the releasing replica without the mutex */
+    MaskCache *mask_cache;          /* masks by pts, reused after seeks and loops */
+    Sidecar *sidecar;               /* masks of earlier sessions, or the recording of this one */
+    int sidecar_vfilter_idx;        /* filter chain the sidecar masks belong to */
+    SaliencyEncoder *encoder;       /* -saliency_out */
+    SDL_mutex *infer_mutex;
+    SDL_cond *infer_cond;
     int eof;
+    int no_audio;                   /* another input plays its audio */
+
+    int64_t decode_busy;            /* microseconds video_thread was not waiting on videoq or infq */
+    int64_t budget_time;            /* start of the thread budget period */
+    int64_t budget_decode_busy, budget_infer_busy;  /* busy times at its start */
+
+    int audio_callback_placed;      /* the SDL audio thread moved to its CPUs */
+    PlacementJitter audio_jitter;   /* callback period against the buffer duration */
+    PlacementJitter display_jitter; /* picture display time against frame_timer */
 
     char *filename;
     int width, height, xleft, ytop;
@@ -308,6 +414,7 @@ typedef struct VideoState {
     int vfilter_idx;
     AVFilterContext *in_video_filter;   // the first filter in the video chain
     AVFilterContext *out_video_filter;  // the last filter in the video chain
+    AVFilterContext *out_analysis_filter;   // the network input branch, with -infer_branch
     AVFilterContext *in_audio_filter;   // the first filter in the audio chain
     AVFilterContext *out_audio_filter;  // the last filter in the audio chain
     AVFilterGraph *agraph;              // audio filter graph
@@ -324,16 +431,36 @@ typedef struct VideoState {
 #define SHOW_MODE_RDFT VideoState::ShowMode::SHOW_MODE_RDFT
 #define SHOW_MODE_NB VideoState::ShowMode::SHOW_MODE_NB
 
-static AVFrame *frameRGB = NULL;
-static int numBytes = 0;
-static uint8_t *buffer = NULL;
-static PoolNet net;
-static int input_image_size = 0;
-static int cnt = 0;
+/* one PoolNet worker of the inference stage */
+typedef struct InferReplica {
+    VideoState *is;
+    int index;
+    PoolNet net{nullptr};
+    PreprocessContext *pre[INFER_SKIP];
+    torch::Tensor input[INFER_SKIP];    /* network input, one per level, reused */
+    int warmed_up[INFER_SKIP];      /* first pass of a level is not a latency sample */
+    SDL_Thread *tid;
+    int cpu_first, nb_cpus;     /* core group when pinned, intra-op threads otherwise */
+    int nb_threads;             /* intra-op threads now */
+    int64_t nb_frames;
+    int64_t busy_time;          /* preprocessing and forward time in microseconds */
+    int64_t start_time;
+} InferReplica;
+
+/* fraction of the wall time a replica spent on pictures, 0..1 */
+static double inference_utilization(InferReplica *r, int64_t now)
+{
+    return r->start_time && now > r->start_time ? (double)r->busy_time / (now - r->start_time) : 0.0;
+}
+
+static PoolNet model;                /* weights as loaded, only read by the replicas */
+static torch::Device infer_device(torch::kCPU);
 
 /* options specified by the user */
 static AVInputFormat *file_iformat;
 static const char *input_filename;
+static const char *input_filenames[MAX_INPUTS];
+static int nb_inputs;
 static const char *window_title;
 static int default_width  = 640;
 static int default_height = 480;
@@ -380,6 +507,45 @@ static char *afilters = NULL;
 static int autorotate = 1;
 static int find_stream_info = 1;
 static int filter_nbthreads = 0;
+static int profile_net = 0;
+static const char *profile_json = NULL;
+static int infer_replicas = 1;
+static int infer_depth = 0;
+static int infer_pin = 0;
+static int infer_dispatch_rr = 0;
+static int infer_deadline = -1;
+static int mask_cache_mb = 64;
+static const char *sidecar_path = NULL;
+static const char *model_path = "../models/poolnet.pt";
+static uint64_t model_fingerprint = SIDECAR_HASH_INIT;
+static int offline = 0;
+static const char *mask_out = NULL;
+static int nb_shards = 0;
+static int infer_nhwc = 0;
+static enum CompositeMode mask_view = COMPOSITE_DIM;
+static int mask_overlay = 0;
+static int infer_width = 300;
+static int infer_height = 400;
+static enum PreprocessFit infer_fit = PREPROCESS_FIT_STRETCH;
+static int infer_branch = 0;
+static const char *cpu_layout = NULL;
+static int rt_prio = 0;
+static int thread_budget = 0;
+static float infer_mean[3] = { 0, 0, 0 };
+static float infer_std[3] = { 1, 1, 1 };
+static const char *saliency_out = NULL;
+static enum SaliencyOutputMode saliency_mode = SALIENCY_OUTPUT_OVERLAY;
+static const char *saliency_codec = NULL;
+static int64_t saliency_bit_rate = 0;
+static int saliency_queue = 16;
+static int headless = 0;
+static int infer_batch = 0;
+static int infer_batch_wait = 10;
+static const char *infer_daemon_path = NULL;
+static const char *infer_remote_path = NULL;
+static int picture_queue_max = 12;
+static int picture_queue_mb = 256;
+static int packet_queue_mb = 15;
 
 /* current context */
 static int is_full_screen;
@@ -391,6 +557,16 @@ static AVPacket flush_pkt;
 
 static SDL_Window *window;
 static SDL_Renderer *renderer;
+
+/* every input has its own VideoState, tiled in the window */
+static VideoState *open_streams[MAX_INPUTS];
+static int nb_open_streams;
+
+/* one forward pass for the pictures of all inputs, with -infer_batch */
+static InferBatcher *batcher;
+static struct InferReplica *batch_replica;
+/* the model runs in an inference daemon, with -infer_remote */
+static InferClient *infer_client;
 static SDL_RendererInfo renderer_info = {0};
 static SDL_AudioDeviceID audio_dev;
 
@@ -449,6 +625,36 @@ int64_t get_valid_channel_layout(int64_t channel_layout, int channels)
         return 0;
 }
 
+/* take a node from the free list, refilling it a slab at a time */
+static MyAVPacketList *packet_queue_alloc_node(PacketQueue *q)
+{
+    MyAVPacketList *pkt1;
+
+    if (!q->free_pkt) {
+        PacketNodeSlab *slab = av_malloc(sizeof(*slab));
+        int i;
+
+        if (!slab)
+            return NULL;
+        for (i = 0; i < PACKET_NODE_SLAB; i++)
+            slab->nodes[i].next = i + 1 < PACKET_NODE_SLAB ? &slab->nodes[i + 1] : NULL;
+        slab->next = q->slabs;
+        q->slabs = slab;
+        q->nb_slabs++;
+        q->free_pkt = &slab->nodes[0];
+    }
+    pkt1 = q->free_pkt;
+    q->free_pkt = pkt1->next;
+    q->nb_puts++;
+    return pkt1;
+}
+
+static void packet_queue_free_node(PacketQueue *q, MyAVPacketList *pkt1)
+{
+    pkt1->next = q->free_pkt;
+    q->free_pkt = pkt1;
+}
+
 static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt)
 {
     MyAVPacketList *pkt1;
@@ -456,7 +662,7 @@ static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt)
     if (q->abort_request)
        return -1;
 
-    pkt1 = av_malloc(sizeof(MyAVPacketList));
+    pkt1 = packet_queue_alloc_node(q);
     if (!pkt1)
         return -1;
     pkt1->pkt = *pkt;
@@ -528,7 +734,7 @@ static void packet_queue_flush(PacketQueue *q)
     for (pkt = q->first_pkt; pkt; pkt = pkt1) {
         pkt1 = pkt->next;
         av_packet_unref(&pkt->pkt);
-        av_freep(&pkt);
+        packet_queue_free_node(q, pkt);
     }
     q->last_pkt = NULL;
     q->first_pkt = NULL;
@@ -538,9 +744,18 @@ static void packet_queue_flush(PacketQueue *q)
     SDL_UnlockMutex(q->mutex);
 }
 
-static void packet_queue_destroy(PacketQueue *q)
+static void packet_queue_destroy(PacketQueue *q, const char *name)
 {
+    PacketNodeSlab *slab, *next;
+
     packet_queue_flush(q);
+    if (q->nb_puts)
+        av_log(NULL, AV_LOG_VERBOSE, "%s packet queue: %"PRId64" packets, %d node allocations "
+               "(%"PRId64" avoided)\n", name, q->nb_puts, q->nb_slabs, q->nb_puts - q->nb_slabs);
+    for (slab = q->slabs; slab; slab = next) {
+        next = slab->next;
+        av_free(slab);
+    }
     SDL_DestroyMutex(q->mutex);
     SDL_DestroyCond(q->cond);
 }
@@ -589,7 +804,7 @@ static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *seria
             *pkt = pkt1->pkt;
             if (serial)
                 *serial = pkt1->serial;
-            av_free(pkt1);
+            packet_queue_free_node(q, pkt1);
             ret = 1;
             break;
         } else if (!block) {
@@ -666,7 +881,10 @@ static int decoder_decode_frame(Decoder *d, AVFrame *frame, AVSubtitle *sub) {
                 av_packet_move_ref(&pkt, &d->pkt);
                 d->packet_pending = 0;
             } else {
-                if (packet_queue_get(d->queue, &pkt, 1, &d->pkt_serial) < 0)
+                int64_t wait_start = av_gettime_relative();
+                int got = packet_queue_get(d->queue, &pkt, 1, &d->pkt_serial);
+                d->wait_time += av_gettime_relative() - wait_start;
+                if (got < 0)
                     return -1;
             }
             if (d->queue->serial == d->pkt_serial)
@@ -704,6 +922,14 @@ static int decoder_decode_frame(Decoder *d, AVFrame *frame, AVSubtitle *sub) {
     }
 }
 
+static int frame_drops_total(VideoState *is)
+{
+    int i, n = 0;
+    for (i = 0; i < DROP_NB; i++)
+        n += is->frame_drops_early[i] + is->frame_drops_late[i];
+    return n;
+}
+
 static void decoder_destroy(Decoder *d) {
     av_packet_unref(&d->pkt);
     avcodec_free_context(&d->avctx);
@@ -712,26 +938,29 @@ static void decoder_destroy(Decoder *d) {
 static void frame_queue_unref_item(Frame *vp)
 {
     av_frame_unref(vp->frame);
+    av_frame_unref(vp->mask);
+    av_frame_unref(vp->analysis);
     avsubtitle_free(&vp->sub);
 }
 
 static int frame_queue_init(FrameQueue *f, PacketQueue *pktq, int max_size, int keep_last)
 {
     int i;
-    memset(f, 0, sizeof(FrameQueue));
+    /* the ring holds atomics, it is constructed by spsc_ring_init */
+    memset(f->queue, 0, sizeof(f->queue));
+    f->rindex = f->windex = f->rindex_shown = 0;
     if (!(f->mutex = SDL_CreateMutex())) {
         av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex(): %s\n", SDL_GetError());
         return AVERROR(ENOMEM);
     }
-    if (!(f->cond = SDL_CreateCond())) {
-        av_log(NULL, AV_LOG_FATAL, "SDL_CreateCond(): %s\n", SDL_GetError());
-        return AVERROR(ENOMEM);
-    }
     f->pktq = pktq;
     f->max_size = FFMIN(max_size, FRAME_QUEUE_SIZE);
+    spsc_ring_init(&f->ring, f->max_size);
     f->keep_last = !!keep_last;
     for (i = 0; i < f->max_size; i++)
-        if (!(f->queue[i].frame = av_frame_alloc()))
+        if (!(f->queue[i].frame = av_frame_alloc()) ||
+            !(f->queue[i].mask = av_frame_alloc()) ||
+            !(f->queue[i].analysis = av_frame_alloc()))
             return AVERROR(ENOMEM);
     return 0;
 }
@@ -743,16 +972,15 @@ static void frame_queue_destory(FrameQueue *f)
         Frame *vp = &f->queue[i];
         frame_queue_unref_item(vp);
         av_frame_free(&vp->frame);
+        av_frame_free(&vp->mask);
+        av_frame_free(&vp->analysis);
     }
     SDL_DestroyMutex(f->mutex);
-    SDL_DestroyCond(f->cond);
 }
 
 static void frame_queue_signal(FrameQueue *f)
 {
-    SDL_LockMutex(f->mutex);
-    SDL_CondSignal(f->cond);
-    SDL_UnlockMutex(f->mutex);
+    spsc_ring_wake(&f->ring);
 }
 
 static Frame *frame_queue_peek(FrameQueue *f)
@@ -770,17 +998,21 @@ static Frame *frame_queue_peek_last(FrameQueue *f)
     return &f->queue[f->rindex];
 }
 
+/* let the producer fill at most depth of the max_size slots */
+static void frame_queue_set_depth(FrameQueue *f, int depth)
+{
+    spsc_ring_set_capacity(&f->ring, av_clip(depth, 1, f->max_size));
+}
+
+static int frame_queue_depth(FrameQueue *f)
+{
+    return f->ring.capacity;
+}
+
 static Frame *frame_queue_peek_writable(FrameQueue *f)
 {
     /* wait until we have space to put a new frame */
-    SDL_LockMutex(f->mutex);
-    while (f->size >= f->max_size &&
-           !f->pktq->abort_request) {
-        SDL_CondWait(f->cond, f->mutex);
-    }
-    SDL_UnlockMutex(f->mutex);
-
-    if (f->pktq->abort_request)
+    if (spsc_ring_wait_writable(&f->ring, &f->pktq->abort_request) < 0)
         return NULL;
 
     return &f->queue[f->windex];
@@ -789,27 +1021,23 @@ static Frame *frame_queue_peek_writable(FrameQueue *f)
 static Frame *frame_queue_peek_readable(FrameQueue *f)
 {
     /* wait until we have a readable a new frame */
-    SDL_LockMutex(f->mutex);
-    while (f->size - f->rindex_shown <= 0 &&
-           !f->pktq->abort_request) {
-        SDL_CondWait(f->cond, f->mutex);
-    }
-    SDL_UnlockMutex(f->mutex);
-
-    if (f->pktq->abort_request)
+    if (spsc_ring_wait_readable(&f->ring, f->rindex_shown, &f->pktq->abort_request, -1) < 0)
         return NULL;
 
     return &f->queue[(f->rindex + f->rindex_shown) % f->max_size];
 }
 
+/* wait at most timeout_ms for a frame to read, without taking it */
+static void frame_queue_wait_readable(FrameQueue *f, int timeout_ms)
+{
+    spsc_ring_wait_readable(&f->ring, f->rindex_shown, &f->pktq->abort_request, timeout_ms);
+}
+
 static void frame_queue_push(FrameQueue *f)
 {
     if (++f->windex == f->max_size)
         f->windex = 0;
-    SDL_LockMutex(f->mutex);
-    f->size++;
-    SDL_CondSignal(f->cond);
-    SDL_UnlockMutex(f->mutex);
+    spsc_ring_push(&f->ring);
 }
 
 static void frame_queue_next(FrameQueue *f)
@@ -821,16 +1049,13 @@ static void frame_queue_next(FrameQueue *f)
     frame_queue_unref_item(&f->queue[f->rindex]);
     if (++f->rindex == f->max_size)
         f->rindex = 0;
-    SDL_LockMutex(f->mutex);
-    f->size--;
-    SDL_CondSignal(f->cond);
-    SDL_UnlockMutex(f->mutex);
+    spsc_ring_pop(&f->ring);
 }
 
 /* return the number of undisplayed frames in the queue */
 static int frame_queue_nb_remaining(FrameQueue *f)
 {
-    return f->size - f->rindex_shown;
+    return spsc_ring_size(&f->ring) - f->rindex_shown;
 }
 
 /* return last shown position */
@@ -932,129 +1157,68 @@ static void get_sdl_pix_fmt_and_blendmode(int format, Uint32 *sdl_pix_fmt, SDL_B
     }
 }
 
-static int my_upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx) {
-    int ret = 0;
-    Uint32 sdl_pix_fmt;
-    SDL_BlendMode sdl_blendmode;
-    get_sdl_pix_fmt_and_blendmode(frame->format, &sdl_pix_fmt, &sdl_blendmode);
-    if (realloc_texture(tex, sdl_pix_fmt == SDL_PIXELFORMAT_UNKNOWN ? SDL_PIXELFORMAT_ARGB8888 : sdl_pix_fmt, frame->width, frame->height, sdl_blendmode, 0) < 0)
+/* Scale frame to w x h straight into the streaming texture and blend the
+ * mask into it there. frame is only read, it may be shared with the
+ * saliency encoder and is redisplayed as is after a resize. */
+static int upload_composite(VideoState *is, SDL_Texture **tex, AVFrame *frame, AVFrame *mask, int w, int h)
+{
+    uint8_t *pixels, *data[4] = { NULL };
+    int pitch, linesize[4] = { 0 };
+    AVFrame *m = is->mask_scaled;
+
+    if (realloc_texture(tex, SDL_PIXELFORMAT_IYUV, w, h, SDL_BLENDMODE_NONE, 0) < 0)
         return -1;
+    if (m->width != w || m->height != h) {
+        av_frame_unref(m);
+        m->format = AV_PIX_FMT_GRAY8;
+        m->width  = w;
+        m->height = h;
+        if (av_frame_get_buffer(m, 0) < 0)
+            return -1;
+    }
 
-    /* initilize frameRGB */
-    if (frameRGB == NULL) {
-        frameRGB = av_frame_alloc();
-        frameRGB->width = 300;
-        frameRGB->height = 400;
-        frameRGB->format = AV_PIX_FMT_RGB24;
-        numBytes = avpicture_get_size(frameRGB->format, frameRGB->width, frameRGB->height);
-        buffer = (uint8_t *)av_malloc(numBytes*sizeof(uint8_t));
-        avpicture_fill((AVPicture *)frameRGB, buffer, frameRGB->format, frameRGB->width, frameRGB->height);
-    }
-    
-    /* frame -> frameRGB */
-    *img_convert_ctx = sws_getCachedContext(*img_convert_ctx,
-        frame->width, frame->height, frame->format, 
-        frameRGB->width, frameRGB->height, frameRGB->format, 
-        sws_flags, NULL, NULL, NULL);
-    if (*img_convert_ctx != NULL) {
-        uint8_t *pixels[4];
-        int pitch[4];
-        if (!SDL_LockTexture(*tex, NULL, (void **)pixels, pitch)) {
-            sws_scale(*img_convert_ctx, (const uint8_t * const *)frame->data, frame->linesize,
-                0, frame->height, frameRGB->data, frameRGB->linesize);
-            SDL_UnlockTexture(*tex);
-        }
-    } else {
+    is->img_convert_ctx = sws_getCachedContext(is->img_convert_ctx,
+        frame->width, frame->height, frame->format, w, h,
+        AV_PIX_FMT_YUV420P, sws_flags, NULL, NULL, NULL);
+    is->mask_convert_ctx = sws_getCachedContext(is->mask_convert_ctx,
+        mask->width, mask->height, AV_PIX_FMT_GRAY8, w, h,
+        AV_PIX_FMT_GRAY8, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!is->img_convert_ctx || !is->mask_convert_ctx) {
         av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-        ret = -1;
+        return -1;
     }
+    sws_scale(is->mask_convert_ctx, (const uint8_t * const *)mask->data, mask->linesize,
+              0, mask->height, m->data, m->linesize);
 
-    /* frameRGB -> torch::Tensor */
-    auto img_tensor = torch::from_blob(frameRGB->data[0], {1, frameRGB->height, frameRGB->width, 3}, torch::kByte).to(torch::kCUDA);
-    img_tensor = img_tensor.permute({0,3,1,2});
-    img_tensor = img_tensor.toType(torch::kFloat);
-
-    /* torch::Tensor -> frameGRAY */
-    auto start = std::chrono::high_resolution_clock::now();
-    auto out = net->forward(img_tensor);
-    out.squeeze_();
-    out.sigmoid_();
-    out.mul_(255.0);
-    out = out.toType(torch::kByte);
-    out = out.to(torch::kCPU);
-    out = out.contiguous();
+    if (SDL_LockTexture(*tex, NULL, (void **)&pixels, &pitch) < 0)
+        return -1;
+    /* IYUV is one block: Y, then U and V at half the pitch */
+    data[0] = pixels;
+    data[1] = pixels + pitch * h;
+    data[2] = data[1] + pitch / 2 * (h / 2);
+    linesize[0] = pitch;
+    linesize[1] = linesize[2] = pitch / 2;
+    sws_scale(is->img_convert_ctx, (const uint8_t * const *)frame->data, frame->linesize,
+              0, frame->height, data, linesize);
+    composite_yuv420(data, linesize, w, h, m->data[0], m->linesize[0], mask_view);
+    SDL_UnlockTexture(*tex);
+    return 0;
+}
 
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-    // It should be known that it takes longer time at first time
-    std::cout << "inference taken : " << duration.count() << " ms" << std::endl;
-
-    /* frameGRAY -> frame */
-    auto frameGRAY = out;
-    int frameGRAY_width = frameRGB->width;
-    int frameGRAY_height = frameRGB->height;
-    *img_convert_ctx = sws_getCachedContext(*img_convert_ctx,
-        frameGRAY_width, frameGRAY_height, AV_PIX_FMT_GRAY8, 
-        frame->width, frame->height, frame->format, 
-        sws_flags, NULL, NULL, NULL);
-    if (*img_convert_ctx != NULL) {
-        uint8_t *pixels[4], *frameGRAY_data[8];
-        int pitch[4], frameGARY_linesize[8];
-        frameGRAY_data[0] = out.data_ptr();
-        frameGARY_linesize[0] = frameGRAY_width;
-        if (!SDL_LockTexture(*tex, NULL, (void **)pixels, pitch)) {
-            sws_scale(*img_convert_ctx, (const uint8_t * const *)frameGRAY_data, frameGARY_linesize,
-                0, frameGRAY_height, frame->data, frame->linesize);
-            SDL_UnlockTexture(*tex);
-        }
-    } else {
-        av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-        ret = -1;
-    }
+/* Upload the mask at its own size as ARGB, to be blended over the picture by
+ * the renderer like the subtitles. */
+static int upload_mask_texture(SDL_Texture **tex, AVFrame *mask)
+{
+    uint8_t *pixels;
+    int pitch;
 
-    /* SDL_UpdateTexture */
-    switch (sdl_pix_fmt) {
-        case SDL_PIXELFORMAT_UNKNOWN:
-            /* This should only happen if we are not using avfilter... */
-            *img_convert_ctx = sws_getCachedContext(*img_convert_ctx,
-                frame->width, frame->height, frame->format, frame->width, frame->height,
-                AV_PIX_FMT_BGRA, sws_flags, NULL, NULL, NULL);
-            if (*img_convert_ctx != NULL) {
-                uint8_t *pixels[4];
-                int pitch[4];
-                if (!SDL_LockTexture(*tex, NULL, (void **)pixels, pitch)) {
-                    sws_scale(*img_convert_ctx, (const uint8_t * const *)frame->data, frame->linesize,
-                              0, frame->height, pixels, pitch);
-                    SDL_UnlockTexture(*tex);
-                }
-            } else {
-                av_log(NULL, AV_LOG_FATAL, "Cannot initialize the conversion context\n");
-                ret = -1;
-            }
-            break;
-        case SDL_PIXELFORMAT_IYUV:
-            if (frame->linesize[0] > 0 && frame->linesize[1] > 0 && frame->linesize[2] > 0) {
-                ret = SDL_UpdateYUVTexture(*tex, NULL, frame->data[0], frame->linesize[0],
-                                                       frame->data[1], frame->linesize[1],
-                                                       frame->data[2], frame->linesize[2]);
-            } else if (frame->linesize[0] < 0 && frame->linesize[1] < 0 && frame->linesize[2] < 0) {
-                ret = SDL_UpdateYUVTexture(*tex, NULL, frame->data[0] + frame->linesize[0] * (frame->height                    - 1), -frame->linesize[0],
-                                                       frame->data[1] + frame->linesize[1] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[1],
-                                                       frame->data[2] + frame->linesize[2] * (AV_CEIL_RSHIFT(frame->height, 1) - 1), -frame->linesize[2]);
-            } else {
-                av_log(NULL, AV_LOG_ERROR, "Mixed negative and positive linesizes are not supported.\n");
-                return -1;
-            }
-            break;
-        default:
-            if (frame->linesize[0] < 0) {
-                ret = SDL_UpdateTexture(*tex, NULL, frame->data[0] + frame->linesize[0] * (frame->height - 1), -frame->linesize[0]);
-            } else {
-                ret = SDL_UpdateTexture(*tex, NULL, frame->data[0], frame->linesize[0]);
-            }
-            break;
-    }
-    return ret;
+    if (realloc_texture(tex, SDL_PIXELFORMAT_ARGB8888, mask->width, mask->height, SDL_BLENDMODE_BLEND, 0) < 0)
+        return -1;
+    if (SDL_LockTexture(*tex, NULL, (void **)&pixels, &pitch) < 0)
+        return -1;
+    composite_mask_argb(pixels, pitch, mask->width, mask->height, mask->data[0], mask->linesize[0], mask_view);
+    SDL_UnlockTexture(*tex);
+    return 0;
 }
 
 static int upload_texture(SDL_Texture **tex, AVFrame *frame, struct SwsContext **img_convert_ctx) {
@@ -1178,8 +1342,24 @@ static void video_image_display(VideoState *is)
 
     calculate_display_rect(&rect, is->xleft, is->ytop, is->width, is->height, vp->width, vp->height, vp->sar);
 
-    if (!vp->uploaded) {
-        if (my_upload_texture(&is->vid_texture, vp->frame, &is->img_convert_ctx) < 0)
+    if (vp->mask->data[0] && !mask_overlay) {
+        /* composite at the display size, never above the picture size,
+         * and again when the window is resized */
+        int w = FFMAX(FFMIN(rect.w, vp->width)  & ~1, 2);
+        int h = FFMAX(FFMIN(rect.h, vp->height) & ~1, 2);
+        int tw = 0, th = 0;
+        if (is->vid_texture)
+            SDL_QueryTexture(is->vid_texture, NULL, NULL, &tw, &th);
+        if (!vp->uploaded || tw != w || th != h) {
+            if (upload_composite(is, &is->vid_texture, vp->frame, vp->mask, w, h) < 0)
+                return;
+            vp->uploaded = 1;
+            vp->flip_v = 0;
+        }
+    } else if (!vp->uploaded) {
+        if (upload_texture(&is->vid_texture, vp->frame, &is->img_convert_ctx) < 0)
+            return;
+        if (vp->mask->data[0] && upload_mask_texture(&is->mask_texture, vp->mask) < 0)
             return;
         vp->uploaded = 1;
         vp->flip_v = vp->frame->linesize[0] < 0;
@@ -1188,6 +1368,9 @@ static void video_image_display(VideoState *is)
     set_sdl_yuv_conversion_mode(vp->frame);
     SDL_RenderCopyEx(renderer, is->vid_texture, NULL, &rect, 0, NULL, vp->flip_v ? SDL_FLIP_VERTICAL : 0);
     set_sdl_yuv_conversion_mode(NULL);
+    /* the mask rows are in display order whatever the frame linesize */
+    if (mask_overlay && vp->mask->data[0])
+        SDL_RenderCopy(renderer, is->mask_texture, NULL, &rect);
     if (sp) {
 #if USE_ONEPASS_SUBTITLE_RENDER
         SDL_RenderCopy(renderer, is->sub_texture, NULL, &rect);
@@ -1381,7 +1564,9 @@ static void stream_component_close(VideoState *is, int stream_index)
         }
         break;
     case AVMEDIA_TYPE_VIDEO:
-        decoder_abort(&is->viddec, &is->pictq);
+        decoder_abort(&is->viddec, &is->infq);
+        inference_stop(is);
+        sidecar_close(&is->sidecar);
         decoder_destroy(&is->viddec);
         break;
     case AVMEDIA_TYPE_SUBTITLE:
@@ -1427,17 +1612,41 @@ static void stream_close(VideoState *is)
 
     avformat_close_input(&is->ic);
 
-    packet_queue_destroy(&is->videoq);
-    packet_queue_destroy(&is->audioq);
-    packet_queue_destroy(&is->subtitleq);
+    packet_queue_destroy(&is->videoq, "video");
+    packet_queue_destroy(&is->audioq, "audio");
+    packet_queue_destroy(&is->subtitleq, "subtitle");
 
     /* free all pictures */
+    frame_queue_destory(&is->infq);
     frame_queue_destory(&is->pictq);
     frame_queue_destory(&is->sampq);
     frame_queue_destory(&is->subpq);
     SDL_DestroyCond(is->continue_read_thread);
     sws_freeContext(is->img_convert_ctx);
     sws_freeContext(is->sub_convert_ctx);
+    sws_freeContext(is->mask_convert_ctx);
+    av_frame_free(&is->mask_scaled);
+    inference_free(is);
+    if (is->mask_cache) {
+        int64_t hits, misses, bytes;
+        mask_cache_get_stats(is->mask_cache, &hits, &misses, &bytes);
+        av_log(NULL, AV_LOG_VERBOSE, "mask cache: %"PRId64" hits, %"PRId64" misses, %.1f MB\n",
+               hits, misses, bytes / 1048576.0);
+        mask_cache_freep(&is->mask_cache);
+    }
+    saliency_encoder_close(&is->encoder);
+    if (frame_drops_total(is))
+        av_log(NULL, AV_LOG_VERBOSE, "frame drops: early %d decode, %d filter, %d inference; "
+               "late %d decode, %d filter, %d inference\n",
+               is->frame_drops_early[DROP_DECODE], is->frame_drops_early[DROP_FILTER],
+               is->frame_drops_early[DROP_INFER], is->frame_drops_late[DROP_DECODE],
+               is->frame_drops_late[DROP_FILTER], is->frame_drops_late[DROP_INFER]);
+    placement_jitter_log(&is->audio_jitter, "audio callback",
+                         placement_active() || rt_prio ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    placement_jitter_log(&is->display_jitter, "display",
+                         placement_active() || rt_prio ? AV_LOG_INFO : AV_LOG_VERBOSE);
+    SDL_DestroyMutex(is->infer_mutex);
+    SDL_DestroyCond(is->infer_cond);
     av_free(is->filename);
     if (is->vis_texture)
         SDL_DestroyTexture(is->vis_texture);
@@ -1445,18 +1654,27 @@ static void stream_close(VideoState *is)
         SDL_DestroyTexture(is->vid_texture);
     if (is->sub_texture)
         SDL_DestroyTexture(is->sub_texture);
+    if (is->mask_texture)
+        SDL_DestroyTexture(is->mask_texture);
     av_free(is);
-
-    /* free frameRGB */
-    av_free(buffer);
-    av_frame_free(&frameRGB);
 }
 
 static void do_exit(VideoState *is)
 {
-    if (is) {
+    int i;
+
+    if (nb_open_streams) {
+        for (i = 0; i < nb_open_streams; i++)
+            stream_close(open_streams[i]);
+        nb_open_streams = 0;
+    } else if (is) {
         stream_close(is);
     }
+    infer_batcher_close(&batcher);
+    delete batch_replica;
+    batch_replica = NULL;
+    infer_client_close(&infer_client);
+    budget_uninit();
     if (renderer)
         SDL_DestroyRenderer(renderer);
     if (window)
@@ -1468,6 +1686,8 @@ static void do_exit(VideoState *is)
     avformat_network_deinit();
     if (show_status)
         printf("\n");
+    if (profile_net)
+        Profiler::instance().print_summary(stderr);
     SDL_Quit();
     av_log(NULL, AV_LOG_QUIET, "%s", "");
     exit(0);
@@ -1490,6 +1710,40 @@ static void set_default_window_size(int width, int height, AVRational sar)
     default_height = rect.h;
 }
 
+/* split the window into a grid with one tile per input */
+static void streams_layout(int w, int h)
+{
+    int cols = (int)ceil(sqrt(nb_open_streams)), rows = (nb_open_streams + cols - 1) / cols;
+    int i;
+
+    for (i = 0; i < nb_open_streams; i++) {
+        VideoState *s = open_streams[i];
+        int col = i % cols, row = i / cols;
+        s->xleft  = col * w / cols;
+        s->ytop   = row * h / rows;
+        s->width  = (col + 1) * w / cols - s->xleft;
+        s->height = (row + 1) * h / rows - s->ytop;
+        if (s->vis_texture) {
+            SDL_DestroyTexture(s->vis_texture);
+            s->vis_texture = NULL;
+        }
+        s->force_refresh = 1;
+    }
+}
+
+/* the input whose tile contains x, y */
+static VideoState *stream_at(VideoState *cur, int x, int y)
+{
+    int i;
+
+    for (i = 0; i < nb_open_streams; i++) {
+        VideoState *s = open_streams[i];
+        if (x >= s->xleft && x < s->xleft + s->width && y >= s->ytop && y < s->ytop + s->height)
+            return s;
+    }
+    return cur;
+}
+
 static int video_open(VideoState *is)
 {
     int w,h;
@@ -1507,24 +1761,45 @@ static int video_open(VideoState *is)
         SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN_DESKTOP);
     SDL_ShowWindow(window);
 
-    is->width  = w;
-    is->height = h;
+    if (nb_open_streams > 1) {
+        streams_layout(w, h);
+    } else {
+        is->width  = w;
+        is->height = h;
+    }
 
     return 0;
 }
 
+static void stream_display(VideoState *is)
+{
+    if (is->audio_st && is->show_mode != SHOW_MODE_VIDEO)
+        video_audio_display(is);
+    else if (is->video_st)
+        video_image_display(is);
+}
+
 /* display the current picture, if any */
 static void video_display(VideoState *is)
 {
+    int i;
+
+    /* -headless: paced and inferred, not drawn */
+    if (!renderer)
+        return;
     if (!is->width)
         video_open(is);
 
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
-    if (is->audio_st && is->show_mode != SHOW_MODE_VIDEO)
-        video_audio_display(is);
-    else if (is->video_st)
-        video_image_display(is);
+    if (nb_open_streams > 1) {
+        /* redraw every tile, the others from their textures */
+        for (i = 0; i < nb_open_streams; i++)
+            if (open_streams[i]->pictq.rindex_shown || open_streams[i]->show_mode != SHOW_MODE_VIDEO)
+                stream_display(open_streams[i]);
+    } else {
+        stream_display(is);
+    }
     SDL_RenderPresent(renderer);
 }
 
@@ -1781,6 +2056,7 @@ retry:
             }
 
             is->frame_timer += delay;
+            placement_jitter_add(&is->display_jitter, time - is->frame_timer);
             if (delay > 0 && time - is->frame_timer > AV_SYNC_THRESHOLD_MAX)
                 is->frame_timer = time;
 
@@ -1793,7 +2069,7 @@ retry:
                 Frame *nextvp = frame_queue_peek_next(&is->pictq);
                 duration = vp_duration(is, vp, nextvp);
                 if(!is->step && (framedrop>0 || (framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)) && time > is->frame_timer + duration){
-                    is->frame_drops_late++;
+                    is->frame_drops_late[vp->drop_cause]++;
                     frame_queue_next(&is->pictq);
                     goto retry;
                 }
@@ -1849,8 +2125,9 @@ display:
         AVBPrint buf;
         static int64_t last_time;
         int64_t cur_time;
-        int aqsize, vqsize, sqsize;
-        double av_diff;
+        int aqsize, vqsize, sqsize, i;
+        int64_t mc_hits = 0, mc_misses = 0, mc_bytes;
+        double av_diff, infer_util;
 
         cur_time = av_gettime_relative();
         if (!last_time || (cur_time - last_time) >= 30000) {
@@ -1870,17 +2147,29 @@ display:
                 av_diff = get_master_clock(is) - get_clock(&is->vidclk);
             else if (is->audio_st)
                 av_diff = get_master_clock(is) - get_clock(&is->audclk);
+            infer_util = 0;
+            if (is->video_st && is->replicas) {
+                for (i = 0; i < is->nb_replicas; i++)
+                    infer_util += inference_utilization(&is->replicas[i], cur_time);
+                infer_util /= is->nb_replicas;
+            }
+            if (is->mask_cache)
+                mask_cache_get_stats(is->mask_cache, &mc_hits, &mc_misses, &mc_bytes);
 
             av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
             av_bprintf(&buf,
-                      "%7.2f %s:%7.3f fd=%4d aq=%5dKB vq=%5dKB sq=%5dB f=%"PRId64"/%"PRId64"   \r",
+                      "%7.2f %s:%7.3f fd=%4d aq=%5dKB vq=%5dKB sq=%5dB inf=%3d%% dg=%4d sk=%4d mc=%"PRId64"/%"PRId64" f=%"PRId64"/%"PRId64"   \r",
                       get_master_clock(is),
                       (is->audio_st && is->video_st) ? "A-V" : (is->video_st ? "M-V" : (is->audio_st ? "M-A" : "   ")),
                       av_diff,
-                      is->frame_drops_early + is->frame_drops_late,
+                      frame_drops_total(is),
                       aqsize / 1024,
                       vqsize / 1024,
                       sqsize,
+                      (int)(100 * infer_util),
+                      is->infer_decisions[INFER_DOWN],
+                      is->infer_decisions[INFER_SKIP],
+                      mc_hits, mc_misses,
                       is->video_st ? is->viddec.avctx->pts_correction_num_faulty_dts : 0,
                       is->video_st ? is->viddec.avctx->pts_correction_num_faulty_pts : 0);
 
@@ -1897,7 +2186,7 @@ display:
     }
 }
 
-static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)
+static int queue_picture(VideoState *is, AVFrame *src_frame, AVFrame *analysis, double pts, double duration, int64_t pos, int serial)
 {
     Frame *vp;
 
@@ -1906,7 +2195,7 @@ static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double
            av_get_picture_type_char(src_frame->pict_type), pts);
 #endif
 
-    if (!(vp = frame_queue_peek_writable(&is->pictq)))
+    if (!(vp = frame_queue_peek_writable(&is->infq)))
         return -1;
 
     vp->sar = src_frame->sample_aspect_ratio;
@@ -1920,14 +2209,20 @@ static int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double
     vp->duration = duration;
     vp->pos = pos;
     vp->serial = serial;
+    /* a filter slower than the frame rate makes the pictures late */
+    vp->drop_cause = duration > 0 && is->frame_last_filter_delay > duration ? DROP_FILTER : DROP_DECODE;
 
     set_default_window_size(vp->width, vp->height, vp->sar);
 
     av_frame_move_ref(vp->frame, src_frame);
-    frame_queue_push(&is->pictq);
+    if (analysis)
+        av_frame_move_ref(vp->analysis, analysis);
+    frame_queue_push(&is->infq);
     return 0;
 }
 
+static double inference_predict_cost(VideoState *is, int64_t pts, double slack);
+
 static int get_video_frame(VideoState *is, AVFrame *frame)
 {
     int got_picture;
@@ -1947,12 +2242,18 @@ static int get_video_frame(VideoState *is, AVFrame *frame)
             if (frame->pts != AV_NOPTS_VALUE) {
                 double diff = dpts - get_master_clock(is);
                 if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
-                    diff - is->frame_last_filter_delay < 0 &&
                     is->viddec.pkt_serial == is->vidclk.serial &&
                     is->videoq.nb_packets) {
-                    is->frame_drops_early++;
-                    av_frame_unref(frame);
-                    got_picture = 0;
+                    int cause = -1;
+                    if (diff < 0)
+                        cause = DROP_DECODE;
+                    else if (diff - is->frame_last_filter_delay < 0)
+                        cause = DROP_FILTER;
+                    if (cause >= 0) {
+                        is->frame_drops_early[cause]++;
+                        av_frame_unref(frame);
+                        got_picture = 0;
+                    }
                 }
             }
         }
@@ -1961,7 +2262,26 @@ static int get_video_frame(VideoState *is, AVFrame *frame)
     return got_picture;
 }
 
+/* The early drop of get_video_frame for the inference stage, made once the
+ * picture has its filtered pts, which is what the mask cache is keyed by. */
+static int inference_drop_early(VideoState *is, AVFrame *frame, double pts)
+{
+    double diff;
+
+    if (!(framedrop > 0 || (framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)) || isnan(pts))
+        return 0;
+    diff = pts - get_master_clock(is);
+    if (isnan(diff) || fabs(diff) >= AV_NOSYNC_THRESHOLD || diff < 0 ||
+        is->viddec.pkt_serial != is->vidclk.serial || !is->videoq.nb_packets)
+        return 0;
+    return diff - inference_predict_cost(is, frame->pts, diff) < 0;
+}
+
 #if CONFIG_AVFILTER
+static InferReplica *inference_filter_replica(VideoState *is);
+static int saliency_filter_forward(void *opaque, float *input, const PreprocessParams *params, uint8_t *out);
+static void inference_sink_configured(VideoState *is, AVFilterContext *sink, int *sidecar_opened);
+
 static int configure_filtergraph(AVFilterGraph *graph, const char *filtergraph,
                                  AVFilterContext *source_ctx, AVFilterContext *sink_ctx)
 {
@@ -2005,6 +2325,57 @@ fail:
     return ret;
 }
 
+/* scale(area) -> setsar -> format -> buffersink from output pad of src,
+ * giving the pictures the size preprocess_geometry maps them to, in the
+ * RGB layout the network takes. For crop the picture is only scaled, the
+ * crop is left to preprocessing so that the mask covers all of it. */
+static int configure_analysis_filters(AVFilterGraph *graph, VideoState *is, AVFilterContext *src, int pad,
+                                      AVFilterContext **sink)
+{
+    static const enum AVPixelFormat rgb_fmts[]  = { AV_PIX_FMT_RGB24, AV_PIX_FMT_NONE };
+    static const enum AVPixelFormat gbrp_fmts[] = { AV_PIX_FMT_GBRP, AV_PIX_FMT_NONE };
+    const char *fmt = infer_nhwc ? "rgb24" : "gbrp";
+    AVFilterContext *filt_scale, *filt_setsar, *filt_format, *filt_sink;
+    int w = is->infer_width, h = is->infer_height;
+    char scale_args[512];
+    int ret;
+
+    if (is->infer_fit == PREPROCESS_FIT_STRETCH) {
+        snprintf(scale_args, sizeof(scale_args), "w=%d:h=%d:flags=area", w, h);
+    } else {
+        const char *op = is->infer_fit == PREPROCESS_FIT_CROP ? "max" : "min";
+        snprintf(scale_args, sizeof(scale_args),
+                 "w='%s(max(round(iw*sar*%s(%d/(iw*sar),%d/ih)),1),%d)'"
+                 ":h='%s(max(round(ih*%s(%d/(iw*sar),%d/ih)),1),%d)':flags=area",
+                 op, op, w, h, w, op, op, w, h, h);
+    }
+
+    if ((ret = avfilter_graph_create_filter(&filt_scale, avfilter_get_by_name("scale"),
+                                            "ffplay_infer_scale", scale_args, NULL, graph)) < 0)
+        return ret;
+    if ((ret = avfilter_graph_create_filter(&filt_setsar, avfilter_get_by_name("setsar"),
+                                            "ffplay_infer_setsar", "1", NULL, graph)) < 0)
+        return ret;
+    if ((ret = avfilter_graph_create_filter(&filt_format, avfilter_get_by_name("format"),
+                                            "ffplay_infer_format", fmt, NULL, graph)) < 0)
+        return ret;
+    if ((ret = avfilter_graph_create_filter(&filt_sink, avfilter_get_by_name("buffersink"),
+                                            "ffplay_infer_buffersink", NULL, NULL, graph)) < 0)
+        return ret;
+    if ((ret = av_opt_set_int_list(filt_sink, "pix_fmts", infer_nhwc ? rgb_fmts : gbrp_fmts,
+                                   AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN)) < 0)
+        return ret;
+
+    if ((ret = avfilter_link(src, pad, filt_scale, 0)) < 0 ||
+        (ret = avfilter_link(filt_scale, 0, filt_setsar, 0)) < 0 ||
+        (ret = avfilter_link(filt_setsar, 0, filt_format, 0)) < 0 ||
+        (ret = avfilter_link(filt_format, 0, filt_sink, 0)) < 0)
+        return ret;
+
+    *sink = filt_sink;
+    return 0;
+}
+
 static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const char *vfilters, AVFrame *frame)
 {
     enum AVPixelFormat pix_fmts[FF_ARRAY_ELEMS(sdl_texture_format_map)];
@@ -2012,6 +2383,8 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
     char buffersrc_args[256];
     int ret;
     AVFilterContext *filt_src = NULL, *filt_out = NULL, *last_filter = NULL;
+    AVFilterContext *filt_split = NULL, *filt_analysis = NULL;
+    char *vfilters_tail = NULL;
     AVCodecParameters *codecpar = is->video_st->codecpar;
     AVRational fr = av_guess_frame_rate(is->ic, is->video_st, NULL);
     AVDictionaryEntry *e = NULL;
@@ -2047,6 +2420,28 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
     if (fr.num && fr.den)
         av_strlcatf(buffersrc_args, sizeof(buffersrc_args), ":frame_rate=%d/%d", fr.num, fr.den);
 
+    if (vfilters) {
+        /* the saliency entries and what comes before them run in graphs of
+         * their own, this one takes the rest */
+        SaliencyFilterConfig saliency = {
+            .forward = saliency_filter_forward,
+            .opaque  = is,
+            .width   = is->infer_width,
+            .height  = is->infer_height,
+            .fit     = is->infer_fit,
+            .nhwc    = infer_nhwc,
+        };
+        for (i = 0; i < 3; i++) {
+            saliency.mean[i] = infer_mean[i];
+            saliency.std[i]  = infer_std[i];
+        }
+        if ((ret = saliency_pipeline_open(&is->saliency_pipeline, graph, vfilters, buffersrc_args, &saliency,
+                                          &vfilters_tail, buffersrc_args, sizeof(buffersrc_args))) < 0)
+            goto fail;
+        if (ret)
+            vfilters = *vfilters_tail ? vfilters_tail : NULL;
+    }
+
     if ((ret = avfilter_graph_create_filter(&filt_src,
                                             avfilter_get_by_name("buffer"),
                                             "ffplay_buffer", buffersrc_args, NULL,
@@ -2063,6 +2458,20 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
         goto fail;
 
     last_filter = filt_out;
+    is->out_analysis_filter = NULL;
+
+    if (infer_branch) {
+        /* split after the user filters: one branch for the display, one
+         * scaled to the network input with the geometry of
+         * preprocess_geometry, so that preprocessing is a plain copy */
+        if ((ret = avfilter_graph_create_filter(&filt_split, avfilter_get_by_name("split"),
+                                                "ffplay_split", NULL, NULL, graph)) < 0 ||
+            (ret = avfilter_link(filt_split, 0, filt_out, 0)) < 0)
+            goto fail;
+        if ((ret = configure_analysis_filters(graph, is, filt_split, 1, &filt_analysis)) < 0)
+            goto fail;
+        last_filter = filt_split;
+    }
 
 /* Note: this macro adds a filter before the lastly added filter, so the
  * processing order of the filters is in reverse */
@@ -2104,8 +2513,10 @@ static int configure_video_filters(AVFilterGraph *graph, VideoState *is, const c
 
     is->in_video_filter  = filt_src;
     is->out_video_filter = filt_out;
+    is->out_analysis_filter = filt_analysis;
 
 fail:
+    av_free(vfilters_tail);
     return ret;
 }
 
@@ -2124,7 +2535,7 @@ static int configure_audio_filters(VideoState *is, const char *afilters, int for
     avfilter_graph_free(&is->agraph);
     if (!(is->agraph = avfilter_graph_alloc()))
         return AVERROR(ENOMEM);
-    is->agraph->nb_threads = filter_nbthreads;
+    is->agraph->nb_threads = filter_nbthreads || !budget_active() ? filter_nbthreads : 1;
 
     while ((e = av_dict_get(swr_opts, "", e, AV_DICT_IGNORE_SUFFIX)))
         av_strlcatf(aresample_swr_opts, sizeof(aresample_swr_opts), "%s=%s:", e->key, e->value);
@@ -2203,6 +2614,7 @@ static int audio_thread(void *arg)
 
     if (!frame)
         return AVERROR(ENOMEM);
+    placement_apply(PLACEMENT_ADEC);
 
     do {
         if ((got_frame = decoder_decode_frame(&is->auddec, frame, NULL)) < 0)
@@ -2289,24 +2701,39 @@ static int video_thread(void *arg)
 {
     VideoState *is = arg;
     AVFrame *frame = av_frame_alloc();
+    AVFrame *analysis = NULL;
     double pts;
     double duration;
+    int64_t busy_start, busy_wait;
     int ret;
     AVRational tb = is->video_st->time_base;
     AVRational frame_rate = av_guess_frame_rate(is->ic, is->video_st, NULL);
 
 #if CONFIG_AVFILTER
     AVFilterGraph *graph = NULL;
-    AVFilterContext *filt_out = NULL, *filt_in = NULL;
+    AVFilterContext *filt_out = NULL, *filt_in = NULL, *filt_analysis = NULL;
     int last_w = 0;
     int last_h = 0;
     enum AVPixelFormat last_format = -2;
     int last_serial = -1;
     int last_vfilter_idx = 0;
+    int sidecar_opened = 0;
 #endif
 
     if (!frame)
         return AVERROR(ENOMEM);
+    placement_apply(PLACEMENT_VDEC);
+    /* the saliency filters of -vf run the network here */
+    if (budget_active())
+        at::set_num_threads(budget_get(BUDGET_FILTER));
+#if CONFIG_AVFILTER
+    if (infer_branch && !(analysis = av_frame_alloc())) {
+        av_frame_free(&frame);
+        return AVERROR(ENOMEM);
+    }
+#endif
+    busy_start = av_gettime_relative();
+    busy_wait  = is->viddec.wait_time;
 
     for (;;) {
         ret = get_video_frame(is, frame);
@@ -2327,13 +2754,14 @@ static int video_thread(void *arg)
                    (const char *)av_x_if_null(av_get_pix_fmt_name(last_format), "none"), last_serial,
                    frame->width, frame->height,
                    (const char *)av_x_if_null(av_get_pix_fmt_name(frame->format), "none"), is->viddec.pkt_serial);
+            saliency_pipeline_free(&is->saliency_pipeline);
             avfilter_graph_free(&graph);
             graph = avfilter_graph_alloc();
             if (!graph) {
                 ret = AVERROR(ENOMEM);
                 goto the_end;
             }
-            graph->nb_threads = filter_nbthreads;
+            graph->nb_threads = filter_nbthreads ? filter_nbthreads : budget_get(BUDGET_FILTER);
             if ((ret = configure_video_filters(graph, is, vfilters_list ? vfilters_list[is->vfilter_idx] : NULL, frame)) < 0) {
                 SDL_Event event;
                 event.type = FF_QUIT_EVENT;
@@ -2343,15 +2771,26 @@ static int video_thread(void *arg)
             }
             filt_in  = is->in_video_filter;
             filt_out = is->out_video_filter;
+            filt_analysis = is->out_analysis_filter;
             last_w = frame->width;
             last_h = frame->height;
             last_format = frame->format;
             last_serial = is->viddec.pkt_serial;
+            if (last_vfilter_idx != is->vfilter_idx) {
+                /* the same pts now maps to a different picture */
+                SDL_LockMutex(is->infer_mutex);
+                mask_cache_clear(is->mask_cache);
+                SDL_UnlockMutex(is->infer_mutex);
+            }
             last_vfilter_idx = is->vfilter_idx;
             frame_rate = av_buffersink_get_frame_rate(filt_out);
+            inference_sink_configured(is, filt_analysis ? filt_analysis : filt_out, &sidecar_opened);
         }
 
-        ret = av_buffersrc_add_frame(filt_in, frame);
+        if (is->saliency_pipeline)
+            ret = saliency_pipeline_send(is->saliency_pipeline, frame, filt_in);
+        else
+            ret = av_buffersrc_add_frame(filt_in, frame);
         if (ret < 0)
             goto the_end;
 
@@ -2366,6 +2805,12 @@ static int video_thread(void *arg)
                 break;
             }
 
+            /* split hands every picture to both branches, so the network
+             * input of this one is ready as well */
+            if (filt_analysis && av_buffersink_get_frame_flags(filt_analysis, analysis, 0) >= 0 &&
+                analysis->pts != frame->pts)
+                av_frame_unref(analysis);
+
             is->frame_last_filter_delay = av_gettime_relative() / 1000000.0 - is->frame_last_returned_time;
             if (fabs(is->frame_last_filter_delay) > AV_NOSYNC_THRESHOLD / 10.0)
                 is->frame_last_filter_delay = 0;
@@ -2373,8 +2818,21 @@ static int video_thread(void *arg)
 #endif
             duration = (frame_rate.num && frame_rate.den ? av_q2d((AVRational){frame_rate.den, frame_rate.num}) : 0);
             pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
-            ret = queue_picture(is, frame, pts, duration, frame->pkt_pos, is->viddec.pkt_serial);
+            if (inference_drop_early(is, frame, pts)) {
+                is->frame_drops_early[DROP_INFER]++;
+                av_frame_unref(frame);
+                if (analysis)
+                    av_frame_unref(analysis);
+                continue;
+            }
+            /* decoding and filtering only, a starved decoder is not busy */
+            is->decode_busy += av_gettime_relative() - busy_start - (is->viddec.wait_time - busy_wait);
+            ret = queue_picture(is, frame, analysis, pts, duration, frame->pkt_pos, is->viddec.pkt_serial);
+            busy_start = av_gettime_relative();
+            busy_wait  = is->viddec.wait_time;
             av_frame_unref(frame);
+            if (analysis)
+                av_frame_unref(analysis);
 #if CONFIG_AVFILTER
             if (is->videoq.serial != is->viddec.pkt_serial)
                 break;
@@ -2386,53 +2844,841 @@ static int video_thread(void *arg)
     }
  the_end:
 #if CONFIG_AVFILTER
+    saliency_pipeline_free(&is->saliency_pipeline);
     avfilter_graph_free(&graph);
 #endif
+    av_frame_free(&analysis);
     av_frame_free(&frame);
     return 0;
 }
 
-static int subtitle_thread(void *arg)
+/* PoolNet on a network input, the saliency as bytes of the input size */
+static torch::Tensor poolnet_forward(InferReplica *r, const torch::Tensor &input)
 {
-    VideoState *is = arg;
-    Frame *sp;
-    int got_subtitle;
-    double pts;
-
-    for (;;) {
-        if (!(sp = frame_queue_peek_writable(&is->subpq)))
-            return 0;
-
-        if ((got_subtitle = decoder_decode_frame(&is->subdec, NULL, &sp->sub)) < 0)
-            break;
+    auto img_tensor = infer_device.is_cpu() ? input : input.to(infer_device);
 
-        pts = 0;
+    /* torch::Tensor -> frameGRAY */
+    auto start = std::chrono::high_resolution_clock::now();
+    auto out = r->net->forward(img_tensor);
+    out.squeeze_();
+    out.sigmoid_();
+    out.mul_(255.0);
+    out = out.toType(torch::kByte);
+    out = out.to(torch::kCPU);
+    out = out.contiguous();
 
-        if (got_subtitle && sp->sub.format == 0) {
-            if (sp->sub.pts != AV_NOPTS_VALUE)
-                pts = sp->sub.pts / (double)AV_TIME_BASE;
-            sp->pts = pts;
-            sp->serial = is->subdec.pkt_serial;
-            sp->width = is->subdec.avctx->width;
-            sp->height = is->subdec.avctx->height;
-            sp->uploaded = 0;
+    auto end = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+    // It should be known that it takes longer time at first time
+    av_log(NULL, AV_LOG_VERBOSE, "replica %d inference taken : %d ms\n", r->index, (int)duration.count());
+    return out;
+}
 
-            /* now we can update the picture count */
-            frame_queue_push(&is->subpq);
-        } else if (got_subtitle) {
-            avsubtitle_free(&sp->sub);
-        }
+/* poolnet_infer in the inference daemon: src is preprocessed into a shared
+ * slot and the daemon writes the mask next to it */
+static int poolnet_infer_remote(InferReplica *r, AVFrame *src, AVFrame *mask, int level,
+                                const PreprocessParams *params)
+{
+    float *input;
+    uint8_t *out;
+    int slot, ret;
+
+    if ((slot = infer_client_acquire(infer_client, &input, &out)) < 0)
+        return slot;
+    if ((ret = preprocess_frame(r->pre[level], src, input, params)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Cannot preprocess a %s picture\n",
+               av_get_pix_fmt_name((enum AVPixelFormat)src->format));
+    } else if ((ret = infer_client_run(infer_client, slot, params->width, params->height, params->nhwc)) >= 0) {
+        ret = preprocess_output_mask(params, out, mask);
     }
-    return 0;
+    infer_client_release(infer_client, slot);
+    return ret;
 }
 
-/* copy samples for viewing in editor window */
-static void update_sample_display(VideoState *is, short *samples, int samples_size)
+/* Run PoolNet on src and store its saliency in mask as GRAY8, the picture
+ * scaled like the network input of the stream, which is halved for
+ * INFER_DOWN. */
+static int poolnet_infer(InferReplica *r, AVFrame *src, AVFrame *mask, int level)
 {
-    int size, len;
+    PreprocessParams params;
+    int w = r->is->infer_width >> level, h = r->is->infer_height >> level;
+    int i, ret;
+
+    params.width  = w;
+    params.height = h;
+    params.nhwc   = infer_nhwc;
+    for (i = 0; i < 3; i++) {
+        params.mean[i]  = infer_mean[i];
+        params.scale[i] = 1.0f / infer_std[i];
+    }
+    preprocess_geometry(&params, r->is->infer_fit, src->width, src->height, src->sample_aspect_ratio);
+    if (!r->pre[level])
+        r->pre[level] = preprocess_alloc();
+    if (infer_client)
+        return poolnet_infer_remote(r, src, mask, level, &params);
+    if (!r->input[level].defined()) {
+        auto options = torch::TensorOptions().dtype(torch::kFloat);
+        /* channels last is NHWC storage behind an NCHW view, no copy */
+        r->input[level] = infer_nhwc ? torch::empty({1, h, w, 3}, options).permute({0, 3, 1, 2})
+                                     : torch::empty({1, 3, h, w}, options);
+    }
 
-    size = samples_size / sizeof(short);
-    while (size > 0) {
+    /* the batcher waits for this picture while it is preprocessed */
+    if (batcher)
+        infer_batcher_add_client(batcher);
+    /* frame -> torch::Tensor, in place from the decoded planes */
+    if ((ret = preprocess_frame(r->pre[level], src, r->input[level].data_ptr<float>(), &params)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Cannot preprocess a %s picture\n",
+               av_get_pix_fmt_name((enum AVPixelFormat)src->format));
+        if (batcher)
+            infer_batcher_remove_client(batcher);
+        return ret;
+    }
+    torch::Tensor out;
+    if (batcher) {
+        ret = infer_batcher_run(batcher, r->input[level], out);
+        infer_batcher_remove_client(batcher);
+        if (ret < 0)
+            return ret;
+    } else {
+        out = poolnet_forward(r, r->input[level]);
+    }
+    return preprocess_output_mask(&params, out.data_ptr<uint8_t>(), mask);
+}
+
+/* forward pass of the saliency filters of -vf, on video_thread */
+static int saliency_filter_forward(void *opaque, float *input, const PreprocessParams *params, uint8_t *out)
+{
+    InferReplica *r;
+
+    if (infer_client) {
+        float *slot_input;
+        uint8_t *slot_mask;
+        int slot, ret;
+
+        if ((slot = infer_client_acquire(infer_client, &slot_input, &slot_mask)) < 0)
+            return slot;
+        memcpy(slot_input, input, 3 * params->width * params->height * sizeof(float));
+        if ((ret = infer_client_run(infer_client, slot, params->width, params->height, params->nhwc)) >= 0)
+            memcpy(out, slot_mask, params->width * params->height);
+        infer_client_release(infer_client, slot);
+        return ret;
+    }
+
+    r = inference_filter_replica((VideoState *)opaque);
+    torch::NoGradGuard no_grad;
+    auto options = torch::TensorOptions().dtype(torch::kFloat);
+    auto tensor = params->nhwc ? torch::from_blob(input, {1, params->height, params->width, 3}, options).permute({0, 3, 1, 2})
+                               : torch::from_blob(input, {1, 3, params->height, params->width}, options);
+    auto res = poolnet_forward(r, tensor);
+
+    memcpy(out, res.data_ptr<uint8_t>(), params->width * params->height);
+    return 0;
+}
+
+/* forward pass of the batcher, on its own thread */
+static torch::Tensor batch_forward(void *opaque, const torch::Tensor &batch)
+{
+    return poolnet_forward((InferReplica *)opaque, batch);
+}
+
+/* move a picture, its mask and its timing from src to dst */
+static void infer_frame_move(Frame *dst, Frame *src)
+{
+    dst->sar      = src->sar;
+    dst->uploaded = 0;
+    dst->width    = src->width;
+    dst->height   = src->height;
+    dst->format   = src->format;
+    dst->pts      = src->pts;
+    dst->duration = src->duration;
+    dst->pos      = src->pos;
+    dst->serial   = src->serial;
+    dst->drop_cause = src->drop_cause;
+    av_frame_move_ref(dst->frame, src->frame);
+    av_frame_move_ref(dst->mask, src->mask);
+    av_frame_move_ref(dst->analysis, src->analysis);
+}
+
+#define MAX_CPUS 1024
+
+/* intra-op threads of a replica: its group of cores, or its part of the
+ * inference share of the thread budget */
+static int inference_threads(InferReplica *r)
+{
+    if (!budget_active())
+        return r->nb_cpus;
+    return av_clip(budget_get(BUDGET_INFER) / r->is->nb_replicas, 1, r->nb_cpus);
+}
+
+/* Split the inference cores into one group per replica. Pinning is
+ * optional without -cpu_layout, the intra-op thread count always follows the
+ * group size so that the replicas do not oversubscribe the machine. With the
+ * OpenMP backend the thread count set here only applies to the calling
+ * thread. */
+static void inference_setup_thread(InferReplica *r)
+{
+    int cpus[MAX_CPUS];
+    int nb_cpus = placement_get_cpus(PLACEMENT_INFER, cpus, MAX_CPUS);
+    int first;
+
+    /* started by whichever thread opened the stream, the render one too */
+    placement_apply(PLACEMENT_INFER);
+    r->nb_cpus   = FFMAX(1, nb_cpus / r->is->nb_replicas);
+    first        = (r->index * r->nb_cpus) % nb_cpus;
+    r->cpu_first = cpus[first];
+#ifdef __linux__
+    if (infer_pin || placement_active()) {
+        cpu_set_t set;
+        int i;
+
+        CPU_ZERO(&set);
+        for (i = 0; i < r->nb_cpus; i++)
+            CPU_SET(cpus[(first + i) % nb_cpus], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            av_log(NULL, AV_LOG_WARNING, "Could not pin inference replica %d\n", r->index);
+    }
+#endif
+    r->nb_threads = inference_threads(r);
+    at::set_num_threads(r->nb_threads);
+}
+
+/* Pick the inference level of a picture from the time left until the master
+ * clock reaches its pts and the running latency of each level. A picture
+ * that is already late, or cannot make it even at the lower level, skips
+ * the network. */
+static int inference_level(VideoState *is, double slack)
+{
+    if (!(infer_deadline > 0 || (infer_deadline && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)))
+        return INFER_FULL;
+    if (isnan(slack) || is->paused)
+        return INFER_FULL;
+    if (slack < 0)
+        return INFER_SKIP;
+    if (slack >= is->infer_latency[INFER_FULL])
+        return INFER_FULL;
+    if (slack >= is->infer_latency[INFER_DOWN])
+        return INFER_DOWN;
+    return INFER_SKIP;
+}
+
+/* Called with infer_mutex held. */
+static int inference_decide(VideoState *is, Frame *f)
+{
+    return inference_level(is, f->pts - get_master_clock(is));
+}
+
+/* Time a picture filtered now needs in the inference stage before it can
+ * be shown, pts in the time base of the mask cache: its own pass at the level inference_decide would pick, and the
+ * pictures ahead of it in infq at the same level, spread over the
+ * replicas. Masks the saliency filters of -vf or the mask cache provide
+ * cost nothing, and neither does a level that was never measured. The
+ * prediction is skipped rather than waited for while a replica holds
+ * infer_mutex, the picture is then queued without it. */
+static double inference_predict_cost(VideoState *is, int64_t pts, double slack)
+{
+    double latency, cost = 0;
+    int level;
+
+    if (!is->replicas || is->saliency_pipeline)
+        return 0;
+    if (SDL_TryLockMutex(is->infer_mutex))
+        return 0;
+    level = inference_level(is, slack);
+    if (level != INFER_SKIP && (latency = is->infer_latency[level]) > 0) {
+        cost = latency * frame_queue_nb_remaining(&is->infq) / is->nb_replicas;
+        if (!is->mask_cache || !mask_cache_contains(is->mask_cache, is->video_stream, pts, level))
+            cost += latency;
+    }
+    SDL_UnlockMutex(is->infer_mutex);
+    return cost;
+}
+
+/* With frame dropping on, a picture that would reach pictq after its
+ * display time even at the level picked for it is dropped before it is
+ * preprocessed, under the same conditions as the early drops of
+ * get_video_frame. Called with infer_mutex held. */
+static int inference_too_late(VideoState *is, InferSlot *slot)
+{
+    double slack, cost;
+
+    if (!(framedrop > 0 || (framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)) ||
+        is->step || is->paused || isnan(slot->f.pts))
+        return 0;
+    slack = slot->f.pts - get_master_clock(is);
+    cost = slot->level == INFER_SKIP ? 0 : is->infer_latency[slot->level];
+    return !isnan(slack) && fabs(slack) < AV_NOSYNC_THRESHOLD &&
+           slot->f.serial == is->vidclk.serial && is->videoq.nb_packets &&
+           slack - cost < 0;
+}
+
+/* Size pictq so that it holds one slow inference worth of pictures: the
+ * mean latency at INFER_FULL plus four deviations, in frame durations, on
+ * top of the default depth. A fast model stays at the default. The depth
+ * is capped by -picture_queue_max and by -picture_queue_mb at the size of
+ * this picture. read_thread keeps that much more video queued, beyond its
+ * usual second. Called with infer_mutex held. */
+static void inference_depth_update(VideoState *is, AVFrame *frame, double duration)
+{
+    double cover = is->infer_latency[INFER_FULL] + 4 * is->infer_latency_dev[INFER_FULL];
+    double min_duration;
+    int64_t bytes;
+    int depth, max_depth = picture_queue_max;
+
+    if (duration <= 0 || isnan(duration))
+        return;
+    bytes = av_image_get_buffer_size((enum AVPixelFormat)frame->format, frame->width, frame->height, 1);
+    bytes += (int64_t)is->mask_width * is->mask_height;
+    if (bytes > 0)
+        max_depth = FFMIN(max_depth, ((int64_t)picture_queue_mb << 20) / bytes);
+    max_depth = FFMAX(max_depth, VIDEO_PICTURE_QUEUE_SIZE);
+
+    depth = VIDEO_PICTURE_QUEUE_SIZE - 1 + (int)ceil(cover / duration);
+    depth = av_clip(depth, VIDEO_PICTURE_QUEUE_SIZE, max_depth);
+    min_duration = 1.0 + (depth + is->reorder_size) * duration;
+    SDL_LockMutex(is->pictq.mutex);
+    is->video_min_duration = min_duration;
+    SDL_UnlockMutex(is->pictq.mutex);
+    if (depth != frame_queue_depth(&is->pictq)) {
+        av_log(NULL, AV_LOG_VERBOSE, "inference %.1f +- %.1f ms, picture queue depth %d, %.2f s of video packets\n",
+               1000 * is->infer_latency[INFER_FULL], 1000 * is->infer_latency_dev[INFER_FULL],
+               depth, min_duration);
+        frame_queue_set_depth(&is->pictq, depth);
+    }
+}
+
+#define BUDGET_PERIOD 1000000
+
+/* Hand the utilization of decoding and inference over the last period to
+ * the thread budget. Called with infer_mutex held. */
+static void inference_budget_update(VideoState *is, int64_t now)
+{
+    double util[BUDGET_NB] = { -1, -1, -1, -1 };
+    int64_t decode_busy = is->decode_busy, infer_busy = 0, wall = now - is->budget_time;
+    int i;
+
+    if (!budget_active() || (is->budget_time && wall < BUDGET_PERIOD))
+        return;
+    for (i = 0; i < is->nb_replicas; i++)
+        infer_busy += is->replicas[i].busy_time;
+    if (is->budget_time) {
+        util[BUDGET_DECODE] = (decode_busy - is->budget_decode_busy) / (double)wall;
+        util[BUDGET_INFER]  = (infer_busy - is->budget_infer_busy) / ((double)wall * is->nb_replicas);
+        budget_rebalance(util);
+    }
+    is->budget_time        = now;
+    is->budget_decode_busy = decode_busy;
+    is->budget_infer_busy  = infer_busy;
+}
+
+/* push the finished pictures at the head of the reorder buffer to pictq,
+ * called with infer_mutex held. Only one replica releases at a time and
+ * waits for room in pictq and for the encoder without the mutex; the
+ * others leave the pictures they finish meanwhile to it. */
+static int inference_release(VideoState *is)
+{
+    InferSlot *slot;
+    Frame *dst;
+    double encode_pts, encode_duration;
+    int encode, encode_serial;
+
+    if (is->infer_releasing)
+        return 0;
+    is->infer_releasing = 1;
+    while (is->infer_next_release < is->infer_next_seq) {
+        slot = &is->reorder[is->infer_next_release % is->reorder_size];
+        if (!slot->done)
+            break;
+        dst = NULL;
+        if (slot->f.serial == is->videoq.serial && !slot->dropped) {
+            /* the slot is not reused before infer_next_release moves on */
+            SDL_UnlockMutex(is->infer_mutex);
+            dst = frame_queue_peek_writable(&is->pictq);
+            SDL_LockMutex(is->infer_mutex);
+            if (!dst) {
+                is->infer_releasing = 0;
+                return -1;
+            }
+        }
+        /* a seek may have made it obsolete meanwhile */
+        encode = 0;
+        if (dst && slot->f.serial == is->videoq.serial) {
+            /* the encoder blocks with -offline, it gets its references
+             * after the mutex is released */
+            if (is->encoder && av_frame_ref(is->encode_frame, slot->f.frame) >= 0) {
+                if (slot->f.mask->buf[0] && av_frame_ref(is->encode_mask, slot->f.mask) < 0)
+                    av_frame_unref(is->encode_mask);
+                encode_pts      = slot->f.pts;
+                encode_duration = slot->f.duration;
+                encode_serial   = slot->f.serial;
+                encode = 1;
+            }
+            if (slot->f.mask->buf[0]) {
+                av_frame_unref(is->last_mask);
+                if (av_frame_ref(is->last_mask, slot->f.mask) < 0)
+                    av_frame_unref(is->last_mask);
+            }
+            /* the display does not need the network input */
+            av_frame_unref(slot->f.analysis);
+            infer_frame_move(dst, &slot->f);
+            frame_queue_push(&is->pictq);
+        } else {
+            frame_queue_unref_item(&slot->f);
+        }
+        slot->done = 0;
+        slot->dropped = 0;
+        is->infer_next_release++;
+        /* a replica may be waiting for room in the reorder buffer */
+        SDL_CondBroadcast(is->infer_cond);
+        if (encode) {
+            SDL_UnlockMutex(is->infer_mutex);
+            saliency_encoder_send(is->encoder, is->encode_frame, is->encode_mask,
+                                  encode_pts, encode_duration, encode_serial);
+            av_frame_unref(is->encode_frame);
+            av_frame_unref(is->encode_mask);
+            SDL_LockMutex(is->infer_mutex);
+        }
+    }
+    is->infer_releasing = 0;
+    return 0;
+}
+
+/* The finished mask closest before slot in decoding order: the pictures
+ * waiting in the reorder buffer first, then the last one released. With
+ * several replicas a later picture may finish first, its mask is not
+ * taken. Called with infer_mutex held. */
+static const AVFrame *inference_previous_mask(VideoState *is, InferSlot *slot)
+{
+    int64_t seq;
+
+    for (seq = slot->seq - 1; seq >= is->infer_next_release; seq--) {
+        InferSlot *prev = &is->reorder[seq % is->reorder_size];
+        if (prev->done && !prev->dropped && prev->f.serial == slot->f.serial && prev->f.mask->buf[0])
+            return prev->f.mask;
+    }
+    return is->last_mask->buf[0] ? is->last_mask : NULL;
+}
+
+/* Drop a picture that cannot make it in time, or count the level it gets
+ * and give a skipped picture the previous mask. Called with infer_mutex
+ * held. */
+static void inference_schedule(VideoState *is, InferSlot *slot)
+{
+    const AVFrame *prev;
+
+    if (inference_too_late(is, slot)) {
+        is->frame_drops_early[DROP_INFER]++;
+        slot->dropped = 1;
+        slot->level = INFER_SKIP;
+    } else {
+        is->infer_decisions[slot->level]++;
+        if (slot->level == INFER_SKIP && (prev = inference_previous_mask(is, slot)) &&
+            av_frame_ref(slot->f.mask, prev) < 0)
+            av_frame_unref(slot->f.mask);
+    }
+}
+
+/* Inference stage between the video decoder and pictq. Each replica takes
+ * the next picture from infq, either in turn (rr) or whenever it is idle
+ * (steal), runs PoolNet on it and hands it to the reorder buffer, which
+ * releases pictures to pictq in the order they were decoded. */
+static int inference_thread(void *arg)
+{
+    InferReplica *r = arg;
+    VideoState *is = r->is;
+    InferSlot *slot;
+    Frame *src;
+    Sidecar *record_to;
+    AVFrame *record;            /* mask for the sidecar, written without the mutex */
+    int64_t t0, record_pts;
+    int ret, from_sidecar;
+
+    /* NoGradGuard is thread local */
+    torch::NoGradGuard no_grad;
+
+    if (!(record = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    inference_setup_thread(r);
+    r->start_time = av_gettime_relative();
+
+    for (;;) {
+        SDL_LockMutex(is->infer_mutex);
+        while (!is->videoq.abort_request &&
+               (is->infer_taking ||
+                is->infer_next_seq - is->infer_next_release >= is->reorder_size ||
+                (infer_dispatch_rr && is->infer_next_seq % is->nb_replicas != r->index)))
+            SDL_CondWait(is->infer_cond, is->infer_mutex);
+        if (is->videoq.abort_request) {
+            SDL_UnlockMutex(is->infer_mutex);
+            break;
+        }
+        /* only one replica waits on infq, the others can still release */
+        is->infer_taking = 1;
+        SDL_UnlockMutex(is->infer_mutex);
+
+        src = frame_queue_peek_readable(&is->infq);
+
+        SDL_LockMutex(is->infer_mutex);
+        is->infer_taking = 0;
+        if (!src) {
+            SDL_CondBroadcast(is->infer_cond);
+            SDL_UnlockMutex(is->infer_mutex);
+            break;
+        }
+        slot = &is->reorder[is->infer_next_seq % is->reorder_size];
+        slot->seq = is->infer_next_seq++;
+        from_sidecar = 0;
+        infer_frame_move(&slot->f, src);
+        frame_queue_next(&is->infq);
+        /* obsolete pictures after a seek are dropped on release */
+        if (slot->f.serial == is->videoq.serial) {
+            const AVFrame *filtered = saliency_filter_get_mask(slot->f.frame);
+            slot->level = inference_decide(is, &slot->f);
+            if (filtered) {
+                /* a saliency filter in -vf already ran the network */
+                if (av_frame_ref(slot->f.mask, filtered) < 0)
+                    av_frame_unref(slot->f.mask);
+                slot->level = INFER_SKIP;
+            } else if (mask_cache_get(is->mask_cache, is->video_stream, slot->f.frame->pts,
+                               slot->level, slot->f.mask) > 0) {
+                slot->level = INFER_SKIP;
+            } else if (is->sidecar && is->sidecar_vfilter_idx == is->vfilter_idx &&
+                       sidecar_is_reading(is->sidecar)) {
+                /* looked up below, without the mutex */
+                from_sidecar = 1;
+            } else {
+                inference_schedule(is, slot);
+            }
+        } else {
+            slot->level = INFER_SKIP;
+        }
+        SDL_CondBroadcast(is->infer_cond);
+        SDL_UnlockMutex(is->infer_mutex);
+
+        if (from_sidecar) {
+            int found = sidecar_read(is->sidecar, slot->f.frame->pts, slot->f.mask) > 0;
+            SDL_LockMutex(is->infer_mutex);
+            if (found) {
+                mask_cache_put(is->mask_cache, is->video_stream, slot->f.frame->pts,
+                               INFER_FULL, slot->f.mask);
+                slot->level = INFER_SKIP;
+            } else {
+                av_frame_unref(slot->f.mask);
+                inference_schedule(is, slot);
+            }
+            SDL_UnlockMutex(is->infer_mutex);
+        }
+
+        t0 = av_gettime_relative();
+        ret = -1;
+        if (slot->level != INFER_SKIP) {
+            AVFrame *in = slot->f.analysis->buf[0] ? slot->f.analysis : slot->f.frame;
+            int nb_threads = inference_threads(r);
+            if (nb_threads != r->nb_threads)
+                at::set_num_threads(r->nb_threads = nb_threads);
+            if ((ret = poolnet_infer(r, in, slot->f.mask, slot->level)) < 0)
+                av_frame_unref(slot->f.mask);
+            r->busy_time += av_gettime_relative() - t0;
+            r->nb_frames++;
+        }
+
+        record_to = NULL;
+        SDL_LockMutex(is->infer_mutex);
+        if (ret >= 0) {
+            double latency = (av_gettime_relative() - t0) / 1000000.0;
+            double *estimate = &is->infer_latency[slot->level];
+            double *dev = &is->infer_latency_dev[slot->level];
+            if (r->warmed_up[slot->level]) {
+                if (*estimate)
+                    *dev = 0.9 * *dev + 0.1 * fabs(latency - *estimate);
+                *estimate = *estimate ? 0.9 * *estimate + 0.1 * latency : latency;
+                inference_depth_update(is, slot->f.frame, slot->f.duration);
+            }
+            r->warmed_up[slot->level] = 1;
+            slot->f.drop_cause = DROP_INFER;
+            mask_cache_put(is->mask_cache, is->video_stream, slot->f.frame->pts,
+                           slot->level, slot->f.mask);
+            /* the writer may block with -offline, which would hold up
+             * every replica behind the mutex */
+            if (is->sidecar && slot->level == INFER_FULL && is->sidecar_vfilter_idx == is->vfilter_idx &&
+                av_frame_ref(record, slot->f.mask) >= 0) {
+                record_to  = is->sidecar;
+                record_pts = slot->f.frame->pts;
+            }
+        }
+        slot->done = 1;
+        inference_budget_update(is, av_gettime_relative());
+        ret = inference_release(is);
+        SDL_CondBroadcast(is->infer_cond);
+        SDL_UnlockMutex(is->infer_mutex);
+        if (record_to) {
+            sidecar_write(record_to, record_pts, record);
+            av_frame_unref(record);
+        }
+        if (ret < 0)
+            break;
+    }
+    av_frame_free(&record);
+    return 0;
+}
+
+/* share the parameters and buffers of src with dst without copying them */
+static void poolnet_share_weights(PoolNet &dst, PoolNet &src)
+{
+    auto params = src->named_parameters(/*recurse=*/true);
+    for (auto &p : dst->named_parameters(/*recurse=*/true))
+        p.value().set_data(params[p.key()]);
+    auto buffers = src->named_buffers(/*recurse=*/true);
+    for (auto &b : dst->named_buffers(/*recurse=*/true))
+        b.value().set_data(buffers[b.key()]);
+}
+
+/* The sidecar fingerprint covers the weights, the network input size and fit,
+ * what decides the pictures and their pts: stream, time base and filters. */
+static uint64_t sidecar_fingerprint(AVStream *st, const char *vfilters)
+{
+    char desc[1024];
+
+    snprintf(desc, sizeof(desc), "%dx%d:%d;%d;%d/%d;%s;%g,%g,%g/%g,%g,%g", infer_width, infer_height, infer_fit, st->index,
+             st->time_base.num, st->time_base.den, vfilters ? vfilters : "",
+             infer_mean[0], infer_mean[1], infer_mean[2], infer_std[0], infer_std[1], infer_std[2]);
+    return sidecar_hash(model_fingerprint, desc, strlen(desc));
+}
+
+/* size of the full size masks of pictures of width x height */
+static void infer_mask_geometry(int width, int height, AVRational sar, int *mask_width, int *mask_height)
+{
+    PreprocessParams params = { infer_width, infer_height };
+
+    preprocess_geometry(&params, infer_fit, width, height, sar);
+    *mask_width  = params.mask_w;
+    *mask_height = params.mask_h;
+}
+
+/* size of the full size masks of the pictures of st without -vf, turned
+ * like -autorotate turns them */
+static void infer_mask_size(AVFormatContext *ic, AVStream *st, int *width, int *height)
+{
+    AVRational sar = av_guess_sample_aspect_ratio(ic, st, NULL);
+    double theta = autorotate ? get_rotation(st) : 0;
+
+    if (fabs(theta - 90) < 1.0 || fabs(theta - 270) < 1.0)
+        infer_mask_geometry(st->codecpar->height, st->codecpar->width, av_make_q(sar.den, sar.num), width, height);
+    else
+        infer_mask_geometry(st->codecpar->width, st->codecpar->height, sar, width, height);
+}
+
+static void inference_open_sidecar(VideoState *is)
+{
+    uint64_t fingerprint = sidecar_fingerprint(is->video_st, vfilters_list ? vfilters_list[is->vfilter_idx] : NULL);
+    Sidecar *sidecar;
+
+    if (sidecar_open(&sidecar, sidecar_path, fingerprint, is->mask_width, is->mask_height) < 0)
+        sidecar = NULL;
+    else if (offline)
+        sidecar_set_blocking(sidecar, 1);
+    SDL_LockMutex(is->infer_mutex);
+    is->sidecar = sidecar;
+    is->sidecar_vfilter_idx = is->vfilter_idx;
+    SDL_UnlockMutex(is->infer_mutex);
+}
+
+#if CONFIG_AVFILTER
+/* The masks are computed on the pictures out of the filters, the analysis
+ * branch when there is one. Take their size from the sink, and open the
+ * sidecar at that size the first time the graph is configured. */
+static void inference_sink_configured(VideoState *is, AVFilterContext *sink, int *sidecar_opened)
+{
+    AVRational sar = av_buffersink_get_sample_aspect_ratio(sink);
+    int width, height;
+
+    infer_mask_geometry(av_buffersink_get_w(sink), av_buffersink_get_h(sink),
+                        sar.num ? sar : av_make_q(1, 1), &width, &height);
+    SDL_LockMutex(is->infer_mutex);
+    if (*sidecar_opened && is->sidecar && (width != is->mask_width || height != is->mask_height))
+        av_log(NULL, AV_LOG_WARNING, "Masks are now %dx%d, the sidecar only holds %dx%d ones\n",
+               width, height, is->mask_width, is->mask_height);
+    is->mask_width  = width;
+    is->mask_height = height;
+    SDL_UnlockMutex(is->infer_mutex);
+
+    if (sidecar_path && !*sidecar_opened) {
+        inference_open_sidecar(is);
+        *sidecar_opened = 1;
+    }
+}
+#endif
+
+static int inference_start(VideoState *is)
+{
+    int i;
+
+    if (!is->replicas) {
+        is->nb_replicas = FFMAX(1, infer_replicas);
+        is->reorder_size = infer_depth > 0 ? FFMAX(infer_depth, is->nb_replicas) : 2 * is->nb_replicas;
+        is->replicas = new InferReplica[is->nb_replicas]();
+        is->reorder = (InferSlot *)av_mallocz_array(is->reorder_size, sizeof(*is->reorder));
+        is->last_mask = av_frame_alloc();
+        is->encode_frame = av_frame_alloc();
+        is->encode_mask  = av_frame_alloc();
+        if (!is->reorder || !is->last_mask || !is->encode_frame || !is->encode_mask)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < is->reorder_size; i++) {
+            if (!(is->reorder[i].f.frame = av_frame_alloc()) ||
+                !(is->reorder[i].f.mask = av_frame_alloc()) ||
+                !(is->reorder[i].f.analysis = av_frame_alloc()))
+                return AVERROR(ENOMEM);
+        }
+        for (i = 0; i < is->nb_replicas; i++) {
+            InferReplica *r = &is->replicas[i];
+            r->is = is;
+            r->index = i;
+            if (infer_client)
+                continue;
+            r->net = PoolNet();
+            poolnet_share_weights(r->net, model);
+            r->net->eval();
+        }
+        if (is->nb_replicas > 1)
+            av_log(NULL, AV_LOG_INFO, "PoolNet: %d replicas, %d pictures in flight, %s dispatch\n",
+                   is->nb_replicas, is->reorder_size, infer_dispatch_rr ? "rr" : "steal");
+    }
+
+    is->infer_next_seq = is->infer_next_release = 0;
+    is->budget_time = 0;
+    for (i = 0; i < is->nb_replicas; i++) {
+        InferReplica *r = &is->replicas[i];
+        r->nb_frames = r->busy_time = 0;
+        r->tid = SDL_CreateThread(inference_thread, "inference", r);
+        if (!r->tid) {
+            av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+            return AVERROR(ENOMEM);
+        }
+    }
+    return 0;
+}
+
+/* The replica the saliency filters run on, created by their first forward
+ * pass so that a -vf without them costs no network. It lives on
+ * video_thread and only shares the weights with the inference stage. */
+static InferReplica *inference_filter_replica(VideoState *is)
+{
+    if (!is->filter_replica) {
+        InferReplica *r = new InferReplica();
+        r->is = is;
+        r->index = -1;
+        r->net = PoolNet();
+        poolnet_share_weights(r->net, model);
+        r->net->eval();
+        is->filter_replica = r;
+    }
+    return is->filter_replica;
+}
+
+/* join the replicas, videoq must have been aborted */
+static void inference_stop(VideoState *is)
+{
+    int64_t now = av_gettime_relative();
+    int i;
+
+    frame_queue_signal(&is->infq);
+    frame_queue_signal(&is->pictq);
+    SDL_LockMutex(is->infer_mutex);
+    SDL_CondBroadcast(is->infer_cond);
+    SDL_UnlockMutex(is->infer_mutex);
+
+    for (i = 0; i < is->nb_replicas; i++) {
+        InferReplica *r = &is->replicas[i];
+        if (!r->tid)
+            continue;
+        SDL_WaitThread(r->tid, NULL);
+        r->tid = NULL;
+        av_log(NULL, AV_LOG_VERBOSE,
+               "inference replica %d (%d cpus from %d): %"PRId64" frames, %.1f ms/frame, %.0f%% busy\n",
+               r->index, r->nb_cpus, r->cpu_first, r->nb_frames,
+               r->nb_frames ? r->busy_time / 1000.0 / r->nb_frames : 0.0,
+               100.0 * inference_utilization(r, now));
+    }
+    for (i = 0; i < is->reorder_size; i++) {
+        frame_queue_unref_item(&is->reorder[i].f);
+        is->reorder[i].done = 0;
+    }
+    is->infer_next_seq = is->infer_next_release = 0;
+    is->infer_taking = 0;
+    is->infer_releasing = 0;
+    av_frame_unref(is->last_mask);
+}
+
+static void inference_free(VideoState *is)
+{
+    int i, j;
+
+    if (is->replicas) {
+        for (i = 0; i < is->nb_replicas; i++) {
+            InferReplica *r = &is->replicas[i];
+            for (j = 0; j < INFER_SKIP; j++)
+                preprocess_freep(&r->pre[j]);
+        }
+        delete[] is->replicas;
+        is->replicas = NULL;
+    }
+    delete is->filter_replica;
+    is->filter_replica = NULL;
+    if (is->reorder) {
+        for (i = 0; i < is->reorder_size; i++) {
+            av_frame_free(&is->reorder[i].f.frame);
+            av_frame_free(&is->reorder[i].f.mask);
+            av_frame_free(&is->reorder[i].f.analysis);
+        }
+        av_freep(&is->reorder);
+    }
+    av_frame_free(&is->last_mask);
+    av_frame_free(&is->encode_frame);
+    av_frame_free(&is->encode_mask);
+}
+
+static int subtitle_thread(void *arg)
+{
+    VideoState *is = arg;
+    Frame *sp;
+    int got_subtitle;
+    double pts;
+
+    placement_apply(PLACEMENT_ADEC);
+    for (;;) {
+        if (!(sp = frame_queue_peek_writable(&is->subpq)))
+            return 0;
+
+        if ((got_subtitle = decoder_decode_frame(&is->subdec, NULL, &sp->sub)) < 0)
+            break;
+
+        pts = 0;
+
+        if (got_subtitle && sp->sub.format == 0) {
+            if (sp->sub.pts != AV_NOPTS_VALUE)
+                pts = sp->sub.pts / (double)AV_TIME_BASE;
+            sp->pts = pts;
+            sp->serial = is->subdec.pkt_serial;
+            sp->width = is->subdec.avctx->width;
+            sp->height = is->subdec.avctx->height;
+            sp->uploaded = 0;
+
+            /* now we can update the picture count */
+            frame_queue_push(&is->subpq);
+        } else if (got_subtitle) {
+            avsubtitle_free(&sp->sub);
+        }
+    }
+    return 0;
+}
+
+/* copy samples for viewing in editor window */
+static void update_sample_display(VideoState *is, short *samples, int samples_size)
+{
+    int size, len;
+
+    size = samples_size / sizeof(short);
+    while (size > 0) {
         len = SAMPLE_ARRAY_SIZE - is->sample_array_index;
         if (len > size)
             len = size;
@@ -2612,8 +3858,16 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len)
 {
     VideoState *is = opaque;
     int audio_size, len1;
+    int64_t now = av_gettime_relative();
 
-    audio_callback_time = av_gettime_relative();
+    if (!is->audio_callback_placed) {
+        placement_apply(PLACEMENT_AUDIO);
+        is->audio_callback_placed = 1;
+    } else {
+        placement_jitter_add(&is->audio_jitter, (now - audio_callback_time) / 1000000.0 -
+                             (double)len / is->audio_tgt.bytes_per_sec);
+    }
+    audio_callback_time = now;
 
     while (len > 0) {
         if (is->audio_buf_index >= is->audio_buf_size) {
@@ -2780,13 +4034,22 @@ static int stream_component_open(VideoState *is, int stream_index)
         avctx->flags2 |= AV_CODEC_FLAG2_FAST;
 
     opts = filter_codec_opts(codec_opts, avctx->codec_id, ic, ic->streams[stream_index], codec);
-    if (!av_dict_get(opts, "threads", NULL, 0))
-        av_dict_set(&opts, "threads", "auto", 0);
+    if (!av_dict_get(opts, "threads", NULL, 0)) {
+        if (budget_active())
+            av_dict_set_int(&opts, "threads", avctx->codec_type == AVMEDIA_TYPE_VIDEO ? budget_get(BUDGET_DECODE) : 1, 0);
+        else
+            av_dict_set(&opts, "threads", "auto", 0);
+    }
     if (stream_lowres)
         av_dict_set_int(&opts, "lowres", stream_lowres, 0);
     if (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)
         av_dict_set(&opts, "refcounted_frames", "1", 0);
-    if ((ret = avcodec_open2(avctx, codec, &opts)) < 0) {
+    /* the frame and slice threads of the decoder inherit the CPUs of the
+     * thread that opens it, and "auto" counts those */
+    placement_spawn(avctx->codec_type == AVMEDIA_TYPE_VIDEO ? PLACEMENT_VDEC : PLACEMENT_ADEC);
+    ret = avcodec_open2(avctx, codec, &opts);
+    placement_restore();
+    if (ret < 0) {
         goto fail;
     }
     if ((t = av_dict_get(opts, "", NULL, AV_DICT_IGNORE_SUFFIX))) {
@@ -2821,6 +4084,7 @@ static int stream_component_open(VideoState *is, int stream_index)
 #endif
 
         /* prepare audio output */
+        is->audio_callback_placed = 0;
         if ((ret = audio_open(is, channel_layout, nb_channels, sample_rate, &is->audio_tgt)) < 0)
             goto fail;
         is->audio_hw_buf_size = ret;
@@ -2851,9 +4115,17 @@ static int stream_component_open(VideoState *is, int stream_index)
         is->video_stream = stream_index;
         is->video_st = ic->streams[stream_index];
 
+        /* until video_thread configured its filters */
+        infer_mask_size(ic, is->video_st, &is->mask_width, &is->mask_height);
         decoder_init(&is->viddec, avctx, &is->videoq, is->continue_read_thread);
         if ((ret = decoder_start(&is->viddec, video_thread, "video_decoder", is)) < 0)
             goto out;
+#if !CONFIG_AVFILTER
+        if (sidecar_path)
+            inference_open_sidecar(is);
+#endif
+        if ((ret = inference_start(is)) < 0)
+            goto out;
         is->queue_attachments_req = 1;
         break;
     case AVMEDIA_TYPE_SUBTITLE:
@@ -2883,11 +4155,11 @@ static int decode_interrupt_cb(void *ctx)
     return is->abort_request;
 }
 
-static int stream_has_enough_packets(AVStream *st, int stream_id, PacketQueue *queue) {
+static int stream_has_enough_packets(AVStream *st, int stream_id, PacketQueue *queue, double min_duration) {
     return stream_id < 0 ||
            queue->abort_request ||
            (st->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
-           queue->nb_packets > MIN_FRAMES && (!queue->duration || av_q2d(st->time_base) * queue->duration > 1.0);
+           queue->nb_packets > MIN_FRAMES && (!queue->duration || av_q2d(st->time_base) * queue->duration > min_duration);
 }
 
 static int is_realtime(AVFormatContext *s)
@@ -2915,6 +4187,7 @@ static int read_thread(void *arg)
     int st_index[AVMEDIA_TYPE_NB];
     AVPacket pkt1, *pkt = &pkt1;
     int64_t stream_start_time;
+    double video_min_duration;
     int pkt_in_play_range = 0;
     AVDictionaryEntry *t;
     SDL_mutex *wait_mutex = SDL_CreateMutex();
@@ -2926,6 +4199,7 @@ static int read_thread(void *arg)
         ret = AVERROR(ENOMEM);
         goto fail;
     }
+    placement_apply(PLACEMENT_READ);
 
     memset(st_index, -1, sizeof(st_index));
     is->eof = 0;
@@ -3031,7 +4305,7 @@ static int read_thread(void *arg)
         st_index[AVMEDIA_TYPE_VIDEO] =
             av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO,
                                 st_index[AVMEDIA_TYPE_VIDEO], -1, NULL, 0);
-    if (!audio_disable)
+    if (!audio_disable && !is->no_audio)
         st_index[AVMEDIA_TYPE_AUDIO] =
             av_find_best_stream(ic, AVMEDIA_TYPE_AUDIO,
                                 st_index[AVMEDIA_TYPE_AUDIO],
@@ -3148,12 +4422,15 @@ static int read_thread(void *arg)
             is->queue_attachments_req = 0;
         }
 
+        SDL_LockMutex(is->pictq.mutex);
+        video_min_duration = is->video_min_duration;
+        SDL_UnlockMutex(is->pictq.mutex);
         /* if the queue are full, no need to read more */
         if (infinite_buffer<1 &&
-              (is->audioq.size + is->videoq.size + is->subtitleq.size > MAX_QUEUE_SIZE
-            || (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq) &&
-                stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq) &&
-                stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq)))) {
+              (is->audioq.size + is->videoq.size + is->subtitleq.size > (int64_t)packet_queue_mb << 20
+            || (stream_has_enough_packets(is->audio_st, is->audio_stream, &is->audioq, 1.0) &&
+                stream_has_enough_packets(is->video_st, is->video_stream, &is->videoq, video_min_duration) &&
+                stream_has_enough_packets(is->subtitle_st, is->subtitle_stream, &is->subtitleq, 1.0)))) {
             /* wait 10 ms */
             SDL_LockMutex(wait_mutex);
             SDL_CondWaitTimeout(is->continue_read_thread, wait_mutex, 10);
@@ -3162,7 +4439,9 @@ static int read_thread(void *arg)
         }
         if (!is->paused &&
             (!is->audio_st || (is->auddec.finished == is->audioq.serial && frame_queue_nb_remaining(&is->sampq) == 0)) &&
-            (!is->video_st || (is->viddec.finished == is->videoq.serial && frame_queue_nb_remaining(&is->pictq) == 0))) {
+            (!is->video_st || (is->viddec.finished == is->videoq.serial && frame_queue_nb_remaining(&is->infq) == 0 &&
+                               is->infer_next_release == is->infer_next_seq &&
+                               frame_queue_nb_remaining(&is->pictq) == 0))) {
             if (loop != 1 && (!loop || --loop)) {
                 stream_seek(is, start_time != AV_NOPTS_VALUE ? start_time : 0, 0, 0);
             } else if (autoexit) {
@@ -3242,10 +4521,33 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat)
     is->iformat = iformat;
     is->ytop    = 0;
     is->xleft   = 0;
+    /* there is one audio device, the first input plays its audio */
+    is->no_audio = nb_open_streams > 0;
 
     /* start video display */
-    if (frame_queue_init(&is->pictq, &is->videoq, VIDEO_PICTURE_QUEUE_SIZE, 1) < 0)
+    if (frame_queue_init(&is->infq, &is->videoq, VIDEO_PICTURE_QUEUE_SIZE, 0) < 0)
+        goto fail;
+    if (!(is->infer_mutex = SDL_CreateMutex()) || !(is->infer_cond = SDL_CreateCond())) {
+        av_log(NULL, AV_LOG_FATAL, "SDL_CreateMutex/Cond(): %s\n", SDL_GetError());
+        goto fail;
+    }
+    is->infer_width  = infer_width;
+    is->infer_height = infer_height;
+    is->infer_fit    = infer_fit;
+    is->mask_cache = mask_cache_alloc((int64_t)mask_cache_mb << 20);
+    if (!(is->mask_scaled = av_frame_alloc()))
         goto fail;
+    if (saliency_out) {
+        SaliencyEncoderOptions opts = { saliency_out, saliency_mode, saliency_codec,
+                                        saliency_bit_rate, saliency_queue };
+        if (saliency_encoder_open(&is->encoder, &opts) < 0)
+            goto fail;
+        saliency_encoder_set_blocking(is->encoder, offline);
+    }
+    if (frame_queue_init(&is->pictq, &is->videoq, FFMAX(picture_queue_max, VIDEO_PICTURE_QUEUE_SIZE), 1) < 0)
+        goto fail;
+    frame_queue_set_depth(&is->pictq, VIDEO_PICTURE_QUEUE_SIZE);
+    is->video_min_duration = 1.0;
     if (frame_queue_init(&is->subpq, &is->subtitleq, SUBPICTURE_QUEUE_SIZE, 0) < 0)
         goto fail;
     if (frame_queue_init(&is->sampq, &is->audioq, SAMPLE_QUEUE_SIZE, 1) < 0)
@@ -3293,6 +4595,9 @@ static void stream_cycle_channel(VideoState *is, int codec_type)
     AVProgram *p = NULL;
     int nb_streams = is->ic->nb_streams;
 
+    if (codec_type == AVMEDIA_TYPE_AUDIO && is->no_audio)
+        return;
+
     if (codec_type == AVMEDIA_TYPE_VIDEO) {
         start_index = is->last_video_stream;
         old_index = is->video_stream;
@@ -3392,7 +4697,14 @@ static void refresh_loop_wait_event(VideoState *is, SDL_Event *event) {
         if (remaining_time > 0.0)
             av_usleep((int64_t)(remaining_time * 1000000.0));
         remaining_time = REFRESH_RATE;
-        if (is->show_mode != SHOW_MODE_NONE && (!is->paused || is->force_refresh))
+        if (nb_open_streams > 1) {
+            int i;
+            for (i = 0; i < nb_open_streams; i++) {
+                VideoState *s = open_streams[i];
+                if (s->show_mode != SHOW_MODE_NONE && (!s->paused || s->force_refresh))
+                    video_refresh(s, &remaining_time);
+            }
+        } else if (is->show_mode != SHOW_MODE_NONE && (!is->paused || is->force_refresh))
             video_refresh(is, &remaining_time);
         SDL_PumpEvents();
     }
@@ -3425,6 +4737,498 @@ static void seek_chapter(VideoState *is, int incr)
                                  AV_TIME_BASE_Q), 0, 0);
 }
 
+/* t in seconds as hh:mm:ss, for the offline progress line */
+static void print_duration(AVBPrint *buf, double t)
+{
+    int secs = isnan(t) || t < 0 ? 0 : (int)t;
+    av_bprintf(buf, "%02d:%02d:%02d", secs / 3600, (secs / 60) % 60, secs % 60);
+}
+
+/* Pull pictures from pictq as soon as the inference stage hands them over,
+ * without clocks or a display. The masks have been computed (and recorded
+ * to the sidecar) upstream, this loop writes them to -mask_out and reports
+ * progress. Returns when read_thread reaches EOF. */
+static void offline_loop(VideoState *is)
+{
+    SDL_Event event;
+    AVBPrint buf;
+    Frame *vp;
+    FILE *out = NULL;
+    uint8_t *blank = NULL;
+    int64_t start = av_gettime_relative(), last_report = 0, now;
+    int64_t nb_frames = 0, nb_blank = 0;
+    double start_pts = NAN, last_pts = NAN, total = NAN;
+    double elapsed, progress;
+    int y, done = 0, mask_width = 0, mask_height = 0;
+
+    if (mask_out) {
+        if (!(out = fopen(mask_out, "wb"))) {
+            av_log(NULL, AV_LOG_FATAL, "Could not open %s\n", mask_out);
+            do_exit(is);
+        }
+    } else if (!sidecar_path && !saliency_out) {
+        av_log(NULL, AV_LOG_WARNING, "None of -sidecar, -mask_out or -saliency_out given, the masks are discarded\n");
+    }
+    if (is->ic->duration != AV_NOPTS_VALUE)
+        total = is->ic->duration / (double)AV_TIME_BASE;
+    if (is->ic->start_time != AV_NOPTS_VALUE)
+        start_pts = is->ic->start_time / (double)AV_TIME_BASE;
+
+    while (!done) {
+        if (SDL_PeepEvents(&event, 1, SDL_GETEVENT, FF_QUIT_EVENT, FF_QUIT_EVENT) > 0)
+            done = 1;
+
+        if (!done)
+            frame_queue_wait_readable(&is->pictq, 10);
+
+        while (frame_queue_nb_remaining(&is->pictq) > 0) {
+            vp = frame_queue_peek(&is->pictq);
+            if (vp->serial == is->videoq.serial) {
+                if (out && !blank) {
+                    /* known once video_thread configured its filters */
+                    SDL_LockMutex(is->infer_mutex);
+                    mask_width  = is->mask_width;
+                    mask_height = is->mask_height;
+                    SDL_UnlockMutex(is->infer_mutex);
+                    if (!(blank = (uint8_t *)av_mallocz(mask_width * mask_height))) {
+                        fclose(out);
+                        do_exit(is);
+                    }
+                    av_log(NULL, AV_LOG_INFO, "Writing %dx%d gray masks to %s\n", mask_width, mask_height, mask_out);
+                }
+                if (out) {
+                    if (vp->mask->data[0] && vp->mask->width == mask_width && vp->mask->height == mask_height) {
+                        for (y = 0; y < vp->mask->height; y++)
+                            fwrite(vp->mask->data[0] + y * vp->mask->linesize[0], 1, vp->mask->width, out);
+                    } else {
+                        if (vp->mask->data[0] && !nb_blank++)
+                            av_log(NULL, AV_LOG_WARNING, "%dx%d masks are written blank to %s\n",
+                                   vp->mask->width, vp->mask->height, mask_out);
+                        fwrite(blank, 1, mask_width * mask_height, out);
+                    }
+                }
+                if (isnan(start_pts))
+                    start_pts = vp->pts;
+                last_pts = vp->pts;
+                nb_frames++;
+            }
+            frame_queue_next(&is->pictq);
+        }
+
+        now = av_gettime_relative();
+        if (done || now - last_report >= 500000) {
+            elapsed = (now - start) / 1000000.0;
+            progress = total > 0 && !isnan(last_pts) ? av_clipd((last_pts - start_pts) / total, 0, 1) : NAN;
+            av_bprint_init(&buf, 0, AV_BPRINT_SIZE_AUTOMATIC);
+            av_bprintf(&buf, "frame=%6"PRId64" fps=%6.1f time=", nb_frames, elapsed > 0 ? nb_frames / elapsed : 0.0);
+            print_duration(&buf, isnan(last_pts) ? 0 : last_pts - start_pts);
+            if (!isnan(progress) && progress > 0) {
+                av_bprintf(&buf, " done=%5.1f%% eta=", 100 * progress);
+                print_duration(&buf, done ? 0 : elapsed * (1 - progress) / progress);
+            }
+            fprintf(stderr, "%s%s", buf.str, done ? "\n" : "   \r");
+            fflush(stderr);
+            av_bprint_finalize(&buf, NULL);
+            last_report = now;
+        }
+    }
+    if (out && fclose(out))
+        av_log(NULL, AV_LOG_ERROR, "Error writing %s\n", mask_out);
+    av_free(blank);
+    do_exit(is);
+}
+
+#ifdef __linux__
+/* Sharded offline processing
+ *
+ * The input is split at keyframes into -shards time ranges. Each range is
+ * processed by a child process running this player with -offline -ss -t on
+ * its own group of cores, recording to a sidecar of its own. A shard
+ * decodes from the keyframe at or before its start and a little past its
+ * end, so pictures reordered across a boundary are complete; the merge
+ * keeps only the pictures of the range a shard owns. Shards that fail are
+ * retried once. The sidecars of finished shards are kept until the merge,
+ * so a failed run can be resumed. */
+
+#define SHARD_MAX_ATTEMPTS 2
+#define SHARD_TAIL_MARGIN 1.0
+
+typedef struct Shard {
+    int index;
+    double start, end;          /* seconds from the start of the file, end < 0 up to EOF */
+    int64_t pts_start, pts_end; /* owned range in the stream time base */
+    char *sidecar;
+    char *log;
+    char **args;
+    pid_t pid;
+    int attempts;
+    int done;
+    int64_t start_time;
+} Shard;
+
+static void shard_free(Shard *sh)
+{
+    int i;
+
+    for (i = 0; sh->args && sh->args[i]; i++)
+        av_free(sh->args[i]);
+    av_freep(&sh->args);
+    av_freep(&sh->sidecar);
+    av_freep(&sh->log);
+}
+
+/* this command line without the options the coordinator owns */
+static char **shard_args(int argc, char **argv, Shard *sh)
+{
+    char **args = (char **)av_mallocz_array(argc + 12, sizeof(*args));
+    int i, n = 0;
+
+    if (!args)
+        return NULL;
+    args[n++] = av_strdup(argv[0]);
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-shards") || !strcmp(argv[i], "-sidecar") || !strcmp(argv[i], "-mask_out") ||
+            !strcmp(argv[i], "-saliency_out") || !strcmp(argv[i], "-ss") || !strcmp(argv[i], "-t") ||
+            !strcmp(argv[i], "-cpu_layout")) {
+            i++;
+            continue;
+        }
+        if (!strcmp(argv[i], "-offline"))
+            continue;
+        args[n++] = av_strdup(argv[i]);
+    }
+    args[n++] = av_strdup("-offline");
+    args[n++] = av_strdup("-ss");
+    args[n++] = av_asprintf("%f", sh->start);
+    if (sh->end >= 0) {
+        args[n++] = av_strdup("-t");
+        args[n++] = av_asprintf("%f", sh->end - sh->start + SHARD_TAIL_MARGIN);
+    }
+    args[n++] = av_strdup("-sidecar");
+    args[n++] = av_strdup(sh->sidecar);
+    for (i = 0; i < n; i++) {
+        if (!args[i]) {
+            sh->args = args;
+            shard_free(sh);
+            return NULL;
+        }
+    }
+    return args;
+}
+
+static pid_t shard_spawn(Shard *sh, const int *cpus, int nb_cpus)
+{
+    cpu_set_t set;
+    pid_t pid;
+    int i, fd;
+
+    sh->attempts++;
+    sh->start_time = av_gettime_relative();
+    if ((pid = fork()))
+        return pid;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < nb_cpus; i++)
+        CPU_SET(cpus[i], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+    if ((fd = open(sh->log, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    execv("/proc/self/exe", sh->args);
+    _exit(127);
+}
+
+/* shard boundaries at the keyframes nearest to an even split */
+static int shard_split(AVFormatContext *ic, AVStream *st, Shard *shards, int nb)
+{
+    double origin = ic->start_time != AV_NOPTS_VALUE ? ic->start_time / (double)AV_TIME_BASE : 0;
+    double begin  = start_time != AV_NOPTS_VALUE ? start_time / (double)AV_TIME_BASE : 0;
+    double total, t;
+    int64_t ts;
+    int k, idx, n = 0;
+
+    if (duration != AV_NOPTS_VALUE)
+        total = duration / (double)AV_TIME_BASE;
+    else if (ic->duration != AV_NOPTS_VALUE)
+        total = ic->duration / (double)AV_TIME_BASE - begin;
+    else
+        return AVERROR(EINVAL);
+
+    for (k = 0; k < nb; k++) {
+        t = begin + total * k / nb;
+        if (k && st->nb_index_entries > 0) {
+            ts  = av_rescale_q(llrint((t + origin) * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base);
+            idx = av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD);
+            if (idx >= 0)
+                t = st->index_entries[idx].timestamp * av_q2d(st->time_base) - origin;
+        }
+        /* short GOP-less inputs may give the same keyframe twice */
+        if (n && t <= shards[n - 1].start)
+            continue;
+        shards[n].index = n;
+        shards[n].start = t;
+        shards[n].pts_start = n ? av_rescale_q(llrint((t + origin) * AV_TIME_BASE), AV_TIME_BASE_Q, st->time_base)
+                                : INT64_MIN;
+        n++;
+    }
+    for (k = 0; k < n; k++) {
+        if (k + 1 < n) {
+            shards[k].end     = shards[k + 1].start;
+            shards[k].pts_end = shards[k + 1].pts_start;
+        } else {
+            shards[k].end     = duration != AV_NOPTS_VALUE ? begin + total : -1;
+            shards[k].pts_end = INT64_MAX;
+        }
+    }
+    return n;
+}
+
+/* Concatenate the owned pictures of every shard, in pts order, into the
+ * final sidecar and -mask_out. Pictures no shard has a mask for, found
+ * from the pts steps of frame_duration, get a blank one in -mask_out, like
+ * the pictures without a mask of -offline. */
+static int shard_merge(Shard *shards, int nb, uint64_t fingerprint, int mask_width, int mask_height,
+                       int64_t frame_duration, int64_t *nb_frames)
+{
+    Sidecar *out = NULL, *in = NULL;
+    AVFrame *mask = av_frame_alloc();
+    FILE *raw = NULL;
+    uint8_t *blank = NULL;
+    int64_t pts, gap, last_pts = AV_NOPTS_VALUE, overlap = 0, nb_blank = 0;
+    int k, i, y, ret = 0;
+
+    *nb_frames = 0;
+    if (!mask)
+        return AVERROR(ENOMEM);
+    if (mask_out && !(raw = fopen(mask_out, "wb"))) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s\n", mask_out);
+        ret = AVERROR(errno);
+        goto end;
+    }
+    if (raw && !(blank = (uint8_t *)av_mallocz(mask_width * mask_height))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = sidecar_open(&out, sidecar_path, fingerprint, mask_width, mask_height)) != 1) {
+        if (ret >= 0)
+            sidecar_close(&out);
+        ret = ret < 0 ? ret : AVERROR(EEXIST);
+        goto end;
+    }
+    sidecar_set_blocking(out, 1);
+
+    for (k = 0; k < nb; k++) {
+        if ((ret = sidecar_open(&in, shards[k].sidecar, fingerprint, mask_width, mask_height)) != 0) {
+            av_log(NULL, AV_LOG_ERROR, "Shard %d lost its sidecar\n", k);
+            if (ret > 0)
+                sidecar_close(&in);
+            ret = AVERROR_INVALIDDATA;
+            goto end;
+        }
+        for (i = 0; i < sidecar_nb_entries(in); i++) {
+            pts = sidecar_entry_pts(in, i);
+            if (pts < shards[k].pts_start || pts >= shards[k].pts_end) {
+                overlap++;
+                continue;
+            }
+            if (sidecar_read(in, pts, mask) > 0) {
+                sidecar_write(out, pts, mask);
+                if (raw) {
+                    if (last_pts != AV_NOPTS_VALUE && frame_duration > 0) {
+                        for (gap = llrint((pts - last_pts) / (double)frame_duration) - 1; gap > 0; gap--) {
+                            fwrite(blank, 1, mask_width * mask_height, raw);
+                            nb_blank++;
+                        }
+                    }
+                    for (y = 0; y < mask->height; y++)
+                        fwrite(mask->data[0] + y * mask->linesize[0], 1, mask->width, raw);
+                }
+                last_pts = pts;
+                (*nb_frames)++;
+            }
+            av_frame_unref(mask);
+        }
+        sidecar_close(&in);
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Merged %"PRId64" masks, dropped %"PRId64" decoded in the overlap\n",
+           *nb_frames, overlap);
+    if (nb_blank)
+        av_log(NULL, AV_LOG_WARNING, "%"PRId64" pictures no shard has a mask for are written blank to %s\n",
+               nb_blank, mask_out);
+    ret = 0;
+
+end:
+    sidecar_close(&out);
+    if (raw && fclose(raw) && !ret)
+        ret = AVERROR(EIO);
+    av_free(blank);
+    av_frame_free(&mask);
+    return ret;
+}
+
+static int shard_run(int argc, char **argv)
+{
+    AVFormatContext *ic = NULL;
+    Shard shards[MAX_CPUS] = { 0 };
+    int cpus[MAX_CPUS];
+    int nb_cpus = placement_allowed_cpus(cpus, MAX_CPUS);
+    int nb, i, k, running = 0, failed = 0, group, status, ret;
+    int mask_width, mask_height;
+    int64_t start = av_gettime_relative(), nb_frames, frame_duration = 0;
+    uint64_t fingerprint;
+    AVRational fr;
+    pid_t pid;
+
+    if (sidecar_hash_file(&model_fingerprint, model_path) < 0)
+        av_log(NULL, AV_LOG_WARNING, "Could not read %s for the sidecar fingerprint\n", model_path);
+
+    if ((ret = avformat_open_input(&ic, input_filename, file_iformat, NULL)) < 0 ||
+        (ret = avformat_find_stream_info(ic, NULL)) < 0) {
+        print_error(input_filename, ret);
+        avformat_close_input(&ic);
+        return 1;
+    }
+    /* the stream the workers pick, -vst included, which the fingerprint
+     * records so that sidecars of another stream are not merged */
+    k = -1;
+    if (wanted_stream_spec[AVMEDIA_TYPE_VIDEO]) {
+        for (i = 0; i < (int)ic->nb_streams && k < 0; i++)
+            if (ic->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+                avformat_match_stream_specifier(ic, ic->streams[i], wanted_stream_spec[AVMEDIA_TYPE_VIDEO]) > 0)
+                k = i;
+        if (k < 0) {
+            av_log(NULL, AV_LOG_FATAL, "Stream specifier %s does not match any video stream\n",
+                   wanted_stream_spec[AVMEDIA_TYPE_VIDEO]);
+            avformat_close_input(&ic);
+            return 1;
+        }
+    }
+    if ((k = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, k, -1, NULL, 0)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "%s: no video stream to shard\n", input_filename);
+        avformat_close_input(&ic);
+        return 1;
+    }
+    fingerprint = sidecar_fingerprint(ic->streams[k], vfilters_list ? vfilters_list[0] : NULL);
+    fr = av_guess_frame_rate(ic, ic->streams[k], NULL);
+    if (fr.num && fr.den)
+        frame_duration = av_rescale_q(1, av_inv_q(fr), ic->streams[k]->time_base);
+    infer_mask_size(ic, ic->streams[k], &mask_width, &mask_height);
+    nb = shard_split(ic, ic->streams[k], shards, FFMIN(FFMIN(nb_shards, nb_cpus), MAX_CPUS));
+    avformat_close_input(&ic);
+    if (nb < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Sharding needs the duration of the input, use -t\n");
+        return 1;
+    }
+    if (sidecar_is_complete(sidecar_path, fingerprint, mask_width, mask_height)) {
+        av_log(NULL, AV_LOG_INFO, "Sidecar %s is up to date\n", sidecar_path);
+        return 0;
+    }
+
+    group = nb_cpus / nb;
+    for (k = 0; k < nb; k++) {
+        Shard *sh = &shards[k];
+        sh->sidecar = av_asprintf("%s.shard%d-%.3f", sidecar_path, k, sh->start);
+        sh->log     = av_asprintf("%s.shard%d.log", sidecar_path, k);
+        if (!sh->sidecar || !sh->log || !(sh->args = shard_args(argc, argv, sh))) {
+            av_log(NULL, AV_LOG_FATAL, "Could not allocate shard %d\n", k);
+            return 1;
+        }
+        /* left over from an interrupted run */
+        if (sidecar_is_complete(sh->sidecar, fingerprint, mask_width, mask_height)) {
+            av_log(NULL, AV_LOG_INFO, "Shard %d [%.2f, %.2f) already done\n", k, sh->start, sh->end);
+            sh->done = 1;
+            continue;
+        }
+        if ((sh->pid = shard_spawn(sh, cpus + k * group, group)) < 0) {
+            av_log(NULL, AV_LOG_FATAL, "fork(): %s\n", strerror(errno));
+            return 1;
+        }
+        running++;
+    }
+    av_log(NULL, AV_LOG_INFO, "%d shards on %d cores each, logs in %s.shard*.log\n", nb, group, sidecar_path);
+
+    while (running) {
+        if ((pid = waitpid(-1, &status, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (k = 0; k < nb && shards[k].pid != pid; k++)
+            ;
+        if (k == nb)
+            continue;
+        running--;
+        /* the player exits with 0 on most errors, so a shard counts as done
+         * only once its sidecar has an index */
+        if (WIFEXITED(status) && !WEXITSTATUS(status) &&
+            sidecar_is_complete(shards[k].sidecar, fingerprint, mask_width, mask_height)) {
+            shards[k].done = 1;
+            av_log(NULL, AV_LOG_INFO, "Shard %d [%.2f, %.2f) done in %.1f s\n", k, shards[k].start,
+                   shards[k].end, (av_gettime_relative() - shards[k].start_time) / 1000000.0);
+        } else if (shards[k].attempts < SHARD_MAX_ATTEMPTS) {
+            av_log(NULL, AV_LOG_WARNING, "Shard %d failed, retrying, see %s\n", k, shards[k].log);
+            if ((shards[k].pid = shard_spawn(&shards[k], cpus + k * group, group)) > 0)
+                running++;
+        } else {
+            av_log(NULL, AV_LOG_ERROR, "Shard %d [%.2f, %.2f) failed, see %s\n",
+                   k, shards[k].start, shards[k].end, shards[k].log);
+        }
+    }
+
+    for (k = 0; k < nb; k++)
+        failed += !shards[k].done;
+    if (failed) {
+        av_log(NULL, AV_LOG_ERROR, "%d of %d shards failed, run again to resume\n", failed, nb);
+    } else if ((ret = shard_merge(shards, nb, fingerprint, mask_width, mask_height, frame_duration, &nb_frames)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not merge the shards into %s\n", sidecar_path);
+        failed = 1;
+    } else {
+        double elapsed = (av_gettime_relative() - start) / 1000000.0;
+        av_log(NULL, AV_LOG_INFO, "%"PRId64" masks in %.1f s, %.1f fps\n",
+               nb_frames, elapsed, elapsed > 0 ? nb_frames / elapsed : 0.0);
+        for (k = 0; k < nb; k++) {
+            char *idx = av_asprintf("%s.idx", shards[k].sidecar);
+            unlink(shards[k].sidecar);
+            if (idx)
+                unlink(idx);
+            unlink(shards[k].log);
+            av_free(idx);
+        }
+    }
+    for (k = 0; k < nb; k++)
+        shard_free(&shards[k]);
+    return failed ? 1 : 0;
+}
+#else
+static int shard_run(int argc, char **argv)
+{
+    av_log(NULL, AV_LOG_FATAL, "-shards is only supported on Linux\n");
+    return 1;
+}
+#endif
+
+/* close one of several inputs and give its tile to the others */
+static void stream_remove(VideoState *is)
+{
+    int i, j;
+
+    for (i = 0; i < nb_open_streams && open_streams[i] != is; i++)
+        ;
+    if (i == nb_open_streams)
+        return;
+    stream_close(is);
+    for (j = i + 1; j < nb_open_streams; j++)
+        open_streams[j - 1] = open_streams[j];
+    nb_open_streams--;
+    if (window && open_streams[0]->width) {
+        int w, h;
+        SDL_GetWindowSize(window, &w, &h);
+        streams_layout(w, h);
+    }
+}
+
 /* handle an event sent by the GUI */
 static void event_loop(VideoState *cur_stream)
 {
@@ -3552,6 +5356,9 @@ static void event_loop(VideoState *cur_stream)
                 do_exit(cur_stream);
                 break;
             }
+            /* keys and seeks go to the input clicked last */
+            if (nb_open_streams > 1)
+                cur_stream = stream_at(cur_stream, event.button.x, event.button.y);
             if (event.button.button == SDL_BUTTON_LEFT) {
                 static int64_t last_mouse_left_click = 0;
                 if (av_gettime_relative() - last_mouse_left_click <= 500000) {
@@ -3579,7 +5386,7 @@ static void event_loop(VideoState *cur_stream)
             }
                 if (seek_by_bytes || cur_stream->ic->duration <= 0) {
                     uint64_t size =  avio_size(cur_stream->ic->pb);
-                    stream_seek(cur_stream, size*x/cur_stream->width, 0, 1);
+                    stream_seek(cur_stream, size*(x - cur_stream->xleft)/cur_stream->width, 0, 1);
                 } else {
                     int64_t ts;
                     int ns, hh, mm, ss;
@@ -3588,7 +5395,7 @@ static void event_loop(VideoState *cur_stream)
                     thh  = tns / 3600;
                     tmm  = (tns % 3600) / 60;
                     tss  = (tns % 60);
-                    frac = x / cur_stream->width;
+                    frac = (x - cur_stream->xleft) / cur_stream->width;
                     ns   = frac * tns;
                     hh   = ns / 3600;
                     mm   = (ns % 3600) / 60;
@@ -3605,6 +5412,12 @@ static void event_loop(VideoState *cur_stream)
         case SDL_WINDOWEVENT:
             switch (event.window.event) {
                 case SDL_WINDOWEVENT_SIZE_CHANGED:
+                    if (nb_open_streams > 1) {
+                        screen_width  = event.window.data1;
+                        screen_height = event.window.data2;
+                        streams_layout(screen_width, screen_height);
+                        break;
+                    }
                     screen_width  = cur_stream->width  = event.window.data1;
                     screen_height = cur_stream->height = event.window.data2;
                     if (cur_stream->vis_texture) {
@@ -3615,8 +5428,15 @@ static void event_loop(VideoState *cur_stream)
                     cur_stream->force_refresh = 1;
             }
             break;
-        case SDL_QUIT:
         case FF_QUIT_EVENT:
+            /* with several inputs, only the one that ended is closed */
+            if (nb_open_streams > 1 && event.user.data1) {
+                stream_remove((VideoState *)event.user.data1);
+                if (cur_stream == event.user.data1)
+                    cur_stream = open_streams[0];
+                break;
+            }
+        case SDL_QUIT:
             do_exit(cur_stream);
             break;
         default:
@@ -3697,15 +5517,116 @@ static int opt_show_mode(void *optctx, const char *opt, const char *arg)
 
 static void opt_input_file(void *optctx, const char *filename)
 {
-    if (input_filename) {
+    if (nb_inputs == MAX_INPUTS) {
         av_log(NULL, AV_LOG_FATAL,
-               "Argument '%s' provided as input filename, but '%s' was already specified.\n",
-                filename, input_filename);
+               "Argument '%s' provided as input filename, but %d inputs were already specified.\n",
+                filename, MAX_INPUTS);
         exit(1);
     }
     if (!strcmp(filename, "-"))
         filename = "pipe:";
-    input_filename = filename;
+    input_filenames[nb_inputs++] = filename;
+    if (!input_filename)
+        input_filename = filename;
+}
+
+static int opt_infer_dispatch(void *optctx, const char *opt, const char *arg)
+{
+    if (!strcmp(arg, "rr"))
+        infer_dispatch_rr = 1;
+    else if (!strcmp(arg, "steal"))
+        infer_dispatch_rr = 0;
+    else {
+        av_log(NULL, AV_LOG_ERROR, "Unknown inference dispatch mode %s\n", arg);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static int opt_mask_view(void *optctx, const char *opt, const char *arg)
+{
+    if (!strcmp(arg, "dim"))
+        mask_view = COMPOSITE_DIM;
+    else if (!strcmp(arg, "tint"))
+        mask_view = COMPOSITE_TINT;
+    else if (!strcmp(arg, "mask"))
+        mask_view = COMPOSITE_MASK;
+    else {
+        av_log(NULL, AV_LOG_ERROR, "Unknown mask view %s\n", arg);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static int opt_infer_size(void *optctx, const char *opt, const char *arg)
+{
+    int w, h;
+
+    if (av_parse_video_size(&w, &h, arg) < 0 || w < 2 || h < 2) {
+        av_log(NULL, AV_LOG_ERROR, "Invalid inference size %s\n", arg);
+        return AVERROR(EINVAL);
+    }
+    infer_width  = w;
+    infer_height = h;
+    return 0;
+}
+
+static int opt_infer_fit(void *optctx, const char *opt, const char *arg)
+{
+    if (!strcmp(arg, "stretch"))
+        infer_fit = PREPROCESS_FIT_STRETCH;
+    else if (!strcmp(arg, "letterbox"))
+        infer_fit = PREPROCESS_FIT_LETTERBOX;
+    else if (!strcmp(arg, "crop"))
+        infer_fit = PREPROCESS_FIT_CROP;
+    else {
+        av_log(NULL, AV_LOG_ERROR, "Unknown inference fit %s\n", arg);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+/* "r,g,b" in 0..255 units, for -infer_mean and -infer_std */
+static int opt_infer_norm(void *optctx, const char *opt, const char *arg)
+{
+    float *dst = !strcmp(opt, "infer_mean") ? infer_mean : infer_std;
+    float v[3];
+
+    if (sscanf(arg, "%f,%f,%f", &v[0], &v[1], &v[2]) != 3 ||
+        (dst == infer_std && (v[0] == 0 || v[1] == 0 || v[2] == 0))) {
+        av_log(NULL, AV_LOG_ERROR, "Invalid -%s %s, expected r,g,b\n", opt, arg);
+        return AVERROR(EINVAL);
+    }
+    memcpy(dst, v, sizeof(v));
+    return 0;
+}
+
+static int opt_saliency_mode(void *optctx, const char *opt, const char *arg)
+{
+    if (!strcmp(arg, "overlay"))
+        saliency_mode = SALIENCY_OUTPUT_OVERLAY;
+    else if (!strcmp(arg, "alpha"))
+        saliency_mode = SALIENCY_OUTPUT_ALPHA;
+    else if (!strcmp(arg, "gray"))
+        saliency_mode = SALIENCY_OUTPUT_GRAY;
+    else {
+        av_log(NULL, AV_LOG_ERROR, "Unknown saliency output mode %s\n", arg);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static int opt_saliency_bit_rate(void *optctx, const char *opt, const char *arg)
+{
+    saliency_bit_rate = parse_number_or_die(opt, arg, OPT_INT64, 0, INT64_MAX);
+    return 0;
+}
+
+/* pictq cannot grow past the frames its array holds */
+static int opt_picture_queue_max(void *optctx, const char *opt, const char *arg)
+{
+    picture_queue_max = parse_number_or_die(opt, arg, OPT_INT, VIDEO_PICTURE_QUEUE_SIZE, FRAME_QUEUE_SIZE);
+    return 0;
 }
 
 static int opt_codec(void *optctx, const char *opt, const char *arg)
@@ -3785,6 +5706,42 @@ static const OptionDef options[] = {
     { "find_stream_info", OPT_BOOL | OPT_INPUT | OPT_EXPERT, { &find_stream_info },
         "read and decode the streams to fill missing information with heuristics" },
     { "filter_threads", HAS_ARG | OPT_INT | OPT_EXPERT, { &filter_nbthreads }, "number of filter threads per graph" },
+    { "profile", OPT_BOOL | OPT_EXPERT, { &profile_net }, "profile every PoolNet submodule and print a table at exit", "" },
+    { "infer_batch", OPT_INT | HAS_ARG | OPT_EXPERT, { &infer_batch }, "max pictures per forward pass over all inputs (0 = one per input and replica, 1 = no batching)", "n" },
+    { "infer_batch_wait", OPT_INT | HAS_ARG | OPT_EXPERT, { &infer_batch_wait }, "max time a picture waits for a batch to fill, in ms", "ms" },
+    { "headless", OPT_BOOL | OPT_EXPERT, { &headless }, "decode, infer and pace the video without a window" },
+    { "infer_daemon", OPT_STRING | HAS_ARG | OPT_EXPERT, { &infer_daemon_path }, "serve PoolNet to other players on a Unix socket instead of playing", "path" },
+    { "infer_remote", OPT_STRING | HAS_ARG | OPT_EXPERT, { &infer_remote_path }, "run PoolNet in the inference daemon listening on path", "path" },
+    { "infer_replicas", OPT_INT | HAS_ARG | OPT_EXPERT, { &infer_replicas }, "number of PoolNet replicas running in parallel", "n" },
+    { "infer_depth", OPT_INT | HAS_ARG | OPT_EXPERT, { &infer_depth }, "max pictures in flight through the replicas (0 = 2 per replica)", "n" },
+    { "infer_dispatch", HAS_ARG | OPT_EXPERT, { .func_arg = opt_infer_dispatch }, "hand pictures to the replicas in turn or to any idle one", "rr|steal" },
+    { "infer_deadline", OPT_INT | HAS_ARG | OPT_EXPERT, { &infer_deadline }, "downgrade or skip inference of pictures that would miss their display time", "" },
+    { "mask_cache", OPT_INT | HAS_ARG | OPT_EXPERT, { &mask_cache_mb }, "memory cap of the mask cache in MB (0 = off)", "size" },
+    { "sidecar", OPT_STRING | HAS_ARG | OPT_EXPERT, { &sidecar_path }, "read masks from, or record them to, a saliency sidecar file", "file" },
+    { "offline", OPT_BOOL | OPT_EXPERT, { &offline }, "run PoolNet on every frame as fast as possible, without display or audio", "" },
+    { "mask_out", OPT_STRING | HAS_ARG | OPT_EXPERT, { &mask_out }, "write the masks of -offline as raw gray video at the mask size", "file" },
+    { "shards", OPT_INT | HAS_ARG | OPT_EXPERT, { &nb_shards }, "split -offline processing into n worker processes at keyframes", "n" },
+    { "infer_pin", OPT_BOOL | OPT_EXPERT, { &infer_pin }, "pin each replica to its own group of cores", "" },
+    { "mask_overlay", OPT_BOOL | OPT_EXPERT, { &mask_overlay }, "draw the mask as an alpha blended texture over the picture instead of compositing on the CPU", "" },
+    { "mask_view", HAS_ARG | OPT_EXPERT, { .func_arg = opt_mask_view }, "show the mask by dimming the picture, as a red tint, or alone", "dim|tint|mask" },
+    { "infer_size", HAS_ARG | OPT_EXPERT, { .func_arg = opt_infer_size }, "network input size (default 300x400)", "size" },
+    { "infer_fit", HAS_ARG | OPT_EXPERT, { .func_arg = opt_infer_fit }, "stretch the picture to the network input, or keep its aspect ratio and pad or crop", "stretch|letterbox|crop" },
+    { "infer_nhwc", OPT_BOOL | OPT_EXPERT, { &infer_nhwc }, "feed PoolNet channels last (NHWC) input", "" },
+    { "infer_branch", OPT_BOOL | OPT_EXPERT, { &infer_branch }, "scale the pictures to the network input in the video filtergraph", "" },
+    { "cpu_layout", OPT_STRING | HAS_ARG | OPT_EXPERT, { &cpu_layout }, "CPUs of the read, decoder, audio, render and inference threads", "auto|role=cpus:..." },
+    { "rt_prio", OPT_INT | HAS_ARG | OPT_EXPERT, { &rt_prio }, "real-time (SCHED_FIFO) priority of the audio and render threads, 0 to disable", "prio" },
+    { "picture_queue_max", HAS_ARG | OPT_EXPERT, { .func_arg = opt_picture_queue_max }, "max depth of the picture queue when inference is slow (3 to 16)", "n" },
+    { "picture_queue_mb", OPT_INT | HAS_ARG | OPT_EXPERT, { &picture_queue_mb }, "max memory of the picture queue in MB", "mb" },
+    { "packet_queue_mb", OPT_INT | HAS_ARG | OPT_EXPERT, { &packet_queue_mb }, "max memory of the packet queues in MB", "mb" },
+    { "thread_budget", OPT_INT | HAS_ARG | OPT_EXPERT, { &thread_budget }, "total threads of decoding, filtering, inference and conversion, 0 for no limit", "n" },
+    { "infer_mean", HAS_ARG | OPT_EXPERT, { .func_arg = opt_infer_norm }, "subtract a per channel mean from the network input", "r,g,b" },
+    { "infer_std", HAS_ARG | OPT_EXPERT, { .func_arg = opt_infer_norm }, "divide the network input by a per channel deviation", "r,g,b" },
+    { "saliency_out", OPT_STRING | HAS_ARG | OPT_EXPERT, { &saliency_out }, "encode the pictures and their masks to a file", "file" },
+    { "saliency_mode", HAS_ARG | OPT_EXPERT, { .func_arg = opt_saliency_mode }, "mask dimmed into the picture, as alpha plane (yuva420p) or as a second gray stream", "overlay|alpha|gray" },
+    { "saliency_codec", OPT_STRING | HAS_ARG | OPT_EXPERT, { &saliency_codec }, "encoder of -saliency_out (default: the container's)", "encoder_name" },
+    { "saliency_b", HAS_ARG | OPT_EXPERT, { .func_arg = opt_saliency_bit_rate }, "bitrate of -saliency_out", "bitrate" },
+    { "saliency_queue", OPT_INT | HAS_ARG | OPT_EXPERT, { &saliency_queue }, "pictures waiting for the encoder before new ones are dropped", "n" },
+    { "profile_json", OPT_STRING | HAS_ARG | OPT_EXPERT, { &profile_json }, "write per-frame PoolNet profile as JSON lines", "file" },
     { NULL, },
 };
 
@@ -3833,7 +5790,7 @@ void show_help_default(const char *opt, const char *arg)
 /* Called from the main */
 int main(int argc, char **argv)
 {
-    int flags;
+    int flags, i;
     VideoState *is;
 
     init_dynload();
@@ -3856,7 +5813,18 @@ int main(int argc, char **argv)
 
     parse_options(NULL, argc, argv, options, opt_input_file);
 
-    if (!input_filename) {
+    if (infer_daemon_path) {
+        /* no input and no window, the players connect with -infer_remote */
+        if (input_filename)
+            av_log(NULL, AV_LOG_WARNING, "Inputs are ignored with -infer_daemon\n");
+        input_filename = NULL;
+        nb_inputs = 0;
+        nb_shards = 1;
+        offline = 0;
+        audio_disable = 1;
+        headless = 1;
+        infer_remote_path = NULL;
+    } else if (!input_filename) {
         show_usage();
         av_log(NULL, AV_LOG_FATAL, "An input file must be specified\n");
         av_log(NULL, AV_LOG_FATAL,
@@ -3864,6 +5832,42 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    if (nb_inputs > 1) {
+        if (nb_shards > 1 || offline) {
+            av_log(NULL, AV_LOG_FATAL, "-shards and -offline take a single input\n");
+            exit(1);
+        }
+        if (saliency_out || sidecar_path || mask_out) {
+            av_log(NULL, AV_LOG_WARNING, "-saliency_out, -sidecar and -mask_out are ignored with several inputs\n");
+            saliency_out = sidecar_path = mask_out = NULL;
+        }
+    }
+    if (nb_shards > 1) {
+        if (!sidecar_path) {
+            av_log(NULL, AV_LOG_FATAL, "-shards needs -sidecar\n");
+            exit(1);
+        }
+        /* the shard ranges are in stream pts, the sidecar in those of the
+         * filtered pictures, which fps, setpts and others change */
+        if (nb_vfilters) {
+            av_log(NULL, AV_LOG_FATAL, "-shards cannot be combined with -vf\n");
+            exit(1);
+        }
+        if (saliency_out)
+            av_log(NULL, AV_LOG_WARNING, "-saliency_out is ignored with -shards, play the sidecar back with -offline to encode it\n");
+        if (cpu_layout)
+            av_log(NULL, AV_LOG_WARNING, "-cpu_layout is ignored with -shards, each worker gets its own group of cores\n");
+        exit(shard_run(argc, argv));
+    }
+    if (offline) {
+        /* no window, no audio device, every picture goes through PoolNet */
+        audio_disable = 1;
+        subtitle_disable = 1;
+        autoexit = 1;
+        loop = 1;
+        framedrop = 0;
+        infer_deadline = 0;
+    }
     if (display_disable) {
         video_disable = 1;
     }
@@ -3878,6 +5882,10 @@ int main(int argc, char **argv)
     }
     if (display_disable)
         flags &= ~SDL_INIT_VIDEO;
+    if (offline || headless)
+        flags = (flags & ~SDL_INIT_VIDEO) | SDL_INIT_EVENTS;
+    if (placement_init(cpu_layout, rt_prio) < 0 || budget_init(thread_budget) < 0)
+        exit(1);
     if (SDL_Init (flags)) {
         av_log(NULL, AV_LOG_FATAL, "Could not initialize SDL - %s\n", SDL_GetError());
         av_log(NULL, AV_LOG_FATAL, "(Did you set the DISPLAY variable?)\n");
@@ -3890,7 +5898,7 @@ int main(int argc, char **argv)
     av_init_packet(&flush_pkt);
     flush_pkt.data = (uint8_t *)&flush_pkt;
 
-    if (!display_disable) {
+    if (!display_disable && !offline && !headless) {
         int flags = SDL_WINDOW_HIDDEN;
         if (alwaysontop)
 #if SDL_VERSION_ATLEAST(2,0,5)
@@ -3929,22 +5937,82 @@ int main(int argc, char **argv)
     }
 
     torch::Device device(device_type);
-    input_image_size = 256;
 
-    net = PoolNet();
-    std::cout << "loading weight ..." << std::endl;
-    torch::load(net, "../models/poolnet.pt");
-    std::cout << "weight loaded ..." << std::endl;
-    net->to(torch::kCUDA);
     torch::NoGradGuard no_grad;
-    net->eval();
+    if (infer_remote_path) {
+        /* a slot for every replica of every input and for the -vf filters */
+        if (infer_client_open(&infer_client, infer_remote_path, nb_inputs * FFMAX(1, infer_replicas) + 1,
+                              infer_width, infer_height) < 0) {
+            av_log(NULL, AV_LOG_FATAL, "Could not use the inference daemon at %s\n", infer_remote_path);
+            do_exit(NULL);
+        }
+        if (infer_batch)
+            av_log(NULL, AV_LOG_WARNING, "-infer_batch is ignored with -infer_remote, the daemon batches\n");
+    } else {
+        model = PoolNet();
+        std::cout << "loading weight ..." << std::endl;
+        torch::load(model, model_path);
+        std::cout << "weight loaded ..." << std::endl;
+        infer_device = device;
+        model->to(device);
+        model->eval();
+    }
+
+    if (sidecar_path && sidecar_hash_file(&model_fingerprint, model_path) < 0)
+        av_log(NULL, AV_LOG_WARNING, "Could not read %s for the sidecar fingerprint\n", model_path);
+
+    if (profile_json)
+        profile_net = 1;
+    if (profile_net) {
+        Profiler::instance().set_enabled(true);
+        if (profile_json && Profiler::instance().open_json(profile_json) < 0)
+            av_log(NULL, AV_LOG_ERROR, "Could not open %s for writing\n", profile_json);
+    }
+
+    /* by default, one forward pass takes a picture of every input, or of
+     * every client of the daemon */
+    if (infer_daemon_path || (!infer_client && (infer_batch > 1 || (!infer_batch && nb_inputs > 1)))) {
+        int cpus[MAX_CPUS];
+        int max_batch = infer_batch ? infer_batch :
+                        infer_daemon_path ? INFER_DAEMON_BATCH : nb_inputs * FFMAX(1, infer_replicas);
+        int nb_threads = budget_active() ? budget_get(BUDGET_INFER) : placement_get_cpus(PLACEMENT_INFER, cpus, MAX_CPUS);
+
+        batch_replica = new InferReplica();
+        batch_replica->index = -1;
+        batch_replica->net = PoolNet();
+        poolnet_share_weights(batch_replica->net, model);
+        batch_replica->net->eval();
+        placement_spawn(PLACEMENT_INFER);
+        if (infer_batcher_open(&batcher, max_batch, infer_batch_wait * 1000LL, nb_threads,
+                               batch_forward, batch_replica) < 0) {
+            av_log(NULL, AV_LOG_FATAL, "Could not start the batcher\n");
+            do_exit(NULL);
+        }
+        placement_restore();
+        av_log(NULL, AV_LOG_INFO, "PoolNet: up to %d pictures per forward pass, %d ms wait\n",
+               max_batch, infer_batch_wait);
+    }
 
-    is = stream_open(input_filename, file_iformat);
-    if (!is) {
-        av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
+    if (infer_daemon_path) {
+        if (infer_daemon_run(infer_daemon_path, batcher) < 0)
+            exit(1);
         do_exit(NULL);
     }
 
+    for (i = 0; i < nb_inputs; i++) {
+        is = stream_open(input_filenames[i], file_iformat);
+        if (!is) {
+            av_log(NULL, AV_LOG_FATAL, "Failed to initialize VideoState!\n");
+            do_exit(NULL);
+        }
+        open_streams[nb_open_streams++] = is;
+    }
+    is = open_streams[0];
+    /* after stream_open, the encoder thread keeps the CPUs of the process */
+    placement_apply(PLACEMENT_RENDER);
+
+    if (offline)
+        offline_loop(is);
     event_loop(is);
 
     /* never returns */
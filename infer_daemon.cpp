@@ -0,0 +1,345 @@
+/*
+ * Inference daemon: one model per host for the players on it
+ */
+
+#include "infer_daemon.h"
+#include "infer_ipc.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/time.h"
+}
+
+#define MAX_CLIENTS 64
+#define SEND_TIMEOUT 1              /* seconds a client may leave its replies unread */
+
+/* one connection, referenced by the poll loop until it hangs up and by
+ * each of its requests until the batcher answered it */
+typedef struct DaemonClient {
+    int fd;
+    uint8_t *shm;
+    size_t shm_size;
+    int nb_slots;
+    size_t slot_size, mask_offset;
+    int index;
+    int accepted;           /* the hello was read, the slots are mapped */
+
+    SDL_mutex *mutex;       /* sends and refs */
+    int refs;
+    int64_t nb_requests;
+} DaemonClient;
+
+typedef struct DaemonRequest {
+    DaemonClient *client;
+    InferIpcRequest req;
+    int64_t received;
+} DaemonRequest;
+
+static volatile sig_atomic_t daemon_quit;
+
+static void daemon_signal(int sig)
+{
+    daemon_quit = 1;
+}
+
+static void client_unref(DaemonClient *cl)
+{
+    int refs;
+
+    SDL_LockMutex(cl->mutex);
+    refs = --cl->refs;
+    SDL_UnlockMutex(cl->mutex);
+    if (refs)
+        return;
+    av_log(NULL, AV_LOG_INFO, "client %d: gone after %"PRId64" requests\n", cl->index, cl->nb_requests);
+    if (cl->shm)
+        munmap(cl->shm, cl->shm_size);
+    close(cl->fd);
+    SDL_DestroyMutex(cl->mutex);
+    av_free(cl);
+}
+
+static void client_send(DaemonClient *cl, const void *msg, size_t len)
+{
+    SDL_LockMutex(cl->mutex);
+    /* a client that hung up is dropped by the poll loop, one that does not
+     * read its replies within SEND_TIMEOUT is cut off so that it does not
+     * hold up the batcher */
+    if (send(cl->fd, msg, len, MSG_NOSIGNAL) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        shutdown(cl->fd, SHUT_RDWR);
+    SDL_UnlockMutex(cl->mutex);
+}
+
+static void reply(DaemonClient *cl, const InferIpcRequest *req, int status,
+                  int64_t received, int64_t started)
+{
+    InferIpcReply rep;
+    int64_t now = av_gettime_relative();
+
+    rep.id       = req->id;
+    rep.slot     = req->slot;
+    rep.status   = status;
+    rep.queue_us = started > received ? started - received : 0;
+    rep.total_us = now - received;
+    client_send(cl, &rep, sizeof(rep));
+}
+
+/* on the batcher thread: the mask goes into the slot it came from */
+static void request_done(void *opaque, int ret, const torch::Tensor &mask, int64_t started)
+{
+    DaemonRequest *dr = (DaemonRequest *)opaque;
+    DaemonClient *cl = dr->client;
+    uint8_t *slot = cl->shm + dr->req.slot * cl->slot_size;
+
+    if (ret >= 0) {
+        if ((size_t)mask.numel() > cl->slot_size - cl->mask_offset)
+            ret = AVERROR(ERANGE);
+        else
+            memcpy(slot + cl->mask_offset, mask.data_ptr<uint8_t>(), mask.numel());
+    }
+    reply(cl, &dr->req, ret, dr->received, started);
+    client_unref(cl);
+    delete dr;
+}
+
+static int recv_fd(int sock, void *msg, size_t len, int *fd)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov = { msg, len };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    *fd = -1;
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = control;
+    mh.msg_controllen = sizeof(control);
+    if ((n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) < 0)
+        return AVERROR(errno);
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    return n == (ssize_t)len && *fd >= 0 ? 0 : AVERROR_INVALIDDATA;
+}
+
+/* read the hello of a new connection and map its slots, once poll says it
+ * arrived */
+static int client_accept(DaemonClient *cl)
+{
+    InferIpcHello hello;
+    InferIpcWelcome welcome;
+    struct stat st;
+    int shm_fd, ret;
+
+    if ((ret = recv_fd(cl->fd, &hello, sizeof(hello), &shm_fd)) < 0)
+        goto end;
+    if (hello.magic != INFER_IPC_MAGIC || !hello.nb_slots || hello.nb_slots > INFER_IPC_MAX_SLOTS ||
+        hello.slot_size % sizeof(float) || hello.mask_offset % sizeof(float) ||
+        hello.mask_offset >= hello.slot_size || hello.slot_size > SIZE_MAX / hello.nb_slots) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+    cl->nb_slots    = hello.nb_slots;
+    cl->slot_size   = hello.slot_size;
+    cl->mask_offset = hello.mask_offset;
+    cl->shm_size    = cl->slot_size * cl->nb_slots;
+    if (fstat(shm_fd, &st) < 0 || (uint64_t)st.st_size < cl->shm_size) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+    cl->shm = (uint8_t *)mmap(NULL, cl->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (cl->shm == MAP_FAILED) {
+        cl->shm = NULL;
+        ret = AVERROR(errno);
+    }
+end:
+    if (shm_fd >= 0)
+        close(shm_fd);
+    welcome.magic  = INFER_IPC_MAGIC;
+    welcome.status = ret;
+    client_send(cl, &welcome, sizeof(welcome));
+    return ret;
+}
+
+/* hand the input of a slot to the batcher, without copying it */
+static int client_request(DaemonClient *cl, InferBatcher *batcher)
+{
+    InferIpcRequest req;
+    DaemonRequest *dr;
+    int64_t received = av_gettime_relative();
+    ssize_t n;
+
+    if ((n = recv(cl->fd, &req, sizeof(req), 0)) <= 0)
+        return n ? AVERROR(errno) : AVERROR_EOF;
+    if (n != sizeof(req))
+        return AVERROR_INVALIDDATA;
+    /* bounded first so that the product cannot wrap */
+    if (req.slot >= (uint32_t)cl->nb_slots ||
+        req.width < 2 || req.width > INFER_IPC_MAX_SIZE ||
+        req.height < 2 || req.height > INFER_IPC_MAX_SIZE ||
+        (uint64_t)3 * req.width * req.height * sizeof(float) > cl->mask_offset) {
+        reply(cl, &req, AVERROR(EINVAL), received, received);
+        return 0;
+    }
+
+    float *input = (float *)(cl->shm + req.slot * cl->slot_size);
+    auto options = torch::TensorOptions().dtype(torch::kFloat);
+    auto tensor = req.nhwc ? torch::from_blob(input, {1, req.height, req.width, 3}, options).permute({0, 3, 1, 2})
+                           : torch::from_blob(input, {1, 3, req.height, req.width}, options);
+
+    dr = new DaemonRequest();
+    dr->client   = cl;
+    dr->req      = req;
+    dr->received = received;
+    SDL_LockMutex(cl->mutex);
+    cl->refs++;
+    cl->nb_requests++;
+    SDL_UnlockMutex(cl->mutex);
+    return infer_batcher_submit(batcher, tensor, request_done, dr);
+}
+
+/* remove a socket left at path, refusing to touch anything else there */
+static int remove_socket(const char *path)
+{
+    struct stat st;
+
+    if (lstat(path, &st) < 0)
+        return errno == ENOENT ? 0 : AVERROR(errno);
+    if (!S_ISSOCK(st.st_mode))
+        return AVERROR(EEXIST);
+    return unlink(path) < 0 ? AVERROR(errno) : 0;
+}
+
+int infer_daemon_run(const char *path, InferBatcher *batcher)
+{
+    struct sockaddr_un addr = { 0 };
+    struct sigaction sa = { 0 };
+    struct pollfd fds[MAX_CLIENTS + 1];
+    DaemonClient *clients[MAX_CLIENTS];
+    int nb_clients = 0, nb_accepted = 0;
+    int listen_fd, ret, i;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        av_log(NULL, AV_LOG_FATAL, "Socket path %s is too long\n", path);
+        return AVERROR(EINVAL);
+    }
+    addr.sun_family = AF_UNIX;
+    av_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    if ((ret = remove_socket(path)) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Could not remove %s%s: %s\n", path,
+               ret == AVERROR(EEXIST) ? ", which is not a socket" : "", av_err2str(ret));
+        return ret;
+    }
+    if ((listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 16) < 0) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_FATAL, "Could not listen on %s: %s\n", path, av_err2str(ret));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        return ret;
+    }
+
+    /* leave the loop on a signal, without SA_RESTART poll returns EINTR */
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    av_log(NULL, AV_LOG_INFO, "Inference daemon listening on %s\n", path);
+
+    while (!daemon_quit) {
+        fds[0].fd     = listen_fd;
+        fds[0].events = nb_clients < MAX_CLIENTS ? POLLIN : 0;
+        for (i = 0; i < nb_clients; i++) {
+            fds[i + 1].fd     = clients[i]->fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(fds, nb_clients + 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = AVERROR(errno);
+            av_log(NULL, AV_LOG_ERROR, "poll(): %s\n", av_err2str(ret));
+            break;
+        }
+
+        /* hellos and requests first, the client array is compacted below */
+        for (i = nb_clients - 1; i >= 0; i--) {
+            DaemonClient *cl = clients[i];
+
+            if (!fds[i + 1].revents)
+                continue;
+            if (!(fds[i + 1].revents & POLLIN)) {
+                ret = AVERROR_EOF;
+            } else if (!cl->accepted) {
+                if ((ret = client_accept(cl)) < 0) {
+                    av_log(NULL, AV_LOG_WARNING, "client %d: bad hello: %s\n", cl->index, av_err2str(ret));
+                    clients[i] = clients[--nb_clients];
+                    client_unref(cl);
+                    continue;
+                }
+                av_log(NULL, AV_LOG_INFO, "client %d: %d slots of %zu KB\n",
+                       cl->index, cl->nb_slots, cl->slot_size >> 10);
+                infer_batcher_add_client(batcher);
+                cl->accepted = 1;
+                continue;
+            } else {
+                ret = client_request(cl, batcher);
+            }
+            if (ret < 0) {
+                if (ret != AVERROR_EOF)
+                    av_log(NULL, AV_LOG_WARNING, "client %d: %s, disconnecting\n", cl->index, av_err2str(ret));
+                shutdown(cl->fd, SHUT_RDWR);
+                if (cl->accepted)
+                    infer_batcher_remove_client(batcher);
+                clients[i] = clients[--nb_clients];
+                client_unref(cl);
+            }
+        }
+
+        /* the hello is read when it arrives, a client that connects and
+         * sends nothing does not hold up the others */
+        if (fds[0].revents & POLLIN) {
+            struct timeval timeout = { SEND_TIMEOUT, 0 };
+            DaemonClient *cl;
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+            if (fd < 0)
+                continue;
+            if (!(cl = (DaemonClient *)av_mallocz(sizeof(*cl))) || !(cl->mutex = SDL_CreateMutex())) {
+                av_free(cl);
+                close(fd);
+                continue;
+            }
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            cl->fd    = fd;
+            cl->refs  = 1;
+            cl->index = nb_accepted++;
+            clients[nb_clients++] = cl;
+        }
+    }
+
+    /* the batcher still answers what was submitted when it is closed, so
+     * the connections are left to the exit of the process */
+    close(listen_fd);
+    remove_socket(path);
+    return 0;
+}
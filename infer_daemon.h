@@ -0,0 +1,22 @@
+/*
+ * Inference daemon: one model per host for the players on it
+ *
+ * The daemon listens on a Unix domain socket, maps the shared memory of
+ * every client (see infer_ipc.h) and hands their inputs to a batcher, so
+ * pictures of different processes share the forward passes. Masks are
+ * written straight into the slot they came from.
+ */
+
+#ifndef INFER_DAEMON_H
+#define INFER_DAEMON_H
+
+#include "batcher.h"
+
+/**
+ * Serve clients on path until a signal ends the process.
+ *
+ * @return <0 if the socket could not be set up
+ */
+int infer_daemon_run(const char *path, InferBatcher *batcher);
+
+#endif /* INFER_DAEMON_H */
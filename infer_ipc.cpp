@@ -0,0 +1,301 @@
+/*
+ * Inference daemon protocol and client
+ */
+
+#include "infer_ipc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+}
+
+#define SLOT_ALIGN 64
+
+enum {
+    SLOT_FREE,
+    SLOT_ACQUIRED,
+    SLOT_SENT,
+    SLOT_DONE,
+};
+
+struct InferClient {
+    int fd;
+    uint8_t *shm;
+    size_t shm_size;
+    int nb_slots;
+    size_t slot_size, mask_offset;
+
+    SDL_Thread *reader;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    int state[INFER_IPC_MAX_SLOTS];
+    InferIpcReply reply[INFER_IPC_MAX_SLOTS];
+    uint64_t next_id;
+    int error;
+
+    int64_t nb_requests;
+    int64_t queue_time, total_time;     /* microseconds, as the daemon measured them */
+};
+
+size_t infer_ipc_mask_offset(int max_width, int max_height)
+{
+    return FFALIGN((size_t)3 * max_width * max_height * sizeof(float), SLOT_ALIGN);
+}
+
+size_t infer_ipc_slot_size(int max_width, int max_height)
+{
+    return infer_ipc_mask_offset(max_width, max_height) + FFALIGN((size_t)max_width * max_height, SLOT_ALIGN);
+}
+
+/* an unnamed shared memory file, mapped here and passed to the daemon */
+static int shm_create(size_t size)
+{
+    static int counter;
+    char name[64];
+    int fd;
+
+    snprintf(name, sizeof(name), "/myplay-infer-%d-%d", (int)getpid(), counter++);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return AVERROR(errno);
+    shm_unlink(name);
+    if (ftruncate(fd, size) < 0) {
+        int ret = AVERROR(errno);
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+static int send_fd(int sock, const void *msg, size_t len, int fd)
+{
+    struct msghdr mh = { 0 };
+    struct iovec iov = { (void *)msg, len };
+    char control[CMSG_SPACE(sizeof(int))] = { 0 };
+    struct cmsghdr *cmsg;
+
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = control;
+    mh.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) == (ssize_t)len ? 0 : AVERROR(errno);
+}
+
+static int reader_thread(void *arg)
+{
+    InferClient *c = (InferClient *)arg;
+    InferIpcReply reply;
+    ssize_t n;
+
+    for (;;) {
+        n = recv(c->fd, &reply, sizeof(reply), 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        SDL_LockMutex(c->mutex);
+        if (n != sizeof(reply)) {
+            if (!c->error)
+                av_log(NULL, n ? AV_LOG_ERROR : AV_LOG_WARNING, "Inference daemon closed the connection\n");
+            c->error = AVERROR(EPIPE);
+            SDL_CondBroadcast(c->cond);
+            SDL_UnlockMutex(c->mutex);
+            break;
+        }
+        if (reply.slot < (uint32_t)c->nb_slots && c->state[reply.slot] == SLOT_SENT) {
+            c->reply[reply.slot] = reply;
+            c->state[reply.slot] = SLOT_DONE;
+            SDL_CondBroadcast(c->cond);
+        }
+        SDL_UnlockMutex(c->mutex);
+    }
+    return 0;
+}
+
+int infer_client_open(InferClient **pc, const char *path, int nb_slots, int max_width, int max_height)
+{
+    InferClient *c;
+    InferIpcHello hello;
+    InferIpcWelcome welcome;
+    struct sockaddr_un addr = { 0 };
+    int shm_fd = -1, ret;
+
+    *pc = NULL;
+    if (!(c = (InferClient *)av_mallocz(sizeof(*c))))
+        return AVERROR(ENOMEM);
+    c->fd          = -1;
+    c->nb_slots    = av_clip(nb_slots, 1, INFER_IPC_MAX_SLOTS);
+    c->mask_offset = infer_ipc_mask_offset(max_width, max_height);
+    c->slot_size   = infer_ipc_slot_size(max_width, max_height);
+    c->shm_size    = c->slot_size * c->nb_slots;
+    c->mutex = SDL_CreateMutex();
+    c->cond  = SDL_CreateCond();
+    if (!c->mutex || !c->cond) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    if ((shm_fd = shm_create(c->shm_size)) < 0) {
+        ret = shm_fd;
+        av_log(NULL, AV_LOG_ERROR, "Could not create %zu bytes of shared memory\n", c->shm_size);
+        goto fail;
+    }
+    c->shm = (uint8_t *)mmap(NULL, c->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (c->shm == MAP_FAILED) {
+        c->shm = NULL;
+        ret = AVERROR(errno);
+        goto fail;
+    }
+
+    addr.sun_family = AF_UNIX;
+    av_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    if ((c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0 ||
+        connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Could not connect to the inference daemon at %s: %s\n", path, av_err2str(ret));
+        goto fail;
+    }
+    hello.magic       = INFER_IPC_MAGIC;
+    hello.nb_slots    = c->nb_slots;
+    hello.slot_size   = c->slot_size;
+    hello.mask_offset = c->mask_offset;
+    if ((ret = send_fd(c->fd, &hello, sizeof(hello), shm_fd)) < 0)
+        goto fail;
+    if (recv(c->fd, &welcome, sizeof(welcome), 0) != sizeof(welcome) || welcome.magic != INFER_IPC_MAGIC) {
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+    if ((ret = welcome.status) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Inference daemon refused the connection: %s\n", av_err2str(ret));
+        goto fail;
+    }
+    close(shm_fd);
+    shm_fd = -1;
+
+    if (!(c->reader = SDL_CreateThread(reader_thread, "infer_client", c))) {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    av_log(NULL, AV_LOG_INFO, "Connected to the inference daemon at %s, %d slots of %zu KB\n",
+           path, c->nb_slots, c->slot_size >> 10);
+    *pc = c;
+    return 0;
+fail:
+    if (shm_fd >= 0)
+        close(shm_fd);
+    infer_client_close(&c);
+    return ret;
+}
+
+void infer_client_close(InferClient **pc)
+{
+    InferClient *c = *pc;
+
+    if (!c)
+        return;
+    if (c->mutex) {
+        /* not an error worth a message in the reader */
+        SDL_LockMutex(c->mutex);
+        c->error = AVERROR_EXIT;
+        SDL_UnlockMutex(c->mutex);
+    }
+    if (c->fd >= 0)
+        shutdown(c->fd, SHUT_RDWR);
+    if (c->reader)
+        SDL_WaitThread(c->reader, NULL);
+    if (c->fd >= 0)
+        close(c->fd);
+    if (c->nb_requests)
+        av_log(NULL, AV_LOG_VERBOSE, "inference daemon: %"PRId64" requests, %.1f ms mean in the daemon, "
+               "%.1f ms mean batch wait\n", c->nb_requests, c->total_time / 1000.0 / c->nb_requests,
+               c->queue_time / 1000.0 / c->nb_requests);
+    if (c->shm)
+        munmap(c->shm, c->shm_size);
+    SDL_DestroyCond(c->cond);
+    SDL_DestroyMutex(c->mutex);
+    av_freep(pc);
+}
+
+int infer_client_acquire(InferClient *c, float **input, uint8_t **mask)
+{
+    int i;
+
+    SDL_LockMutex(c->mutex);
+    for (;;) {
+        if (c->error) {
+            SDL_UnlockMutex(c->mutex);
+            return c->error;
+        }
+        for (i = 0; i < c->nb_slots && c->state[i] != SLOT_FREE; i++)
+            ;
+        if (i < c->nb_slots)
+            break;
+        SDL_CondWait(c->cond, c->mutex);
+    }
+    c->state[i] = SLOT_ACQUIRED;
+    SDL_UnlockMutex(c->mutex);
+
+    *input = (float *)(c->shm + i * c->slot_size);
+    *mask  = c->shm + i * c->slot_size + c->mask_offset;
+    return i;
+}
+
+int infer_client_run(InferClient *c, int slot, int width, int height, int nhwc)
+{
+    InferIpcRequest req;
+    int ret;
+
+    if ((size_t)3 * width * height * sizeof(float) > c->mask_offset)
+        return AVERROR(EINVAL);
+
+    SDL_LockMutex(c->mutex);
+    req.id     = c->next_id++;
+    req.slot   = slot;
+    req.width  = width;
+    req.height = height;
+    req.nhwc   = nhwc;
+    c->state[slot] = SLOT_SENT;
+    if (!c->error && send(c->fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+        c->error = AVERROR(errno);
+    while (!c->error && c->state[slot] != SLOT_DONE)
+        SDL_CondWait(c->cond, c->mutex);
+    if (c->state[slot] == SLOT_DONE) {
+        ret = c->reply[slot].status;
+        c->nb_requests++;
+        c->queue_time += c->reply[slot].queue_us;
+        c->total_time += c->reply[slot].total_us;
+    } else {
+        ret = c->error;
+    }
+    c->state[slot] = SLOT_ACQUIRED;
+    SDL_UnlockMutex(c->mutex);
+    return ret;
+}
+
+void infer_client_release(InferClient *c, int slot)
+{
+    SDL_LockMutex(c->mutex);
+    c->state[slot] = SLOT_FREE;
+    SDL_CondBroadcast(c->cond);
+    SDL_UnlockMutex(c->mutex);
+}
@@ -0,0 +1,84 @@
+/*
+ * Inference daemon protocol and client
+ *
+ * A client maps a shared memory area of nb_slots slots and hands its file
+ * descriptor to the daemon over a Unix domain socket (SOCK_SEQPACKET).
+ * A slot holds the network input of one picture, float planes or packed
+ * RGB as the client preprocessed it, followed by the GRAY8 mask the daemon
+ * writes back. Only the slot index and the picture size go over the
+ * socket; the pictures and masks are never copied between the processes.
+ */
+
+#ifndef INFER_IPC_H
+#define INFER_IPC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INFER_IPC_MAGIC   0x50534c31    /* "PSL1" */
+#define INFER_IPC_MAX_SLOTS 256
+#define INFER_IPC_MAX_SIZE  16384       /* of the network input on either side */
+
+/* first message of a client, with the shared memory fd attached */
+typedef struct InferIpcHello {
+    uint32_t magic;
+    uint32_t nb_slots;
+    uint64_t slot_size;         /* bytes per slot */
+    uint64_t mask_offset;       /* start of the mask in a slot, the input starts at 0 */
+} InferIpcHello;
+
+/* the daemon's answer to the hello */
+typedef struct InferIpcWelcome {
+    uint32_t magic;
+    int32_t status;             /* 0, or a negative AVERROR */
+} InferIpcWelcome;
+
+typedef struct InferIpcRequest {
+    uint64_t id;
+    uint32_t slot;
+    uint32_t width, height;     /* network input size */
+    uint32_t nhwc;              /* packed RGB floats instead of planes */
+} InferIpcRequest;
+
+typedef struct InferIpcReply {
+    uint64_t id;
+    uint32_t slot;
+    int32_t status;             /* 0, or a negative AVERROR */
+    uint32_t queue_us;          /* from the request to the start of its batch */
+    uint32_t total_us;          /* from the request to the reply */
+} InferIpcReply;
+
+typedef struct InferClient InferClient;
+
+/**
+ * Connect to the daemon at path with nb_slots slots for inputs of at most
+ * max_width x max_height.
+ */
+int infer_client_open(InferClient **c, const char *path, int nb_slots, int max_width, int max_height);
+
+/**
+ * Disconnect and log the latency of the requests.
+ */
+void infer_client_close(InferClient **c);
+
+/**
+ * Wait for a free slot and return its input and mask buffers.
+ *
+ * @return the slot index, or <0 if the daemon went away
+ */
+int infer_client_acquire(InferClient *c, float **input, uint8_t **mask);
+
+/**
+ * Ask the daemon for the mask of the input in slot and wait for it.
+ *
+ * @return 0, or <0 on error
+ */
+int infer_client_run(InferClient *c, int slot, int width, int height, int nhwc);
+
+void infer_client_release(InferClient *c, int slot);
+
+/* slot layout shared by both sides */
+size_t infer_ipc_mask_offset(int max_width, int max_height);
+size_t infer_ipc_slot_size(int max_width, int max_height);
+
+#endif /* INFER_IPC_H */
@@ -0,0 +1,134 @@
+/*
+ * Bounded LRU cache of saliency masks keyed by stream index and pts
+ *
+ * The cache only holds references, the mask buffers are shared with the
+ * pictures they were attached to. It does no locking, the inference stage
+ * calls it with infer_mutex held.
+ */
+
+#include "mask_cache.h"
+
+#include <errno.h>
+#include <iterator>
+#include <list>
+#include <map>
+#include <utility>
+
+extern "C"
+{
+#include "libavutil/error.h"
+}
+
+typedef std::pair<int, int64_t> MaskCacheKey;
+
+typedef struct MaskCacheEntry {
+    MaskCacheKey key;
+    int level;
+    AVFrame *mask;
+    int64_t bytes;
+} MaskCacheEntry;
+
+struct MaskCache {
+    std::list<MaskCacheEntry> lru;      /* most recently used first */
+    std::map<MaskCacheKey, std::list<MaskCacheEntry>::iterator> index;
+    int64_t max_bytes;
+    int64_t bytes;
+    int64_t hits;
+    int64_t misses;
+};
+
+static void entry_erase(MaskCache *c, std::list<MaskCacheEntry>::iterator it)
+{
+    c->bytes -= it->bytes;
+    av_frame_free(&it->mask);
+    c->index.erase(it->key);
+    c->lru.erase(it);
+}
+
+MaskCache *mask_cache_alloc(int64_t max_bytes)
+{
+    MaskCache *c = new MaskCache();
+    c->max_bytes = max_bytes;
+    return c;
+}
+
+void mask_cache_clear(MaskCache *c)
+{
+    while (!c->lru.empty())
+        entry_erase(c, c->lru.begin());
+}
+
+void mask_cache_freep(MaskCache **c)
+{
+    if (!*c)
+        return;
+    mask_cache_clear(*c);
+    delete *c;
+    *c = NULL;
+}
+
+int mask_cache_get(MaskCache *c, int stream_index, int64_t pts, int max_level, AVFrame *mask)
+{
+    int ret;
+
+    if (pts == AV_NOPTS_VALUE)
+        return 0;
+    auto found = c->index.find(MaskCacheKey(stream_index, pts));
+    if (found == c->index.end() || found->second->level > max_level) {
+        c->misses++;
+        return 0;
+    }
+    c->lru.splice(c->lru.begin(), c->lru, found->second);
+    if ((ret = av_frame_ref(mask, found->second->mask)) < 0)
+        return ret;
+    c->hits++;
+    return 1;
+}
+
+int mask_cache_contains(const MaskCache *c, int stream_index, int64_t pts, int max_level)
+{
+    if (pts == AV_NOPTS_VALUE)
+        return 0;
+    auto found = c->index.find(MaskCacheKey(stream_index, pts));
+    return found != c->index.end() && found->second->level <= max_level;
+}
+
+int mask_cache_put(MaskCache *c, int stream_index, int64_t pts, int level, const AVFrame *mask)
+{
+    MaskCacheEntry entry;
+    int ret;
+
+    if (pts == AV_NOPTS_VALUE || !mask->buf[0] || c->max_bytes <= 0)
+        return 0;
+
+    MaskCacheKey key(stream_index, pts);
+    auto found = c->index.find(key);
+    if (found != c->index.end())
+        entry_erase(c, found->second);
+
+    entry.key   = key;
+    entry.level = level;
+    entry.bytes = (int64_t)mask->linesize[0] * mask->height;
+    if (entry.bytes > c->max_bytes)
+        return 0;
+    if (!(entry.mask = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    if ((ret = av_frame_ref(entry.mask, mask)) < 0) {
+        av_frame_free(&entry.mask);
+        return ret;
+    }
+
+    c->lru.push_front(entry);
+    c->index[key] = c->lru.begin();
+    c->bytes += entry.bytes;
+    while (c->bytes > c->max_bytes)
+        entry_erase(c, std::prev(c->lru.end()));
+    return 0;
+}
+
+void mask_cache_get_stats(const MaskCache *c, int64_t *hits, int64_t *misses, int64_t *bytes)
+{
+    *hits   = c->hits;
+    *misses = c->misses;
+    *bytes  = c->bytes;
+}
@@ -0,0 +1,52 @@
+/*
+ * Bounded LRU cache of saliency masks keyed by stream index and pts
+ */
+
+#ifndef MASK_CACHE_H
+#define MASK_CACHE_H
+
+#include <stdint.h>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+}
+
+typedef struct MaskCache MaskCache;
+
+/**
+ * Allocate a cache holding at most max_bytes of mask data.
+ */
+MaskCache *mask_cache_alloc(int64_t max_bytes);
+
+void mask_cache_freep(MaskCache **c);
+
+/**
+ * Drop all entries, e.g. when the pictures of a pts change with the filter
+ * chain. Hit and miss counts are kept.
+ */
+void mask_cache_clear(MaskCache *c);
+
+/**
+ * Look up the mask of a picture. Entries computed at a level above
+ * max_level (a lower quality) do not count as a hit.
+ *
+ * @return 1 and a new reference in mask on a hit, 0 on a miss, <0 on error
+ */
+int mask_cache_get(MaskCache *c, int stream_index, int64_t pts, int max_level, AVFrame *mask);
+
+/**
+ * Check for the mask of a picture like mask_cache_get, without taking a
+ * reference or counting a hit or miss.
+ */
+int mask_cache_contains(const MaskCache *c, int stream_index, int64_t pts, int max_level);
+
+/**
+ * Store a reference to mask, replacing an existing entry of the same key,
+ * and evict the least recently used entries above the memory cap.
+ */
+int mask_cache_put(MaskCache *c, int stream_index, int64_t pts, int level, const AVFrame *mask);
+
+void mask_cache_get_stats(const MaskCache *c, int64_t *hits, int64_t *misses, int64_t *bytes);
+
+#endif /* MASK_CACHE_H */
@@ -1,4 +1,5 @@
 #include "deeplab_resnet.h"
+#include "profiler.h"
 
 #include <iostream>
 
@@ -47,24 +48,34 @@ BottleNeckImpl::BottleNeckImpl(int64_t inplanes_, int64_t planes_, int64_t strid
 }
 
 torch::Tensor BottleNeckImpl::forward(torch::Tensor x) {
+    ProfileScope prof("bottleneck", ProfileScope::kAutoIndex);
     torch::Tensor residual = x.clone();
 
     x = conv1->forward(x);
+    prof.conv(conv1, x);
     x = bn1->forward(x);
     x = torch::relu(x);
+    prof.elementwise(x, 2);
 
     x = conv2->forward(x);
+    prof.conv(conv2, x);
     x = bn2->forward(x);
     x = torch::relu(x);
+    prof.elementwise(x, 2);
 
     x = conv3->forward(x);
+    prof.conv(conv3, x);
     x = bn3->forward(x);
+    prof.elementwise(x);
 
     if (!downsample->is_empty()){
+        torch::Tensor identity = residual;
         residual = downsample->forward(residual);
+        prof.sequential(downsample, identity, residual);
     }
     x += residual;
     x = torch::relu(x);
+    prof.elementwise(x, 3);
 
     return x;
 }
@@ -103,22 +114,40 @@ ResNetImpl::ResNetImpl(std::vector<int> layers)
 }
 
 std::vector<torch::Tensor> ResNetImpl::forward(torch::Tensor x) {
+    ProfileScope prof("resnet");
     std::vector<torch::Tensor> tmp_x;
-    x = conv1->forward(x);
-    x = bn1->forward(x);
-    x = torch::relu(x);
-    tmp_x.push_back(x);
-    x = torch::max_pool2d(/*tensor=*/x, /*kernel_size=*/3, /*stride=*/2, 
-                          /*padding=*/1, /*dilation=*/1, /*ceil_mode=*/true);
-
-    x = layer1->forward(x);
-    tmp_x.push_back(x);
-    x = layer2->forward(x);
-    tmp_x.push_back(x);
-    x = layer3->forward(x);
-    tmp_x.push_back(x);
-    x = layer4->forward(x);
-    tmp_x.push_back(x);
+    {
+        ProfileScope prof_stem("stem");
+        x = conv1->forward(x);
+        prof_stem.conv(conv1, x);
+        x = bn1->forward(x);
+        x = torch::relu(x);
+        prof_stem.elementwise(x, 2);
+        tmp_x.push_back(x);
+        x = torch::max_pool2d(/*tensor=*/x, /*kernel_size=*/3, /*stride=*/2, 
+                              /*padding=*/1, /*dilation=*/1, /*ceil_mode=*/true);
+        prof_stem.elementwise(x, 4);
+    }
+    {
+        ProfileScope prof_layer("layer1");
+        x = layer1->forward(x);
+        tmp_x.push_back(x);
+    }
+    {
+        ProfileScope prof_layer("layer2");
+        x = layer2->forward(x);
+        tmp_x.push_back(x);
+    }
+    {
+        ProfileScope prof_layer("layer3");
+        x = layer3->forward(x);
+        tmp_x.push_back(x);
+    }
+    {
+        ProfileScope prof_layer("layer4");
+        x = layer4->forward(x);
+        tmp_x.push_back(x);
+    }
 
     return tmp_x;
 }
@@ -186,34 +215,55 @@ ResNet_locateImpl::ResNet_locateImpl(std::vector<int> layers)
 
 std::pair<std::vector<torch::Tensor>, std::vector<torch::Tensor>> 
 ResNet_locateImpl::forward(torch::Tensor x) {
+    ProfileScope prof("base");
     std::vector<torch::Tensor> tmp_x = resnet->forward(x);
     /* y.sizes() : { 1, 512, 24, 32 } */
-    torch::Tensor y = ppms_pre->forward(tmp_x.back());
+    torch::Tensor y;
+    {
+        ProfileScope prof_pre("ppms_pre");
+        y = ppms_pre->forward(tmp_x.back());
+        prof_pre.conv(ppms_pre, y);
+    }
 
     std::vector<torch::Tensor> xls{ y };
     for (int i = 0; i < ppms->size(); i++) {
+        ProfileScope prof_ppm("ppms", i);
+        torch::nn::Sequential ppm = ppms[i]->as<torch::nn::Sequential>();
+        torch::Tensor pooled = ppm->forward(y);
+        prof_ppm.sequential(ppm, y, pooled);
         xls.push_back(
             torch::nn::functional::interpolate(
-                /*input=*/  ppms[i]->as<torch::nn::Sequential>()->forward(y), 
+                /*input=*/  pooled, 
                 /*options=*/torch::nn::functional::InterpolateFuncOptions()
                                 .size(std::vector<int64_t>({y.size(2), y.size(3)}))
                                 .mode(torch::kBilinear)
                                 .align_corners(true)));
+        prof_ppm.elementwise(xls.back());
     }
     /* z.sizes() : { 1, 2048, 24, 32 } */
-    torch::Tensor z = ppm_cat->forward(torch::cat(/*TensorList=*/xls, /*dim=*/1));
+    torch::Tensor z;
+    {
+        ProfileScope prof_cat("ppm_cat");
+        torch::Tensor cat = torch::cat(/*TensorList=*/xls, /*dim=*/1);
+        prof_cat.elementwise(cat);
+        z = ppm_cat->forward(cat);
+        prof_cat.sequential(ppm_cat, cat, z);
+    }
 
     std::vector<torch::Tensor> infos_out;
     for (int i = 0; i < infos->size(); i++) {
+        ProfileScope prof_info("infos", i);
         c10::IntArrayRef size = tmp_x[infos->size() - 1 - i].sizes();
-        infos_out.push_back(
-            infos[i]->as<torch::nn::Sequential>()->forward(
-                torch::nn::functional::interpolate(
-                    /*input=*/  z, 
-                    /*options=*/torch::nn::functional::InterpolateFuncOptions()
-                                    .size(std::vector<int64_t>({size[2], size[3]}))
-                                    .mode(torch::kBilinear)
-                                    .align_corners(true))));
+        torch::nn::Sequential info = infos[i]->as<torch::nn::Sequential>();
+        torch::Tensor up = torch::nn::functional::interpolate(
+            /*input=*/  z, 
+            /*options=*/torch::nn::functional::InterpolateFuncOptions()
+                            .size(std::vector<int64_t>({size[2], size[3]}))
+                            .mode(torch::kBilinear)
+                            .align_corners(true));
+        prof_info.elementwise(up);
+        infos_out.push_back(info->forward(up));
+        prof_info.sequential(info, up, infos_out.back());
     }
     return std::make_pair(tmp_x, infos_out);
 }
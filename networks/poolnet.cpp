@@ -1,4 +1,5 @@
 #include "poolnet.h"
+#include "profiler.h"
 
 #include <iostream>
 
@@ -9,9 +10,13 @@ ConvertLayerImpl::ConvertLayerImpl()
 }
 
 std::vector<torch::Tensor> ConvertLayerImpl::forward(std::vector<torch::Tensor> x) {
+    ProfileScope prof("convert");
     std::vector<torch::Tensor> resl;
     for(int i = 0; i < x.size(); i++) {
-        resl.push_back(convert0[i]->as<torch::nn::Sequential>()->forward(x[i]));
+        ProfileScope prof_conv("conv", i);
+        torch::nn::Sequential conv = convert0[i]->as<torch::nn::Sequential>();
+        resl.push_back(conv->forward(x[i]));
+        prof_conv.sequential(conv, x[i], resl.back());
     }
     return resl;
 }
@@ -59,11 +64,16 @@ DeepPoolLayerImpl::DeepPoolLayerImpl(int64_t inplanes_, int64_t planes_,
 torch::Tensor DeepPoolLayerImpl::forward(torch::Tensor x, 
                                          torch::Tensor x2, 
                                          torch::Tensor x3) {
+    ProfileScope prof("deep_pool", ProfileScope::kAutoIndex);
     c10::IntArrayRef x_size = x.sizes();
     torch::Tensor resl = x;
     for(int i = 0; i < 3; i++) {
-        torch::Tensor y = convs[i]->as<torch::nn::Conv2d>()->forward(
-            pools[i]->as<torch::nn::AvgPool2d>()->forward(x));
+        ProfileScope prof_branch("branch", i);
+        torch::Tensor pooled = pools[i]->as<torch::nn::AvgPool2d>()->forward(x);
+        prof_branch.elementwise(pooled);
+        torch::nn::Conv2d conv = convs[i]->as<torch::nn::Conv2d>();
+        torch::Tensor y = conv->forward(pooled);
+        prof_branch.conv(conv, y);
         resl = torch::add(
             resl, 
             torch::nn::functional::interpolate(
@@ -72,19 +82,30 @@ torch::Tensor DeepPoolLayerImpl::forward(torch::Tensor x,
                                 .size(std::vector<int64_t>({x_size[2], x_size[3]}))
                                 .mode(torch::kBilinear)
                                 .align_corners(true)));
+        prof_branch.elementwise(resl, 2);
     }
-    resl = torch::relu(resl);
-    if(need_x2) {
-        resl = torch::nn::functional::interpolate(
-            /*input=*/  resl, 
-            /*options=*/torch::nn::functional::InterpolateFuncOptions()
-                            .size(std::vector<int64_t>({x2.size(2), x2.size(3)}))
-                            .mode(torch::kBilinear)
-                            .align_corners(true));
+    {
+        ProfileScope prof_sum("conv_sum");
+        resl = torch::relu(resl);
+        prof_sum.elementwise(resl);
+        if(need_x2) {
+            resl = torch::nn::functional::interpolate(
+                /*input=*/  resl, 
+                /*options=*/torch::nn::functional::InterpolateFuncOptions()
+                                .size(std::vector<int64_t>({x2.size(2), x2.size(3)}))
+                                .mode(torch::kBilinear)
+                                .align_corners(true));
+            prof_sum.elementwise(resl);
+        }
+        resl = conv_sum->forward(resl);
+        prof_sum.conv(conv_sum, resl);
     }
-    resl = conv_sum->forward(resl);
     if(need_fuse) {
-        resl = conv_sum_c->forward(torch::add(torch::add(resl, x2), x3));
+        ProfileScope prof_fuse("fuse");
+        torch::Tensor sum = torch::add(torch::add(resl, x2), x3);
+        prof_fuse.elementwise(sum, 3);
+        resl = conv_sum_c->forward(sum);
+        prof_fuse.conv(conv_sum_c, resl);
     }
     return resl;
 }
@@ -122,7 +143,9 @@ ScoreLayerImpl::ScoreLayerImpl(int64_t inplanes)
 }
 
 torch::Tensor ScoreLayerImpl::forward(torch::Tensor x, c10::IntArrayRef x_size) {
+    ProfileScope prof("score");
     x = score->forward(x);
+    prof.conv(score, x);
     if(!x_size.empty()) {
         x = torch::nn::functional::interpolate(
             /*input=*/  x, 
@@ -130,6 +153,7 @@ torch::Tensor ScoreLayerImpl::forward(torch::Tensor x, c10::IntArrayRef x_size)
                             .size(std::vector<int64_t>({x_size[2], x_size[3]}))
                             .mode(torch::kBilinear)
                             .align_corners(true));
+        prof.elementwise(x);
     }
     return x;
 }
@@ -146,25 +170,49 @@ PoolNetImpl::PoolNetImpl()
     register_module("convert", convert);
 }
 
-torch::Tensor PoolNetImpl::forward(torch::Tensor x) {
+torch::Tensor PoolNetImpl::forward(torch::Tensor x, FeatureTrace *trace) {
+    ProfileScope prof("poolnet");
     c10::IntArrayRef x_size = x.sizes();
     std::pair<std::vector<torch::Tensor>, std::vector<torch::Tensor>> 
         pair_data = base->forward(x);
     std::vector<torch::Tensor> tmp_x = pair_data.first;
     std::vector<torch::Tensor> infos = pair_data.second;
     std::vector<torch::Tensor> conv2merge = convert->forward(tmp_x);
+    if(trace) {
+        for(int i = 0; i < tmp_x.size(); i++) {
+            trace->emplace_back("base/resnet[" + std::to_string(i) + "]", tmp_x[i]);
+        }
+        for(int i = 0; i < infos.size(); i++) {
+            trace->emplace_back("base/infos[" + std::to_string(i) + "]", infos[i]);
+        }
+        for(int i = 0; i < conv2merge.size(); i++) {
+            trace->emplace_back("convert[" + std::to_string(i) + "]", conv2merge[i]);
+        }
+    }
     std::reverse(conv2merge.begin(), conv2merge.end());
 
     torch::Tensor merge = deep_pool[0]->as<DeepPoolLayer>()->forward(conv2merge[0], 
                                                                      conv2merge[1], 
                                                                      infos[0]);
+    if(trace) {
+        trace->emplace_back("deep_pool[0]", merge);
+    }
     for(int i = 1; i < 4; i++) {
         merge = deep_pool[i]->as<DeepPoolLayer>()->forward(merge, 
                                                            conv2merge[i + 1], 
                                                            infos[i]);
+        if(trace) {
+            trace->emplace_back("deep_pool[" + std::to_string(i) + "]", merge);
+        }
     }
     merge = deep_pool[4]->as<DeepPoolLayer>()->forward(merge);
+    if(trace) {
+        trace->emplace_back("deep_pool[4]", merge);
+    }
     merge = score->forward(merge, x_size);
+    if(trace) {
+        trace->emplace_back("score", merge);
+    }
     return merge;
 }
 
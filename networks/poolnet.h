@@ -44,11 +44,14 @@ private:
 };
 TORCH_MODULE(ScoreLayer);
 
+/* Named intermediate feature maps, in the order they are produced */
+typedef std::vector<std::pair<std::string, torch::Tensor>> FeatureTrace;
+
 /* PoolNet */
 class PoolNetImpl : public torch::nn::Module {
 public:
     PoolNetImpl();
-    torch::Tensor forward(torch::Tensor x);
+    torch::Tensor forward(torch::Tensor x, FeatureTrace *trace = nullptr);
     torch::nn::ModuleList _make_deeppool_layers();
 private:
     ResNet_locate base;
@@ -0,0 +1,178 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+/* Scope stack of the forward pass running on this thread */
+struct ScopeFrame {
+    ProfileScope *scope;
+    std::string path;
+    std::map<std::string, int> children;
+};
+
+static thread_local std::vector<ScopeFrame> scope_stack;
+static thread_local std::vector<ProfileRecord> pass_records;
+
+static int64_t tensor_bytes(const torch::Tensor& t) {
+    return t.defined() ? t.numel() * (int64_t)t.element_size() : 0;
+}
+
+/* Profiler */
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+int Profiler::open_json(const char *path) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (json)
+        fclose(json);
+    json = fopen(path, "w");
+    return json ? 0 : -1;
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> guard(lock);
+    totals.clear();
+    nb_passes = 0;
+}
+
+void Profiler::commit(const std::vector<ProfileRecord>& pass) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (const auto& r : pass) {
+        ModuleStats& s = totals[r.path];
+        s.calls    += r.stats.calls;
+        s.total_ms += r.stats.total_ms;
+        s.flops    += r.stats.flops;
+        s.bytes    += r.stats.bytes;
+        s.alloc    += r.stats.alloc;
+    }
+    if (json) {
+        fprintf(json, "{\"pass\":%" PRId64 ",\"modules\":[", nb_passes);
+        for (size_t i = 0; i < pass.size(); i++) {
+            const ProfileRecord& r = pass[i];
+            fprintf(json, "%s{\"name\":\"%s\",\"depth\":%d,\"ms\":%.3f,"
+                          "\"flops\":%" PRId64 ",\"bytes\":%" PRId64 ",\"alloc\":%" PRId64 "}",
+                    i ? "," : "", r.path.c_str(), r.depth, r.stats.total_ms,
+                    r.stats.flops, r.stats.bytes, r.stats.alloc);
+        }
+        fprintf(json, "]}\n");
+        fflush(json);
+    }
+    nb_passes++;
+}
+
+void Profiler::print_summary(FILE *out) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (nb_passes) {
+        std::vector<std::pair<std::string, ModuleStats>> rows(totals.begin(), totals.end());
+        std::sort(rows.begin(), rows.end(),
+                  [](const std::pair<std::string, ModuleStats>& a,
+                     const std::pair<std::string, ModuleStats>& b) {
+                      return a.second.total_ms > b.second.total_ms;
+                  });
+        /* top level scopes have no '/' in their path */
+        double root_ms = 0.0;
+        for (const auto& r : rows)
+            if (r.first.find('/') == std::string::npos)
+                root_ms += r.second.total_ms;
+
+        fprintf(out, "\nPoolNet profile over %" PRId64 " forward passes, %.2f ms per pass\n",
+                nb_passes, root_ms / nb_passes);
+        fprintf(out, "%-48s %6s %9s %7s %9s %8s %10s %10s\n",
+                "module", "calls", "ms/pass", "%", "GFLOP", "GFLOP/s", "MB moved", "MB alloc");
+        for (const auto& r : rows) {
+            const ModuleStats& s = r.second;
+            fprintf(out, "%-48s %6" PRId64 " %9.3f %6.1f%% %9.3f %8.1f %10.2f %10.2f\n",
+                    r.first.c_str(), s.calls,
+                    s.total_ms / nb_passes,
+                    root_ms > 0 ? 100.0 * s.total_ms / root_ms : 0.0,
+                    s.flops / 1e9 / nb_passes,
+                    s.total_ms > 0 ? s.flops / 1e6 / s.total_ms : 0.0,
+                    s.bytes / 1048576.0 / nb_passes,
+                    s.alloc / 1048576.0 / nb_passes);
+        }
+    }
+    if (json) {
+        fclose(json);
+        json = nullptr;
+    }
+}
+
+/* ProfileScope */
+ProfileScope::ProfileScope(const char *name, int index) {
+    if (!Profiler::instance().is_enabled())
+        return;
+    std::string leaf(name);
+    if (index == kAutoIndex)
+        index = scope_stack.empty() ? 0 : scope_stack.back().children[leaf]++;
+    if (index >= 0)
+        leaf += "[" + std::to_string(index) + "]";
+
+    depth = (int)scope_stack.size();
+    slot = pass_records.size();
+    pass_records.push_back({ scope_stack.empty() ? leaf : scope_stack.back().path + "/" + leaf,
+                             depth, ModuleStats() });
+    scope_stack.push_back({ this, pass_records.back().path, {} });
+    start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+    if (depth < 0)
+        return;
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    stats.calls = 1;
+    stats.total_ms = elapsed.count();
+    pass_records[slot].stats = stats;
+
+    scope_stack.pop_back();
+    if (!scope_stack.empty()) {
+        ModuleStats& parent = scope_stack.back().scope->stats;
+        parent.flops += stats.flops;
+        parent.bytes += stats.bytes;
+        parent.alloc += stats.alloc;
+    } else {
+        Profiler::instance().commit(pass_records);
+        pass_records.clear();
+    }
+}
+
+void ProfileScope::conv(const torch::nn::Conv2d& conv, const torch::Tensor& y) {
+    if (depth < 0)
+        return;
+    const torch::Tensor& w = conv->weight;
+    /* weight is { out, in / groups, kh, kw } */
+    int64_t macs_per_out = w.numel() / w.size(0);
+    int64_t in_channels = conv->options.in_channels();
+    int64_t in_numel = y.size(0) * in_channels
+                     * y.size(2) * (*conv->options.stride())[0]
+                     * y.size(3) * (*conv->options.stride())[1];
+
+    stats.flops += 2 * y.numel() * macs_per_out;
+    stats.bytes += in_numel * (int64_t)y.element_size() + tensor_bytes(y) + tensor_bytes(w);
+    stats.alloc += tensor_bytes(y);
+}
+
+void ProfileScope::sequential(const torch::nn::Sequential& seq,
+                              const torch::Tensor& x, const torch::Tensor& y) {
+    if (depth < 0)
+        return;
+    int64_t out_pixels = y.size(0) * y.size(2) * y.size(3);
+    for (const auto& m : seq->children()) {
+        if (auto* c = m->as<torch::nn::Conv2d>())
+            stats.flops += 2 * out_pixels * c->weight.numel();
+    }
+    for (const auto& p : seq->parameters())
+        stats.bytes += tensor_bytes(p);
+    for (const auto& b : seq->buffers())
+        stats.bytes += tensor_bytes(b);
+    stats.bytes += tensor_bytes(x) + tensor_bytes(y);
+    stats.alloc += tensor_bytes(y);
+}
+
+void ProfileScope::elementwise(const torch::Tensor& y, int nb_inputs) {
+    if (depth < 0)
+        return;
+    stats.bytes += (nb_inputs + 1) * tensor_bytes(y);
+    stats.alloc += tensor_bytes(y);
+}
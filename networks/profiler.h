@@ -0,0 +1,88 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <torch/torch.h>
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Statistics of one module path, e.g. "poolnet/base/resnet/layer3" */
+struct ModuleStats {
+    int64_t calls = 0;
+    double total_ms = 0.0;
+    int64_t flops = 0;    // a multiply-add counts as 2 flops
+    int64_t bytes = 0;    // activations read + written, weights read
+    int64_t alloc = 0;    // bytes of activations produced
+};
+
+struct ProfileRecord {
+    std::string path;
+    int depth;
+    ModuleStats stats;
+};
+
+/* Profiler
+ *
+ * Collects wall time, FLOPs, bytes moved and allocated activation memory for
+ * every ProfileScope opened inside a forward pass. Scopes nest and a scope's
+ * counters include those of its children. When the outermost scope closes the
+ * pass is added to the totals and optionally written out as one JSON line.
+ *
+ * Wall times are taken on the host. On CUDA they only cover kernel launches
+ * unless CUDA_LAUNCH_BLOCKING=1 is set. */
+class Profiler {
+public:
+    static Profiler& instance();
+    void set_enabled(bool on) { enabled = on; }
+    bool is_enabled() const { return enabled; }
+    /* Write one JSON line per forward pass to path. */
+    int open_json(const char *path);
+    /* Print the totals sorted by wall time and close the JSON output. */
+    void print_summary(FILE *out);
+    void reset();
+private:
+    friend class ProfileScope;
+    Profiler() = default;
+    void commit(const std::vector<ProfileRecord>& pass);
+
+    bool enabled = false;
+    std::mutex lock;
+    std::map<std::string, ModuleStats> totals;
+    int64_t nb_passes = 0;
+    FILE *json = nullptr;
+};
+
+/* ProfileScope
+ *
+ * RAII marker around one submodule call. It does nothing while the profiler
+ * is disabled, so it can stay in the forward code. */
+class ProfileScope {
+public:
+    /* Append "[n]" to the name, n counting same-named siblings. */
+    static const int kAutoIndex = -2;
+
+    explicit ProfileScope(const char *name, int index = -1);
+    ~ProfileScope();
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    /* Account a conv that produced y. Its input is sized from y and the stride,
+     * which is exact for the "same" padded convs of PoolNet. */
+    void conv(const torch::nn::Conv2d& conv, const torch::Tensor& y);
+    /* Account a Sequential whose convs all produce the spatial size of y. */
+    void sequential(const torch::nn::Sequential& seq,
+                    const torch::Tensor& x, const torch::Tensor& y);
+    /* Account a pointwise op, resize or pooling with nb_inputs operands. */
+    void elementwise(const torch::Tensor& y, int nb_inputs = 1);
+private:
+    int depth = -1;
+    size_t slot = 0;
+    ModuleStats stats;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // PROFILER_H_
@@ -0,0 +1,352 @@
+/*
+ * Thread placement: which CPUs each thread of the player runs on
+ *
+ * The NUMA node of a CPU comes from /sys/devices/system/node, a machine
+ * without it is one node. Affinity and SCHED_FIFO are Linux only, other
+ * systems get the SDL thread priority and no pinning.
+ */
+
+#include "placement.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/mem.h"
+}
+
+#define PLACEMENT_MAX_CPUS 1024
+
+static const char * const role_names[PLACEMENT_NB] = {
+    "read", "vdec", "adec", "audio", "render", "infer",
+};
+
+static struct {
+    std::vector<int> cpus[PLACEMENT_NB];    /* empty: all allowed CPUs */
+    std::vector<int> allowed;               /* of the process, before any pinning */
+    int active;
+    int rt_prio;
+    int rt_failed;                          /* warned once already */
+} layout;
+
+int placement_allowed_cpus(int *cpus, int max)
+{
+    int i, n = 0;
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (!sched_getaffinity(0, sizeof(set), &set)) {
+        for (i = 0; i < CPU_SETSIZE && n < max; i++)
+            if (CPU_ISSET(i, &set))
+                cpus[n++] = i;
+        if (n)
+            return n;
+    }
+#endif
+    n = FFMIN(FFMAX(SDL_GetCPUCount(), 1), max);
+    for (i = 0; i < n; i++)
+        cpus[i] = i;
+    return n;
+}
+
+/* "0-3,8,10-11" */
+static int parse_cpu_list(const char *s, std::vector<int> &cpus)
+{
+    char *end;
+
+    cpus.clear();
+    while (*s && *s != '\n') {
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s || a < 0)
+            return AVERROR(EINVAL);
+        s = end;
+        if (*s == '-') {
+            b = strtol(s + 1, &end, 10);
+            if (end == s + 1 || b < a)
+                return AVERROR(EINVAL);
+            s = end;
+        }
+        for (; a <= b && a < PLACEMENT_MAX_CPUS; a++)
+            cpus.push_back((int)a);
+        if (*s == ',')
+            s++;
+        else if (*s && *s != '\n')
+            return AVERROR(EINVAL);
+    }
+    return cpus.empty() ? AVERROR(EINVAL) : 0;
+}
+
+/* node of each CPU, 0 when the kernel does not tell */
+static void cpu_nodes(std::vector<int> &node)
+{
+    node.assign(PLACEMENT_MAX_CPUS, 0);
+#ifdef __linux__
+    DIR *dir = opendir("/sys/devices/system/node");
+    struct dirent *e;
+
+    if (!dir)
+        return;
+    while ((e = readdir(dir))) {
+        char path[512], line[4096];
+        std::vector<int> cpus;
+        FILE *f;
+        int n;
+
+        if (sscanf(e->d_name, "node%d", &n) != 1)
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", e->d_name);
+        if (!(f = fopen(path, "r")))
+            continue;
+        if (fgets(line, sizeof(line), f) && parse_cpu_list(line, cpus) >= 0)
+            for (int cpu : cpus)
+                node[cpu] = n;
+        fclose(f);
+    }
+    closedir(dir);
+#endif
+}
+
+static int layout_auto(const int *allowed, int nb_allowed)
+{
+    std::vector<int> node, rest;
+    int io, nb_vdec, i;
+
+    if (nb_allowed < 4) {
+        av_log(NULL, AV_LOG_WARNING, "%d CPUs are too few for an automatic thread layout\n", nb_allowed);
+        return 0;
+    }
+    cpu_nodes(node);
+    io = allowed[0];
+    layout.cpus[PLACEMENT_AUDIO]  = { io };
+    layout.cpus[PLACEMENT_RENDER] = { io };
+
+    /* the decoders hand their pictures to the render thread, keep them
+     * on its node, then inference node by node */
+    rest.assign(allowed + 1, allowed + nb_allowed);
+    std::stable_sort(rest.begin(), rest.end(), [&](int a, int b) {
+        int na = node[a] != node[io], nb = node[b] != node[io];
+        return na != nb ? na < nb : node[a] < node[b];
+    });
+    nb_vdec = FFMAX(1, nb_allowed / 4);
+    layout.cpus[PLACEMENT_VDEC].assign(rest.begin(), rest.begin() + nb_vdec);
+    /* audio decoding and demuxing would starve behind the two real-time
+     * threads on io, they share the decoder CPUs instead */
+    layout.cpus[PLACEMENT_READ] = layout.cpus[PLACEMENT_VDEC];
+    layout.cpus[PLACEMENT_ADEC] = layout.cpus[PLACEMENT_VDEC];
+    layout.cpus[PLACEMENT_INFER].assign(rest.begin() + nb_vdec, rest.end());
+    for (i = 0; i < PLACEMENT_NB; i++)
+        if (!layout.cpus[i].empty())
+            layout.active = 1;
+    return 0;
+}
+
+static int layout_parse(const char *spec, const int *allowed, int nb_allowed)
+{
+    char *dup = av_strdup(spec), *ptr, *tok;
+    int ret = 0, i;
+
+    if (!dup)
+        return AVERROR(ENOMEM);
+    for (tok = av_strtok(dup, ":", &ptr); tok; tok = av_strtok(NULL, ":", &ptr)) {
+        char *eq = strchr(tok, '=');
+        std::vector<int> cpus;
+
+        for (i = 0; i < PLACEMENT_NB; i++)
+            if (eq && !strncmp(tok, role_names[i], eq - tok) && !role_names[i][eq - tok])
+                break;
+        if (i == PLACEMENT_NB || parse_cpu_list(eq + 1, cpus) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Invalid thread placement '%s'\n", tok);
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        for (int cpu : cpus) {
+            if (std::find(allowed, allowed + nb_allowed, cpu) == allowed + nb_allowed) {
+                av_log(NULL, AV_LOG_ERROR, "CPU %d of %s is not available\n", cpu, role_names[i]);
+                ret = AVERROR(EINVAL);
+                break;
+            }
+        }
+        if (ret < 0)
+            break;
+        layout.cpus[i] = cpus;
+        layout.active = 1;
+    }
+    av_free(dup);
+    return ret;
+}
+
+int placement_init(const char *spec, int rt_prio)
+{
+    int allowed[PLACEMENT_MAX_CPUS];
+    int nb_allowed = placement_allowed_cpus(allowed, PLACEMENT_MAX_CPUS);
+    int i, ret;
+
+    layout.rt_prio = rt_prio;
+    layout.allowed.assign(allowed, allowed + nb_allowed);
+    if (!spec)
+        return 0;
+    if ((ret = !strcmp(spec, "auto") ? layout_auto(allowed, nb_allowed)
+                                     : layout_parse(spec, allowed, nb_allowed)) < 0)
+        return ret;
+#ifndef __linux__
+    if (layout.active)
+        av_log(NULL, AV_LOG_WARNING, "Thread pinning is not supported on this system\n");
+#endif
+
+    for (i = 0; i < PLACEMENT_NB; i++) {
+        char buf[256] = "all";
+        int len = 0;
+        for (size_t k = 0; k < layout.cpus[i].size() && len < (int)sizeof(buf) - 8; k++)
+            len += snprintf(buf + len, sizeof(buf) - len, "%s%d", k ? "," : "", layout.cpus[i][k]);
+        av_log(NULL, AV_LOG_VERBOSE, "placement: %-6s on cpus %s\n", role_names[i], buf);
+    }
+    return 0;
+}
+
+int placement_active(void)
+{
+    return layout.active;
+}
+
+int placement_get_cpus(enum PlacementRole role, int *cpus, int max)
+{
+    const std::vector<int> &set = layout.cpus[role].empty() ? layout.allowed : layout.cpus[role];
+    int n;
+
+    if (set.empty())
+        return placement_allowed_cpus(cpus, max);
+    n = FFMIN((int)set.size(), max);
+    std::copy(set.begin(), set.begin() + n, cpus);
+    return n;
+}
+
+static void set_realtime(enum PlacementRole role)
+{
+#ifdef __linux__
+    struct sched_param param = { 0 };
+
+    param.sched_priority = FFMIN(layout.rt_prio, sched_get_priority_max(SCHED_FIFO));
+    if (!pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+        return;
+    if (!layout.rt_failed)
+        av_log(NULL, AV_LOG_WARNING, "Could not get real-time priority for %s, "
+               "falling back to a high thread priority\n", role_names[role]);
+    layout.rt_failed = 1;
+#endif
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+}
+
+/* Threads inherit the policy of their creator, so threads of the other
+ * roles started from a real-time one have to leave it again. */
+static void set_normal(void)
+{
+#ifdef __linux__
+    struct sched_param param = { 0 };
+    int policy;
+
+    if (!pthread_getschedparam(pthread_self(), &policy, &param) && policy != SCHED_OTHER) {
+        param.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    }
+#endif
+    if (layout.rt_failed)
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_NORMAL);
+}
+
+static int is_realtime(int role)
+{
+    return layout.rt_prio > 0 && (role == PLACEMENT_AUDIO || role == PLACEMENT_RENDER);
+}
+
+/* role of the calling thread, -1 before placement_apply */
+static thread_local int thread_role = -1;
+
+/* role -1 is a thread without a role, it runs on all allowed CPUs */
+static int pin(int role)
+{
+#ifdef __linux__
+    if (layout.active) {
+        const std::vector<int> &cpus = role >= 0 && !layout.cpus[role].empty() ? layout.cpus[role] : layout.allowed;
+        cpu_set_t set;
+        int err;
+
+        /* roles without a set go back to all CPUs, a thread may have
+         * inherited the set of its creator */
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+            CPU_SET(cpu, &set);
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))) {
+            av_log(NULL, AV_LOG_WARNING, "Could not pin the %s thread\n",
+                   role >= 0 ? role_names[role] : "calling");
+            return AVERROR(err);
+        }
+    }
+#endif
+    return 0;
+}
+
+int placement_apply(enum PlacementRole role)
+{
+    if (is_realtime(role))
+        set_realtime(role);
+    else if (layout.rt_prio > 0)
+        set_normal();
+    thread_role = role;
+    return pin(role);
+}
+
+int placement_spawn(enum PlacementRole role)
+{
+    if (is_realtime(thread_role) && !is_realtime(role))
+        set_normal();
+    return pin(role);
+}
+
+int placement_restore(void)
+{
+    if (is_realtime(thread_role))
+        set_realtime((enum PlacementRole)thread_role);
+    return pin(thread_role);
+}
+
+void placement_jitter_add(PlacementJitter *j, double deviation)
+{
+    deviation = fabs(deviation);
+    j->count++;
+    j->sum  += deviation;
+    j->sum2 += deviation * deviation;
+    j->max   = FFMAX(j->max, deviation);
+}
+
+void placement_jitter_log(const PlacementJitter *j, const char *name, int level)
+{
+    double mean, sd;
+
+    if (!j->count)
+        return;
+    mean = j->sum / j->count;
+    sd   = sqrt(FFMAX(j->sum2 / j->count - mean * mean, 0.0));
+    av_log(NULL, level, "%s jitter: %.2f ms mean, %.2f ms sd, %.2f ms max over %"PRId64" events\n",
+           name, mean * 1000.0, sd * 1000.0, j->max * 1000.0, j->count);
+}
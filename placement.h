@@ -0,0 +1,87 @@
+/*
+ * Thread placement: which CPUs each thread of the player runs on
+ *
+ * A layout gives every role a CPU set. Each thread calls placement_apply
+ * for its role when it starts, and the threads it creates afterwards, such
+ * as the workers of libavcodec or the OpenMP pool of libtorch, inherit the
+ * set. Roles without a set run on all the CPUs the process may use.
+ *
+ * "auto" keeps the render and audio threads on the first CPU, gives the
+ * read thread and the decoders about a quarter of the CPUs on the same NUMA
+ * node, and the rest to inference, ordered by node so that the core group of a replica
+ * stays on one node where it can.
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdint.h>
+
+enum PlacementRole {
+    PLACEMENT_READ,     /* read_thread */
+    PLACEMENT_VDEC,     /* video_thread, its libavcodec workers and the -vf graph */
+    PLACEMENT_ADEC,     /* audio and subtitle decoders */
+    PLACEMENT_AUDIO,    /* the SDL audio callback */
+    PLACEMENT_RENDER,   /* the main thread: events, refresh and display */
+    PLACEMENT_INFER,    /* inference replicas and their intra-op threads */
+    PLACEMENT_NB
+};
+
+/**
+ * Set up the layout from spec, either "auto" or role=cpus pairs separated
+ * by ':' with roles read, vdec, adec, audio, render and infer and cpus a
+ * list like "4-7,12". With rt_prio > 0 the audio and render threads ask
+ * for SCHED_FIFO at that priority. A NULL spec only sets the priority.
+ */
+int placement_init(const char *spec, int rt_prio);
+
+/**
+ * @return 1 if a CPU set was given to any role
+ */
+int placement_active(void);
+
+/**
+ * Store the CPUs of role in cpus, all allowed ones for a role without a set.
+ *
+ * @return the number of CPUs, at least 1
+ */
+int placement_get_cpus(enum PlacementRole role, int *cpus, int max);
+
+/**
+ * CPUs this process may run on, which is less than the machine when it
+ * was started with an affinity mask, e.g. as a shard worker.
+ */
+int placement_allowed_cpus(int *cpus, int max);
+
+/**
+ * Move the calling thread to the CPU set and priority of role. With
+ * -rt_prio, roles other than audio and render drop the real-time policy
+ * inherited from the thread that started them. Does nothing without a
+ * layout or -rt_prio.
+ */
+int placement_apply(enum PlacementRole role);
+
+/**
+ * Move the calling thread to the CPU set and priority of role for
+ * creating the threads of another role, e.g. around avcodec_open2 for the
+ * decoder workers. placement_restore puts it back on the set and priority
+ * of its own role.
+ */
+int placement_spawn(enum PlacementRole role);
+
+int placement_restore(void);
+
+/**
+ * Running statistics of how far an event was from its schedule, in
+ * seconds, e.g. the audio callback period or the display time of a picture.
+ */
+typedef struct PlacementJitter {
+    int64_t count;
+    double sum, sum2, max;
+} PlacementJitter;
+
+void placement_jitter_add(PlacementJitter *j, double deviation);
+
+void placement_jitter_log(const PlacementJitter *j, const char *name, int level);
+
+#endif /* PLACEMENT_H */
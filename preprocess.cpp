@@ -0,0 +1,427 @@
+/*
+ * Decoded picture -> PoolNet input tensor in one pass
+ *
+ * Area filtering is done on the YUV samples before the colorspace
+ * conversion. The conversion is linear, so this only differs from
+ * averaging RGB where the result is clipped. The per-row loops work on
+ * contiguous arrays and are left to the compiler to vectorize, this file
+ * is built with -O3.
+ */
+
+#include "preprocess.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+extern "C"
+{
+#include "libavutil/common.h"
+#include "libavutil/error.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixfmt.h"
+#include "libswscale/swscale.h"
+}
+
+struct PreprocessContext {
+    int src_x, src_w, dst_w;        /* columns the tables were built for */
+    std::vector<int> lx0, lx1;      /* luma columns averaged into each output column */
+    std::vector<int> cx0, cx1;      /* same for chroma */
+    std::vector<float> linv, cinv;  /* 1 / columns of each span */
+    std::vector<uint32_t> acc_y, acc_u, acc_v;
+
+    /* other formats */
+    struct SwsContext *sws;
+    std::vector<uint8_t> rgb;
+    AVFrame *cropped;
+};
+
+PreprocessContext *preprocess_alloc(void)
+{
+    return new PreprocessContext();
+}
+
+void preprocess_freep(PreprocessContext **ctx)
+{
+    if (!*ctx)
+        return;
+    sws_freeContext((*ctx)->sws);
+    av_frame_free(&(*ctx)->cropped);
+    delete *ctx;
+    *ctx = NULL;
+}
+
+int preprocess_supported(int format)
+{
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P ||
+           format == AV_PIX_FMT_NV12 || format == AV_PIX_FMT_NV21;
+}
+
+void preprocess_geometry(PreprocessParams *p, enum PreprocessFit fit,
+                         int src_w, int src_h, AVRational sar)
+{
+    double aspect = sar.num > 0 && sar.den > 0 ? av_q2d(sar) : 1.0;
+    double s, sx, sy;
+    int w, h, ox, oy, x0, x1, y0, y1;
+
+    /* the picture scaled to w x h, the input at ox, oy in it */
+    if (fit == PREPROCESS_FIT_STRETCH) {
+        w = p->width;
+        h = p->height;
+    } else {
+        sx = p->width / (src_w * aspect);
+        sy = p->height / (double)src_h;
+        s  = fit == PREPROCESS_FIT_CROP ? FFMAX(sx, sy) : FFMIN(sx, sy);
+        w  = FFMAX(lrint(src_w * aspect * s), 1);
+        h  = FFMAX(lrint(src_h * s), 1);
+        if (fit == PREPROCESS_FIT_CROP) {
+            w = FFMAX(w, p->width);
+            h = FFMAX(h, p->height);
+        } else {
+            w = FFMIN(w, p->width);
+            h = FFMIN(h, p->height);
+        }
+    }
+    ox = (w - p->width) / 2;
+    oy = (h - p->height) / 2;
+    x0 = FFMAX(ox, 0);
+    y0 = FFMAX(oy, 0);
+    x1 = FFMIN(ox + p->width, w);
+    y1 = FFMIN(oy + p->height, h);
+
+    p->mask_w = w;
+    p->mask_h = h;
+    p->mask_x = x0;
+    p->mask_y = y0;
+    p->dst_x  = x0 - ox;
+    p->dst_y  = y0 - oy;
+    p->dst_w  = x1 - x0;
+    p->dst_h  = y1 - y0;
+    p->src_x  = (int)((int64_t)x0 * src_w / w);
+    p->src_y  = (int)((int64_t)y0 * src_h / h);
+    p->src_w  = FFMAX((int)((int64_t)x1 * src_w / w) - p->src_x, 1);
+    p->src_h  = FFMAX((int)((int64_t)y1 * src_h / h) - p->src_y, 1);
+}
+
+/* source samples [x0[i], x1[i]) cover output sample i, at least one each */
+static void build_spans(int off, int src, int dst, std::vector<int> &x0, std::vector<int> &x1, std::vector<float> &inv)
+{
+    int i;
+
+    x0.resize(dst);
+    x1.resize(dst);
+    inv.resize(dst);
+    for (i = 0; i < dst; i++) {
+        x0[i] = off + (int)((int64_t)i * src / dst);
+        x1[i] = FFMAX(off + (int)((int64_t)(i + 1) * src / dst), x0[i] + 1);
+        inv[i] = 1.0f / (x1[i] - x0[i]);
+    }
+}
+
+/* zero the input outside the dst area */
+static void clear_padding(float *dst, const PreprocessParams *p)
+{
+    int planes = p->nhwc ? 1 : 3, comps = p->nhwc ? 3 : 1;
+    int row = p->width * comps;
+    int c, j;
+
+    if (p->dst_w == p->width && p->dst_h == p->height)
+        return;
+    for (c = 0; c < planes; c++) {
+        float *plane = dst + (ptrdiff_t)c * p->width * p->height;
+        for (j = 0; j < p->height; j++) {
+            float *line = plane + (ptrdiff_t)j * row;
+            if (j < p->dst_y || j >= p->dst_y + p->dst_h) {
+                memset(line, 0, row * sizeof(*line));
+            } else {
+                memset(line, 0, p->dst_x * comps * sizeof(*line));
+                memset(line + (p->dst_x + p->dst_w) * comps, 0,
+                       (p->width - p->dst_x - p->dst_w) * comps * sizeof(*line));
+            }
+        }
+    }
+}
+
+static void add_row(uint32_t *acc, const uint8_t *row, int step,
+                    const int *x0, const int *x1, int n)
+{
+    int i, x;
+
+    for (i = 0; i < n; i++) {
+        uint32_t sum = 0;
+        for (x = x0[i]; x < x1[i]; x++)
+            sum += row[x * step];
+        acc[i] += sum;
+    }
+}
+
+static void yuv_coefficients(const AVFrame *src, float *kr, float *kb)
+{
+    switch (src->colorspace) {
+    case AVCOL_SPC_BT709:
+        *kr = 0.2126f; *kb = 0.0722f;
+        break;
+    case AVCOL_SPC_BT2020_NCL:
+    case AVCOL_SPC_BT2020_CL:
+        *kr = 0.2627f; *kb = 0.0593f;
+        break;
+    case AVCOL_SPC_SMPTE240M:
+        *kr = 0.212f;  *kb = 0.087f;
+        break;
+    case AVCOL_SPC_FCC:
+        *kr = 0.30f;   *kb = 0.11f;
+        break;
+    default:    /* BT.601, also what swscale assumes when unspecified */
+        *kr = 0.299f;  *kb = 0.114f;
+        break;
+    }
+}
+
+/* dst rows [j0, j1) of the dst area */
+static int preprocess_yuv420(PreprocessContext *ctx, const AVFrame *src, float *dst,
+                             const PreprocessParams *p, int j0, int j1)
+{
+    int sx = p->src_x, sy = p->src_y, sw = p->src_w, sh = p->src_h;
+    int cx = sx >> 1, cy = sy >> 1;
+    int cw = AV_CEIL_RSHIFT(sx + sw, 1) - cx, ch = AV_CEIL_RSHIFT(sy + sh, 1) - cy;
+    int dw = p->dst_w, dh = p->dst_h, plane = p->width * p->height;
+    ptrdiff_t stride = p->nhwc ? p->width * 3 : p->width;
+    int full = src->color_range == AVCOL_RANGE_JPEG || src->format == AV_PIX_FMT_YUVJ420P;
+    float kr, kb, kg, crv, cgu, cgv, cbu, ys, yo, cs;
+    const uint8_t *u, *v;
+    int cstep, i, j, y, y0, y1, c0, c1;
+
+    if (ctx->src_x != sx || ctx->src_w != sw || ctx->dst_w != dw) {
+        build_spans(sx, sw, dw, ctx->lx0, ctx->lx1, ctx->linv);
+        build_spans(cx, cw, dw, ctx->cx0, ctx->cx1, ctx->cinv);
+        ctx->acc_y.resize(dw);
+        ctx->acc_u.resize(dw);
+        ctx->acc_v.resize(dw);
+        ctx->src_x = sx;
+        ctx->src_w = sw;
+        ctx->dst_w = dw;
+    }
+
+    yuv_coefficients(src, &kr, &kb);
+    kg  = 1.0f - kr - kb;
+    crv = 2.0f * (1.0f - kr);
+    cbu = 2.0f * (1.0f - kb);
+    cgu = 2.0f * kb * (1.0f - kb) / kg;
+    cgv = 2.0f * kr * (1.0f - kr) / kg;
+    ys  = full ? 1.0f : 255.0f / 219.0f;
+    yo  = full ? 0.0f : 16.0f;
+    cs  = full ? 1.0f : 255.0f / 224.0f;
+
+    if (src->format == AV_PIX_FMT_NV12 || src->format == AV_PIX_FMT_NV21) {
+        u = src->data[1] + (src->format == AV_PIX_FMT_NV21);
+        v = src->data[1] + (src->format == AV_PIX_FMT_NV12);
+        cstep = 2;
+    } else {
+        u = src->data[1];
+        v = src->data[2];
+        cstep = 1;
+    }
+
+    for (j = j0; j < j1; j++) {
+        uint32_t *ay = ctx->acc_y.data(), *au = ctx->acc_u.data(), *av = ctx->acc_v.data();
+        const float *linv = ctx->linv.data(), *cinv = ctx->cinv.data();
+        float ry, rc;
+
+        y0 = sy + (int)((int64_t)j * sh / dh);
+        y1 = FFMAX(sy + (int)((int64_t)(j + 1) * sh / dh), y0 + 1);
+        c0 = cy + (int)((int64_t)j * ch / dh);
+        c1 = FFMAX(cy + (int)((int64_t)(j + 1) * ch / dh), c0 + 1);
+        ry = 1.0f / (y1 - y0);
+        rc = 1.0f / (c1 - c0);
+
+        memset(ay, 0, dw * sizeof(*ay));
+        memset(au, 0, dw * sizeof(*au));
+        memset(av, 0, dw * sizeof(*av));
+        for (y = y0; y < y1; y++)
+            add_row(ay, src->data[0] + (ptrdiff_t)y * src->linesize[0], 1,
+                    ctx->lx0.data(), ctx->lx1.data(), dw);
+        for (y = c0; y < c1; y++) {
+            add_row(au, u + (ptrdiff_t)y * src->linesize[1], cstep,
+                    ctx->cx0.data(), ctx->cx1.data(), dw);
+            add_row(av, v + (ptrdiff_t)y * src->linesize[cstep == 2 ? 1 : 2], cstep,
+                    ctx->cx0.data(), ctx->cx1.data(), dw);
+        }
+
+        if (p->nhwc) {
+            float *out = dst + (p->dst_y + j) * stride + p->dst_x * 3;
+            for (i = 0; i < dw; i++) {
+                float Y = (ay[i] * linv[i] * ry - yo) * ys;
+                float U = (au[i] * cinv[i] * rc - 128.0f) * cs;
+                float V = (av[i] * cinv[i] * rc - 128.0f) * cs;
+                float R = av_clipf(Y + crv * V, 0.0f, 255.0f);
+                float G = av_clipf(Y - cgu * U - cgv * V, 0.0f, 255.0f);
+                float B = av_clipf(Y + cbu * U, 0.0f, 255.0f);
+                out[3 * i    ] = (R - p->mean[0]) * p->scale[0];
+                out[3 * i + 1] = (G - p->mean[1]) * p->scale[1];
+                out[3 * i + 2] = (B - p->mean[2]) * p->scale[2];
+            }
+        } else {
+            float *outr = dst + (p->dst_y + j) * stride + p->dst_x;
+            float *outg = outr + plane;
+            float *outb = outg + plane;
+            for (i = 0; i < dw; i++) {
+                float Y = (ay[i] * linv[i] * ry - yo) * ys;
+                float U = (au[i] * cinv[i] * rc - 128.0f) * cs;
+                float V = (av[i] * cinv[i] * rc - 128.0f) * cs;
+                float R = av_clipf(Y + crv * V, 0.0f, 255.0f);
+                float G = av_clipf(Y - cgu * U - cgv * V, 0.0f, 255.0f);
+                float B = av_clipf(Y + cbu * U, 0.0f, 255.0f);
+                outr[i] = (R - p->mean[0]) * p->scale[0];
+                outg[i] = (G - p->mean[1]) * p->scale[1];
+                outb[i] = (B - p->mean[2]) * p->scale[2];
+            }
+        }
+    }
+    return 0;
+}
+
+/* RGB24 or GBRP with the src area already at the dst size, as the analysis
+ * branch of the player's filtergraph delivers it: only normalize dst rows
+ * [j0, j1) */
+static int preprocess_rgb(const AVFrame *src, float *dst, const PreprocessParams *p, int j0, int j1)
+{
+    int dw = p->dst_w, plane = p->width * p->height;
+    ptrdiff_t stride = p->nhwc ? p->width * 3 : p->width;
+    int i, j, c;
+
+    for (j = j0; j < j1; j++) {
+        int y = p->src_y + j;
+        if (src->format == AV_PIX_FMT_RGB24) {
+            const uint8_t *row = src->data[0] + (ptrdiff_t)y * src->linesize[0] + p->src_x * 3;
+            if (p->nhwc) {
+                float *out = dst + (p->dst_y + j) * stride + p->dst_x * 3;
+                for (i = 0; i < 3 * dw; i++)
+                    out[i] = (row[i] - p->mean[i % 3]) * p->scale[i % 3];
+            } else {
+                float *outr = dst + (p->dst_y + j) * stride + p->dst_x;
+                for (i = 0; i < dw; i++) {
+                    outr[i]             = (row[3 * i    ] - p->mean[0]) * p->scale[0];
+                    outr[i + plane]     = (row[3 * i + 1] - p->mean[1]) * p->scale[1];
+                    outr[i + 2 * plane] = (row[3 * i + 2] - p->mean[2]) * p->scale[2];
+                }
+            }
+        } else {
+            /* GBRP stores G, B, R */
+            static const int order[3] = { 2, 0, 1 };
+            for (c = 0; c < 3; c++) {
+                const uint8_t *row = src->data[order[c]] + (ptrdiff_t)y * src->linesize[order[c]] + p->src_x;
+                float mean = p->mean[c], scale = p->scale[c];
+                if (p->nhwc) {
+                    float *out = dst + (p->dst_y + j) * stride + p->dst_x * 3 + c;
+                    for (i = 0; i < dw; i++)
+                        out[3 * i] = (row[i] - mean) * scale;
+                } else {
+                    float *out = dst + c * plane + (p->dst_y + j) * stride + p->dst_x;
+                    for (i = 0; i < dw; i++)
+                        out[i] = (row[i] - mean) * scale;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* swscale the src area to RGB24 at the dst size, then normalize */
+static int preprocess_sws(PreprocessContext *ctx, const AVFrame *src, float *dst,
+                          const PreprocessParams *p)
+{
+    int dw = p->dst_w, dh = p->dst_h, plane = p->width * p->height;
+    int stride = FFALIGN(dw * 3, 32);
+    ptrdiff_t out_stride = p->nhwc ? p->width * 3 : p->width;
+    uint8_t *data[4] = { NULL };
+    int linesize[4] = { stride };
+    AVFrame *in;
+    int i, j, ret;
+
+    if (!ctx->cropped && !(ctx->cropped = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    in = ctx->cropped;
+    if ((ret = av_frame_ref(in, src)) < 0)
+        return ret;
+    in->crop_left   = p->src_x;
+    in->crop_top    = p->src_y;
+    in->crop_right  = src->width  - p->src_x - p->src_w;
+    in->crop_bottom = src->height - p->src_y - p->src_h;
+    if ((ret = av_frame_apply_cropping(in, AV_FRAME_CROP_UNALIGNED)) < 0)
+        goto end;
+
+    ctx->sws = sws_getCachedContext(ctx->sws, in->width, in->height, (enum AVPixelFormat)in->format,
+                                    dw, dh, AV_PIX_FMT_RGB24, SWS_AREA, NULL, NULL, NULL);
+    if (!ctx->sws) {
+        ret = AVERROR(EINVAL);
+        goto end;
+    }
+    ctx->rgb.resize((size_t)stride * dh);
+    data[0] = ctx->rgb.data();
+    sws_scale(ctx->sws, (const uint8_t * const *)in->data, in->linesize, 0, in->height,
+              data, linesize);
+
+    for (j = 0; j < dh; j++) {
+        const uint8_t *row = data[0] + (ptrdiff_t)j * stride;
+        if (p->nhwc) {
+            float *out = dst + (p->dst_y + j) * out_stride + p->dst_x * 3;
+            for (i = 0; i < 3 * dw; i++)
+                out[i] = (row[i] - p->mean[i % 3]) * p->scale[i % 3];
+        } else {
+            float *outr = dst + (p->dst_y + j) * out_stride + p->dst_x;
+            for (i = 0; i < dw; i++) {
+                outr[i]             = (row[3 * i    ] - p->mean[0]) * p->scale[0];
+                outr[i + plane]     = (row[3 * i + 1] - p->mean[1]) * p->scale[1];
+                outr[i + 2 * plane] = (row[3 * i + 2] - p->mean[2]) * p->scale[2];
+            }
+        }
+    }
+    ret = 0;
+end:
+    av_frame_unref(in);
+    return ret;
+}
+
+int preprocess_frame_slice(PreprocessContext *ctx, const AVFrame *src, float *dst,
+                           const PreprocessParams *params, int jobnr, int nb_jobs)
+{
+    if (params->width <= 0 || params->height <= 0 || params->dst_w <= 0 || params->dst_h <= 0 ||
+        params->src_x + params->src_w > src->width || params->src_y + params->src_h > src->height)
+        return AVERROR(EINVAL);
+    if (!jobnr)
+        clear_padding(dst, params);
+    if (preprocess_supported(src->format))
+        return preprocess_yuv420(ctx, src, dst, params,
+                                 params->dst_h * jobnr / nb_jobs, params->dst_h * (jobnr + 1) / nb_jobs);
+    if ((src->format == AV_PIX_FMT_RGB24 || src->format == AV_PIX_FMT_GBRP) &&
+        params->src_w == params->dst_w && params->src_h == params->dst_h)
+        return preprocess_rgb(src, dst, params,
+                              params->dst_h * jobnr / nb_jobs, params->dst_h * (jobnr + 1) / nb_jobs);
+    /* swscale does the whole picture in one go */
+    return jobnr ? 0 : preprocess_sws(ctx, src, dst, params);
+}
+
+int preprocess_frame(PreprocessContext *ctx, const AVFrame *src, float *dst,
+                     const PreprocessParams *params)
+{
+    return preprocess_frame_slice(ctx, src, dst, params, 0, 1);
+}
+
+int preprocess_output_mask(const PreprocessParams *p, const uint8_t *out, AVFrame *mask)
+{
+    int ret;
+
+    mask->format = AV_PIX_FMT_GRAY8;
+    mask->width  = p->mask_w;
+    mask->height = p->mask_h;
+    if ((ret = av_frame_get_buffer(mask, 0)) < 0)
+        return ret;
+    if (p->dst_w != p->mask_w || p->dst_h != p->mask_h)
+        memset(mask->data[0], 0, (size_t)mask->linesize[0] * mask->height);
+    av_image_copy_plane(mask->data[0] + p->mask_y * mask->linesize[0] + p->mask_x, mask->linesize[0],
+                        out + p->dst_y * p->width + p->dst_x, p->width,
+                        p->dst_w, p->dst_h);
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Decoded picture -> PoolNet input tensor in one pass
+ *
+ * YUV420P, YUVJ420P, NV12 and NV21 pictures are read in place: each output
+ * row area-averages the luma and chroma rows it covers, converts the
+ * averages to RGB with the colorspace and range of the picture, normalizes
+ * and stores float planes (NCHW) or interleaved float (NHWC). RGB24 and GBRP
+ * pictures that are already at the input size are only normalized. Other
+ * formats go through swscale to RGB24 first.
+ *
+ * The picture is stretched to the input size, or scaled with its display
+ * aspect ratio kept and either letterboxed (zero padding) or center cropped.
+ * The mask is the network output mapped back onto the picture scaled the
+ * same way, so it always has the display aspect ratio of the picture.
+ */
+
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+extern "C"
+{
+#include "libavutil/frame.h"
+#include "libavutil/rational.h"
+}
+
+enum PreprocessFit {
+    PREPROCESS_FIT_STRETCH,
+    PREPROCESS_FIT_LETTERBOX,
+    PREPROCESS_FIT_CROP,
+};
+
+typedef struct PreprocessParams {
+    int width, height;          /* network input */
+    int nhwc;                   /* interleaved RGB instead of one plane per channel */
+    float mean[3];              /* subtracted from R, G, B in 0..255 */
+    float scale[3];             /* multiplied after the mean is subtracted */
+
+    /* set by preprocess_geometry */
+    int src_x, src_y, src_w, src_h;     /* area of the picture fed to the network */
+    int dst_x, dst_y, dst_w, dst_h;     /* where it lands in the input, the rest is zero */
+    int mask_w, mask_h;                 /* the picture scaled like the input */
+    int mask_x, mask_y;                 /* where the dst area lands in the mask */
+} PreprocessParams;
+
+typedef struct PreprocessContext PreprocessContext;
+
+PreprocessContext *preprocess_alloc(void);
+void preprocess_freep(PreprocessContext **ctx);
+
+/**
+ * @return 1 if pictures of this format take the single pass path
+ */
+int preprocess_supported(int format);
+
+/**
+ * Fit a src_w x src_h picture with sample aspect ratio sar (0/1 for
+ * square) into params->width x params->height.
+ */
+void preprocess_geometry(PreprocessParams *params, enum PreprocessFit fit,
+                         int src_w, int src_h, AVRational sar);
+
+/**
+ * Write src as params->width x params->height float RGB to dst, which holds
+ * 3 * width * height floats, after preprocess_geometry was called for the
+ * size of src. The tables of the context follow the geometry and grow with
+ * the picture, so one context per input size and stream avoids rebuilding
+ * them.
+ */
+int preprocess_frame(PreprocessContext *ctx, const AVFrame *src, float *dst,
+                     const PreprocessParams *params);
+
+/**
+ * Same as preprocess_frame for the rows of job jobnr out of nb_jobs, so
+ * slice threads can share one picture. Each job needs its own context.
+ */
+int preprocess_frame_slice(PreprocessContext *ctx, const AVFrame *src, float *dst,
+                           const PreprocessParams *params, int jobnr, int nb_jobs);
+
+/**
+ * Map the params->width x params->height network output onto mask, which
+ * gets allocated as params->mask_w x params->mask_h GRAY8.
+ */
+int preprocess_output_mask(const PreprocessParams *params, const uint8_t *out, AVFrame *mask);
+
+#endif /* PREPROCESS_H */
@@ -0,0 +1,484 @@
+/*
+ * Encode pictures and their saliency masks to a file on a thread of its own
+ *
+ * The player only queues references. Conversion, compositing, encoding and
+ * muxing all happen on the encoder thread, and a full queue drops pictures
+ * (counted) rather than stalling the decoder or the inference stage.
+ */
+
+#include "saliency_encoder.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/avstring.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+typedef struct EncoderItem {
+    AVFrame *frame;
+    AVFrame *mask;
+    double pts;
+    double duration;
+    int serial;
+} EncoderItem;
+
+struct SaliencyEncoder {
+    SaliencyEncoderOptions opts;
+    char *filename;
+    char *codec_name;
+
+    AVFormatContext *oc;
+    AVCodecContext *enc[2];
+    AVStream *st[2];
+    AVFrame *out[2];            /* encoder input of each stream */
+    AVFrame *scaled_mask;       /* mask at the output size, for the overlay */
+    AVPacket *pkt;
+    int nb_streams;
+    struct SwsContext *video_ctx;
+    struct SwsContext *mask_ctx;
+    int opened;
+    int error;
+
+    /* output timeline */
+    int last_serial;
+    double pts_offset;
+    double last_pts;
+    double last_duration;
+    int64_t last_ms;
+    int64_t nb_frames;
+
+    SDL_Thread *tid;
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    EncoderItem *queue;
+    int rindex;
+    int size;
+    int abort_request;
+    int blocking;
+    int64_t nb_dropped;
+};
+
+static int pix_fmt_supported(const AVCodec *codec, enum AVPixelFormat fmt)
+{
+    const enum AVPixelFormat *p;
+
+    if (!codec->pix_fmts)
+        return 1;
+    for (p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++)
+        if (*p == fmt)
+            return 1;
+    return 0;
+}
+
+static enum AVPixelFormat pick_pix_fmt(const AVCodec *codec, enum AVPixelFormat src)
+{
+    if (pix_fmt_supported(codec, src))
+        return src;
+    return avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, src, 0, NULL);
+}
+
+static int add_stream(SaliencyEncoder *e, const AVCodec *codec, int index,
+                      int width, int height, AVRational sar, enum AVPixelFormat pix_fmt)
+{
+    AVCodecContext *c;
+    int ret;
+
+    if (!(e->st[index] = avformat_new_stream(e->oc, NULL)) ||
+        !(c = e->enc[index] = avcodec_alloc_context3(codec)))
+        return AVERROR(ENOMEM);
+    c->width  = width;
+    c->height = height;
+    c->sample_aspect_ratio = sar;
+    c->pix_fmt   = pix_fmt;
+    c->time_base = av_make_q(1, 1000);
+    if (e->opts.bit_rate > 0)
+        c->bit_rate = e->opts.bit_rate;
+    if (e->oc->oformat->flags & AVFMT_GLOBALHEADER)
+        c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if ((ret = avcodec_open2(c, codec, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open the %s encoder\n", codec->name);
+        return ret;
+    }
+    e->st[index]->time_base = c->time_base;
+    e->st[index]->sample_aspect_ratio = sar;
+    if ((ret = avcodec_parameters_from_context(e->st[index]->codecpar, c)) < 0)
+        return ret;
+
+    if (!(e->out[index] = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    e->out[index]->format = pix_fmt;
+    e->out[index]->width  = width;
+    e->out[index]->height = height;
+    return av_frame_get_buffer(e->out[index], 0);
+}
+
+/* create the output from the first picture */
+static int open_output(SaliencyEncoder *e, const AVFrame *frame)
+{
+    const AVCodec *codec;
+    enum AVPixelFormat video_fmt;
+    AVRational sar = frame->sample_aspect_ratio;
+    int ret;
+
+    if ((ret = avformat_alloc_output_context2(&e->oc, NULL, NULL, e->filename)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not find an output format for %s\n", e->filename);
+        return ret;
+    }
+    codec = e->codec_name ? avcodec_find_encoder_by_name(e->codec_name)
+                          : avcodec_find_encoder(e->oc->oformat->video_codec);
+    if (!codec || codec->type != AVMEDIA_TYPE_VIDEO) {
+        av_log(NULL, AV_LOG_ERROR, "No video encoder %s\n", e->codec_name ? e->codec_name : "for this format");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    if (e->opts.mode == SALIENCY_OUTPUT_ALPHA) {
+        if (!pix_fmt_supported(codec, AV_PIX_FMT_YUVA420P)) {
+            av_log(NULL, AV_LOG_ERROR, "The %s encoder has no yuva420p, try ffv1 or libvpx-vp9\n", codec->name);
+            return AVERROR(EINVAL);
+        }
+        video_fmt = AV_PIX_FMT_YUVA420P;
+    } else {
+        video_fmt = pick_pix_fmt(codec, (enum AVPixelFormat)frame->format);
+    }
+
+    e->nb_streams = e->opts.mode == SALIENCY_OUTPUT_GRAY ? 2 : 1;
+    if ((ret = add_stream(e, codec, 0, frame->width, frame->height, sar, video_fmt)) < 0)
+        return ret;
+    if (e->nb_streams > 1 &&
+        (ret = add_stream(e, codec, 1, frame->width, frame->height, sar,
+                          pick_pix_fmt(codec, AV_PIX_FMT_GRAY8))) < 0)
+        return ret;
+
+    if (e->opts.mode == SALIENCY_OUTPUT_OVERLAY) {
+        if (!(e->scaled_mask = av_frame_alloc()))
+            return AVERROR(ENOMEM);
+        e->scaled_mask->format = AV_PIX_FMT_GRAY8;
+        e->scaled_mask->width  = frame->width;
+        e->scaled_mask->height = frame->height;
+        if ((ret = av_frame_get_buffer(e->scaled_mask, 0)) < 0)
+            return ret;
+    }
+
+    if (!(e->oc->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&e->oc->pb, e->filename, AVIO_FLAG_WRITE)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s\n", e->filename);
+        return ret;
+    }
+    if ((ret = avformat_write_header(e->oc, NULL)) < 0)
+        return ret;
+    e->opened = 1;
+    av_log(NULL, AV_LOG_INFO, "Encoding saliency to %s with %s, %s\n", e->filename, codec->name,
+           av_get_pix_fmt_name(video_fmt));
+    return 0;
+}
+
+static int encode(SaliencyEncoder *e, int index, AVFrame *frame)
+{
+    int ret;
+
+    if ((ret = avcodec_send_frame(e->enc[index], frame)) < 0)
+        return ret;
+    for (;;) {
+        ret = avcodec_receive_packet(e->enc[index], e->pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            return ret;
+        av_packet_rescale_ts(e->pkt, e->enc[index]->time_base, e->st[index]->time_base);
+        e->pkt->stream_index = index;
+        if ((ret = av_interleaved_write_frame(e->oc, e->pkt)) < 0)
+            return ret;
+    }
+}
+
+/* scale the GRAY8 mask into dst planes of the given format and size */
+static int scale_mask(SaliencyEncoder *e, const AVFrame *mask, uint8_t **dst, const int *linesize,
+                      enum AVPixelFormat fmt, int width, int height)
+{
+    e->mask_ctx = sws_getCachedContext(e->mask_ctx, mask->width, mask->height, AV_PIX_FMT_GRAY8,
+                                       width, height, fmt, SWS_BILINEAR, NULL, NULL, NULL);
+    if (!e->mask_ctx)
+        return AVERROR(EINVAL);
+    sws_scale(e->mask_ctx, (const uint8_t * const *)mask->data, mask->linesize, 0, mask->height,
+              dst, linesize);
+    return 0;
+}
+
+/* dim each plane towards black (luma, RGB) or neutral (chroma) where the
+ * mask is low, keeping a quarter of the picture visible */
+static void overlay_mask(AVFrame *out, const AVFrame *m)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get((enum AVPixelFormat)out->format);
+    int rgb = desc->flags & AV_PIX_FMT_FLAG_RGB;
+    int plane, x, y, w, h, sx, sy, neutral;
+    uint8_t *p;
+
+    if ((desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM)) ||
+        !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) || desc->comp[0].depth != 8)
+        return;
+    for (plane = 0; plane < desc->nb_components; plane++) {
+        sx = (plane == 1 || plane == 2) && !rgb ? desc->log2_chroma_w : 0;
+        sy = (plane == 1 || plane == 2) && !rgb ? desc->log2_chroma_h : 0;
+        neutral = (plane == 1 || plane == 2) && !rgb ? 128 : 0;
+        if (plane == 3)
+            continue;
+        w = AV_CEIL_RSHIFT(out->width, sx);
+        h = AV_CEIL_RSHIFT(out->height, sy);
+        for (y = 0; y < h; y++) {
+            const uint8_t *mrow = m->data[0] + (y << sy) * m->linesize[0];
+            p = out->data[plane] + y * out->linesize[plane];
+            for (x = 0; x < w; x++) {
+                int weight = 64 + (mrow[x << sx] * 192 >> 8);
+                p[x] = neutral + ((p[x] - neutral) * weight >> 8);
+            }
+        }
+    }
+}
+
+static double output_pts(SaliencyEncoder *e, const EncoderItem *item)
+{
+    double pts = item->pts;
+
+    if (!e->nb_frames) {
+        e->pts_offset = isnan(pts) ? 0 : -pts;
+    } else if (item->serial != e->last_serial || isnan(pts)) {
+        /* continue right after the last picture */
+        pts = e->last_pts + e->last_duration;
+        e->pts_offset = 0;
+        if (!isnan(item->pts))
+            e->pts_offset = pts - item->pts;
+        return pts;
+    }
+    return (isnan(pts) ? 0 : pts) + e->pts_offset;
+}
+
+static int encode_item(SaliencyEncoder *e, const EncoderItem *item)
+{
+    AVFrame *out;
+    const AVFrame *mask = item->mask->data[0] ? item->mask : NULL;
+    double pts;
+    int64_t ms;
+    int ret;
+
+    if (!e->opened && (ret = open_output(e, item->frame)) < 0)
+        return ret;
+
+    pts = output_pts(e, item);
+    ms  = llrint(pts * 1000);
+    if (e->nb_frames && ms <= e->last_ms)
+        ms = e->last_ms + 1;
+    e->last_ms       = ms;
+    e->last_pts      = pts;
+    e->last_duration = item->duration > 0 ? item->duration : 0.04;
+    e->last_serial   = item->serial;
+
+    out = e->out[0];
+    if ((ret = av_frame_make_writable(out)) < 0)
+        return ret;
+    e->video_ctx = sws_getCachedContext(e->video_ctx,
+                                        item->frame->width, item->frame->height, (enum AVPixelFormat)item->frame->format,
+                                        out->width, out->height, (enum AVPixelFormat)out->format,
+                                        SWS_BICUBIC, NULL, NULL, NULL);
+    if (!e->video_ctx)
+        return AVERROR(EINVAL);
+    sws_scale(e->video_ctx, (const uint8_t * const *)item->frame->data, item->frame->linesize,
+              0, item->frame->height, out->data, out->linesize);
+
+    if (mask && e->opts.mode == SALIENCY_OUTPUT_OVERLAY) {
+        if ((ret = scale_mask(e, mask, e->scaled_mask->data, e->scaled_mask->linesize,
+                              AV_PIX_FMT_GRAY8, out->width, out->height)) < 0)
+            return ret;
+        overlay_mask(out, e->scaled_mask);
+    } else if (mask && e->opts.mode == SALIENCY_OUTPUT_ALPHA) {
+        if ((ret = scale_mask(e, mask, &out->data[3], &out->linesize[3],
+                              AV_PIX_FMT_GRAY8, out->width, out->height)) < 0)
+            return ret;
+    } else if (e->opts.mode == SALIENCY_OUTPUT_ALPHA) {
+        memset(out->data[3], 255, out->linesize[3] * out->height);
+    }
+    out->pts = ms;
+    if ((ret = encode(e, 0, out)) < 0)
+        return ret;
+
+    if (e->nb_streams > 1) {
+        out = e->out[1];
+        if ((ret = av_frame_make_writable(out)) < 0)
+            return ret;
+        if (mask) {
+            if ((ret = scale_mask(e, mask, out->data, out->linesize,
+                                  (enum AVPixelFormat)out->format, out->width, out->height)) < 0)
+                return ret;
+        } else {
+            ptrdiff_t linesize[4] = { out->linesize[0], out->linesize[1], out->linesize[2], out->linesize[3] };
+            av_image_fill_black(out->data, linesize, (enum AVPixelFormat)out->format,
+                                AVCOL_RANGE_JPEG, out->width, out->height);
+        }
+        out->pts = ms;
+        if ((ret = encode(e, 1, out)) < 0)
+            return ret;
+    }
+    e->nb_frames++;
+    return 0;
+}
+
+static void item_free(EncoderItem *item)
+{
+    av_frame_free(&item->frame);
+    av_frame_free(&item->mask);
+}
+
+static int encoder_thread(void *arg)
+{
+    SaliencyEncoder *e = (SaliencyEncoder *)arg;
+    EncoderItem item;
+    int i, ret;
+
+    for (;;) {
+        SDL_LockMutex(e->mutex);
+        while (!e->size && !e->abort_request)
+            SDL_CondWait(e->cond, e->mutex);
+        if (!e->size) {
+            SDL_UnlockMutex(e->mutex);
+            break;
+        }
+        item = e->queue[e->rindex];
+        memset(&e->queue[e->rindex], 0, sizeof(item));
+        e->rindex = (e->rindex + 1) % e->opts.queue_size;
+        e->size--;
+        SDL_CondBroadcast(e->cond);
+        SDL_UnlockMutex(e->mutex);
+
+        if (!e->error && (ret = encode_item(e, &item)) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Encoding to %s failed: %s\n", e->filename, av_err2str(ret));
+            e->error = 1;
+        }
+        item_free(&item);
+    }
+
+    if (e->opened) {
+        for (i = 0; i < e->nb_streams; i++)
+            encode(e, i, NULL);
+        av_write_trailer(e->oc);
+        av_log(NULL, AV_LOG_INFO, "Encoded %"PRId64" pictures to %s, %"PRId64" dropped\n",
+               e->nb_frames, e->filename, e->nb_dropped);
+    }
+    return 0;
+}
+
+int saliency_encoder_open(SaliencyEncoder **penc, const SaliencyEncoderOptions *opts)
+{
+    SaliencyEncoder *e = (SaliencyEncoder *)av_mallocz(sizeof(*e));
+
+    *penc = NULL;
+    if (!e)
+        return AVERROR(ENOMEM);
+    e->opts = *opts;
+    e->opts.queue_size = FFMAX(opts->queue_size, 1);
+    e->filename   = av_strdup(opts->filename);
+    e->codec_name = opts->codec_name ? av_strdup(opts->codec_name) : NULL;
+    e->queue = (EncoderItem *)av_mallocz_array(e->opts.queue_size, sizeof(*e->queue));
+    e->pkt   = av_packet_alloc();
+    e->mutex = SDL_CreateMutex();
+    e->cond  = SDL_CreateCond();
+    if (!e->filename || (opts->codec_name && !e->codec_name) || !e->queue || !e->pkt ||
+        !e->mutex || !e->cond) {
+        saliency_encoder_close(&e);
+        return AVERROR(ENOMEM);
+    }
+    if (!(e->tid = SDL_CreateThread(encoder_thread, "saliency_encoder", e))) {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        saliency_encoder_close(&e);
+        return AVERROR(ENOMEM);
+    }
+    *penc = e;
+    return 0;
+}
+
+void saliency_encoder_set_blocking(SaliencyEncoder *e, int blocking)
+{
+    e->blocking = blocking;
+}
+
+int saliency_encoder_send(SaliencyEncoder *e, const AVFrame *frame, const AVFrame *mask,
+                          double pts, double duration, int serial)
+{
+    EncoderItem *item;
+    int ret;
+
+    if (e->error)
+        return 0;
+    SDL_LockMutex(e->mutex);
+    while (e->blocking && e->size == e->opts.queue_size && !e->error)
+        SDL_CondWait(e->cond, e->mutex);
+    if (e->size == e->opts.queue_size) {
+        e->nb_dropped++;
+        SDL_UnlockMutex(e->mutex);
+        return 0;
+    }
+    item = &e->queue[(e->rindex + e->size) % e->opts.queue_size];
+    item->pts      = pts;
+    item->duration = duration;
+    item->serial   = serial;
+    if (!(item->frame = av_frame_alloc()) || !(item->mask = av_frame_alloc())) {
+        item_free(item);
+        SDL_UnlockMutex(e->mutex);
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = av_frame_ref(item->frame, frame)) < 0 ||
+        (mask->buf[0] && (ret = av_frame_ref(item->mask, mask)) < 0)) {
+        item_free(item);
+        SDL_UnlockMutex(e->mutex);
+        return ret;
+    }
+    e->size++;
+    SDL_CondBroadcast(e->cond);
+    SDL_UnlockMutex(e->mutex);
+    return 0;
+}
+
+void saliency_encoder_close(SaliencyEncoder **penc)
+{
+    SaliencyEncoder *e = *penc;
+    int i;
+
+    if (!e)
+        return;
+    if (e->tid) {
+        SDL_LockMutex(e->mutex);
+        e->abort_request = 1;
+        SDL_CondBroadcast(e->cond);
+        SDL_UnlockMutex(e->mutex);
+        SDL_WaitThread(e->tid, NULL);
+    }
+    for (i = 0; e->queue && i < e->opts.queue_size; i++)
+        item_free(&e->queue[i]);
+    for (i = 0; i < 2; i++) {
+        avcodec_free_context(&e->enc[i]);
+        av_frame_free(&e->out[i]);
+    }
+    if (e->oc && !(e->oc->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&e->oc->pb);
+    avformat_free_context(e->oc);
+    av_frame_free(&e->scaled_mask);
+    av_packet_free(&e->pkt);
+    sws_freeContext(e->video_ctx);
+    sws_freeContext(e->mask_ctx);
+    SDL_DestroyMutex(e->mutex);
+    SDL_DestroyCond(e->cond);
+    av_freep(&e->queue);
+    av_freep(&e->filename);
+    av_freep(&e->codec_name);
+    av_freep(penc);
+}
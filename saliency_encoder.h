@@ -0,0 +1,58 @@
+/*
+ * Encode pictures and their saliency masks to a file on a thread of its own
+ */
+
+#ifndef SALIENCY_ENCODER_H
+#define SALIENCY_ENCODER_H
+
+#include <stdint.h>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+}
+
+enum SaliencyOutputMode {
+    SALIENCY_OUTPUT_OVERLAY,    /* one video, pixels dimmed where the mask is low */
+    SALIENCY_OUTPUT_ALPHA,      /* one yuva420p video, the mask as alpha plane */
+    SALIENCY_OUTPUT_GRAY,       /* the original video plus the mask as a second video stream */
+};
+
+typedef struct SaliencyEncoderOptions {
+    const char *filename;
+    enum SaliencyOutputMode mode;
+    const char *codec_name;     /* NULL for the default codec of the container */
+    int64_t bit_rate;           /* 0 for the encoder default */
+    int queue_size;             /* pictures waiting for the encoder thread */
+} SaliencyEncoderOptions;
+
+typedef struct SaliencyEncoder SaliencyEncoder;
+
+/**
+ * Start the encoder thread. The output is created with the first picture,
+ * whose size and aspect ratio it keeps.
+ */
+int saliency_encoder_open(SaliencyEncoder **enc, const SaliencyEncoderOptions *opts);
+
+/**
+ * Make saliency_encoder_send wait for the encoder instead of dropping
+ * pictures when the queue is full.
+ */
+void saliency_encoder_set_blocking(SaliencyEncoder *enc, int blocking);
+
+/**
+ * Queue references to a picture and its mask (which may have no data).
+ * pts and duration are in seconds. Output timestamps follow the pictures
+ * within a serial and continue without a gap when the serial changes, so
+ * seeks produce a continuous file.
+ */
+int saliency_encoder_send(SaliencyEncoder *enc, const AVFrame *frame, const AVFrame *mask,
+                          double pts, double duration, int serial);
+
+/**
+ * Encode what is queued, flush the encoders, write the trailer and free
+ * everything.
+ */
+void saliency_encoder_close(SaliencyEncoder **enc);
+
+#endif /* SALIENCY_ENCODER_H */
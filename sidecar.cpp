@@ -0,0 +1,564 @@
+/*
+ * Saliency sidecar: per-frame PoolNet masks stored next to a video
+ *
+ * Writing happens on a thread of its own so that playback never waits on
+ * the disk. Reading maps the index and decodes records with pread,
+ * continuing from the last decoded record when playback is sequential.
+ */
+
+#include "sidecar.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libavutil/pixfmt.h"
+}
+
+#define SIDECAR_QUEUE_SIZE 64
+
+typedef struct SidecarQueueItem {
+    int64_t pts;
+    AVFrame *mask;
+} SidecarQueueItem;
+
+struct Sidecar {
+    std::string path;
+    SidecarHeader header;
+    int reading;
+    int frame_size;
+    std::vector<uint8_t> cur;       /* unpacked mask of the current record */
+    std::vector<uint8_t> diff;
+    std::vector<uint8_t> payload;
+
+    /* reading */
+    int fd = -1;
+    void *map = MAP_FAILED;
+    size_t map_size;
+    const SidecarIndexEntry *index;
+    size_t nb_entries;
+    int64_t cur_offset = -1;        /* record decoded in cur */
+    int64_t cur_key_offset = -1;
+    int64_t next_offset;
+
+    /* writing */
+    FILE *out;
+    std::vector<SidecarIndexEntry> entries;
+    std::vector<uint8_t> prev;
+    int64_t nb_records;
+    uint64_t write_offset;
+    uint64_t key_offset;
+    int error;
+    SDL_Thread *tid;
+    SDL_mutex *mutex;       /* the queue when writing, cur when reading */
+    SDL_cond *cond;
+    SidecarQueueItem queue[SIDECAR_QUEUE_SIZE];
+    int rindex;
+    int size;
+    int abort_request;
+    int blocking;
+    int64_t nb_dropped;
+    int64_t nb_mismatched;  /* masks of another size */
+};
+
+uint64_t sidecar_hash(uint64_t h, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int sidecar_hash_file(uint64_t *h, const char *path)
+{
+    uint8_t buf[65536];
+    size_t n;
+    FILE *f = fopen(path, "rb");
+
+    if (!f)
+        return AVERROR(errno);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        *h = sidecar_hash(*h, buf, n);
+    fclose(f);
+    return 0;
+}
+
+/* PackBits: n < 128 is followed by n + 1 literal bytes, n > 128 by one
+ * byte repeated 257 - n times */
+static void rle_encode(std::vector<uint8_t> &out, const uint8_t *src, int n)
+{
+    int i = 0, start, run, lit;
+
+    out.clear();
+    while (i < n) {
+        run = 1;
+        while (i + run < n && run < 128 && src[i + run] == src[i])
+            run++;
+        if (run >= 2) {
+            out.push_back((uint8_t)(257 - run));
+            out.push_back(src[i]);
+            i += run;
+            continue;
+        }
+        start = i;
+        lit = 0;
+        while (i < n && lit < 128) {
+            if (i + 2 < n && src[i] == src[i + 1] && src[i] == src[i + 2])
+                break;
+            i++;
+            lit++;
+        }
+        out.push_back((uint8_t)(lit - 1));
+        out.insert(out.end(), src + start, src + start + lit);
+    }
+}
+
+static int rle_decode(uint8_t *dst, int n, const uint8_t *src, size_t size)
+{
+    size_t i = 0;
+    int o = 0, len, c;
+
+    while (i < size && o < n) {
+        c = src[i++];
+        if (c < 128) {
+            len = c + 1;
+            if (i + len > size || o + len > n)
+                return AVERROR_INVALIDDATA;
+            memcpy(dst + o, src + i, len);
+            i += len;
+        } else if (c > 128) {
+            len = 257 - c;
+            if (i >= size || o + len > n)
+                return AVERROR_INVALIDDATA;
+            memset(dst + o, src[i++], len);
+        } else {
+            return AVERROR_INVALIDDATA;
+        }
+        o += len;
+    }
+    return o == n ? 0 : AVERROR_INVALIDDATA;
+}
+
+static int header_matches(const SidecarHeader *a, const SidecarHeader *b)
+{
+    return !memcmp(a->magic, b->magic, sizeof(a->magic)) &&
+           a->fingerprint  == b->fingerprint &&
+           a->width        == b->width &&
+           a->height       == b->height &&
+           a->key_interval == b->key_interval;
+}
+
+static int open_reader(Sidecar *sc)
+{
+    std::string index_path = sc->path + ".idx";
+    SidecarHeader header;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(index_path.c_str(), O_RDONLY)) < 0)
+        return AVERROR(errno);
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SidecarHeader)) {
+        close(fd);
+        return AVERROR_INVALIDDATA;
+    }
+    sc->map_size = st.st_size;
+    sc->map = mmap(NULL, sc->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (sc->map == MAP_FAILED)
+        return AVERROR(errno);
+    if (!header_matches((const SidecarHeader *)sc->map, &sc->header)) {
+        av_log(NULL, AV_LOG_INFO, "Sidecar %s is stale\n", sc->path.c_str());
+        return AVERROR_INVALIDDATA;
+    }
+    sc->index = (const SidecarIndexEntry *)((const uint8_t *)sc->map + sizeof(SidecarHeader));
+    sc->nb_entries = (sc->map_size - sizeof(SidecarHeader)) / sizeof(SidecarIndexEntry);
+
+    if ((sc->fd = open(sc->path.c_str(), O_RDONLY)) < 0)
+        return AVERROR(errno);
+    if (pread(sc->fd, &header, sizeof(header), 0) != sizeof(header) ||
+        !header_matches(&header, &sc->header))
+        return AVERROR_INVALIDDATA;
+
+    sc->cur.resize(sc->frame_size);
+    sc->diff.resize(sc->frame_size);
+    if (!(sc->mutex = SDL_CreateMutex()))
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+static void close_reader(Sidecar *sc)
+{
+    if (sc->map != MAP_FAILED)
+        munmap(sc->map, sc->map_size);
+    sc->map = MAP_FAILED;
+    if (sc->fd >= 0)
+        close(sc->fd);
+    sc->fd = -1;
+    SDL_DestroyMutex(sc->mutex);
+    sc->mutex = NULL;
+}
+
+static void write_record(Sidecar *sc, int64_t pts, const AVFrame *mask)
+{
+    SidecarRecordHeader rh;
+    SidecarIndexEntry entry;
+    int y, i;
+
+    /* pack the mask rows */
+    for (y = 0; y < mask->height; y++)
+        memcpy(&sc->cur[y * mask->width], mask->data[0] + y * mask->linesize[0], mask->width);
+
+    rh.pts = pts;
+    rh.key = !(sc->nb_records % sc->header.key_interval);
+    if (rh.key) {
+        rle_encode(sc->payload, sc->cur.data(), sc->frame_size);
+        sc->key_offset = sc->write_offset;
+    } else {
+        for (i = 0; i < sc->frame_size; i++)
+            sc->diff[i] = sc->cur[i] - sc->prev[i];
+        rle_encode(sc->payload, sc->diff.data(), sc->frame_size);
+    }
+    rh.size = sc->payload.size();
+
+    if (fwrite(&rh, sizeof(rh), 1, sc->out) != 1 ||
+        fwrite(sc->payload.data(), 1, rh.size, sc->out) != rh.size) {
+        av_log(NULL, AV_LOG_ERROR, "Could not write sidecar %s\n", sc->path.c_str());
+        sc->error = 1;
+        return;
+    }
+    entry.pts        = pts;
+    entry.offset     = sc->write_offset;
+    entry.key_offset = sc->key_offset;
+    sc->entries.push_back(entry);
+    sc->write_offset += sizeof(rh) + rh.size;
+    sc->nb_records++;
+    sc->prev.swap(sc->cur);
+}
+
+static int writer_thread(void *arg)
+{
+    Sidecar *sc = (Sidecar *)arg;
+    SidecarQueueItem item;
+
+    for (;;) {
+        SDL_LockMutex(sc->mutex);
+        while (!sc->size && !sc->abort_request)
+            SDL_CondWait(sc->cond, sc->mutex);
+        if (!sc->size) {
+            SDL_UnlockMutex(sc->mutex);
+            break;
+        }
+        item = sc->queue[sc->rindex];
+        sc->rindex = (sc->rindex + 1) % SIDECAR_QUEUE_SIZE;
+        sc->size--;
+        SDL_CondBroadcast(sc->cond);
+        SDL_UnlockMutex(sc->mutex);
+
+        if (!sc->error)
+            write_record(sc, item.pts, item.mask);
+        av_frame_free(&item.mask);
+    }
+    return 0;
+}
+
+static int open_writer(Sidecar *sc)
+{
+    if (!(sc->out = fopen(sc->path.c_str(), "wb")))
+        return AVERROR(errno);
+    /* an index left from an earlier recording would describe the old data */
+    unlink((sc->path + ".idx").c_str());
+    if (fwrite(&sc->header, sizeof(sc->header), 1, sc->out) != 1)
+        return AVERROR(EIO);
+    sc->write_offset = sizeof(sc->header);
+    sc->cur.resize(sc->frame_size);
+    sc->prev.resize(sc->frame_size);
+    sc->diff.resize(sc->frame_size);
+
+    if (!(sc->mutex = SDL_CreateMutex()) || !(sc->cond = SDL_CreateCond()))
+        return AVERROR(ENOMEM);
+    if (!(sc->tid = SDL_CreateThread(writer_thread, "sidecar_writer", sc))) {
+        av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+        return AVERROR(ENOMEM);
+    }
+    return 0;
+}
+
+static int write_index(Sidecar *sc)
+{
+    std::string index_path = sc->path + ".idx", tmp_path = index_path + ".tmp";
+    FILE *f;
+
+    std::stable_sort(sc->entries.begin(), sc->entries.end(),
+                     [](const SidecarIndexEntry &a, const SidecarIndexEntry &b) { return a.pts < b.pts; });
+    /* a pts recorded twice, e.g. after seeking back, keeps its first record */
+    sc->entries.erase(std::unique(sc->entries.begin(), sc->entries.end(),
+                                  [](const SidecarIndexEntry &a, const SidecarIndexEntry &b) { return a.pts == b.pts; }),
+                      sc->entries.end());
+
+    if (!(f = fopen(tmp_path.c_str(), "wb")))
+        return AVERROR(errno);
+    if (fwrite(&sc->header, sizeof(sc->header), 1, f) != 1 ||
+        fwrite(sc->entries.data(), sizeof(SidecarIndexEntry), sc->entries.size(), f) != sc->entries.size()) {
+        fclose(f);
+        unlink(tmp_path.c_str());
+        return AVERROR(EIO);
+    }
+    if (fclose(f) || rename(tmp_path.c_str(), index_path.c_str()) < 0)
+        return AVERROR(errno);
+    return 0;
+}
+
+static void close_writer(Sidecar *sc)
+{
+    if (sc->tid) {
+        SDL_LockMutex(sc->mutex);
+        sc->abort_request = 1;
+        SDL_CondSignal(sc->cond);
+        SDL_UnlockMutex(sc->mutex);
+        SDL_WaitThread(sc->tid, NULL);
+    }
+    if (sc->out) {
+        if (fclose(sc->out))
+            sc->error = 1;
+        if (!sc->error && !sc->entries.empty()) {
+            if (write_index(sc) < 0)
+                av_log(NULL, AV_LOG_ERROR, "Could not write the index of sidecar %s\n", sc->path.c_str());
+            else
+                av_log(NULL, AV_LOG_INFO, "Sidecar %s: %d masks, %.1f MB, %" PRId64 " dropped, %" PRId64 " of another size\n",
+                       sc->path.c_str(), (int)sc->entries.size(), sc->write_offset / 1048576.0, sc->nb_dropped,
+                       sc->nb_mismatched);
+        }
+    }
+    SDL_DestroyMutex(sc->mutex);
+    SDL_DestroyCond(sc->cond);
+}
+
+static Sidecar *sidecar_alloc(const char *path, uint64_t fingerprint, int width, int height)
+{
+    Sidecar *sc = new Sidecar();
+
+    sc->path = path;
+    memcpy(sc->header.magic, SIDECAR_MAGIC, sizeof(sc->header.magic));
+    sc->header.fingerprint  = fingerprint;
+    sc->header.width        = width;
+    sc->header.height       = height;
+    sc->header.key_interval = SIDECAR_KEY_INTERVAL;
+    sc->frame_size = width * height;
+    return sc;
+}
+
+static int sidecar_open_reader(Sidecar **psc, const char *path, uint64_t fingerprint, int width, int height)
+{
+    Sidecar *sc = sidecar_alloc(path, fingerprint, width, height);
+    int ret;
+
+    if ((ret = open_reader(sc)) < 0) {
+        close_reader(sc);
+        delete sc;
+        return ret;
+    }
+    sc->reading = 1;
+    *psc = sc;
+    return 0;
+}
+
+int sidecar_open(Sidecar **psc, const char *path, uint64_t fingerprint, int width, int height)
+{
+    Sidecar *sc;
+    int ret;
+
+    if (sidecar_open_reader(psc, path, fingerprint, width, height) >= 0) {
+        av_log(NULL, AV_LOG_INFO, "Reading %d masks from sidecar %s\n", sidecar_nb_entries(*psc), path);
+        return 0;
+    }
+
+    sc = sidecar_alloc(path, fingerprint, width, height);
+
+    if ((ret = open_writer(sc)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Could not open sidecar %s for writing\n", path);
+        close_writer(sc);
+        delete sc;
+        return ret;
+    }
+    av_log(NULL, AV_LOG_INFO, "Recording masks to sidecar %s\n", path);
+    *psc = sc;
+    return 1;
+}
+
+int sidecar_is_complete(const char *path, uint64_t fingerprint, int width, int height)
+{
+    Sidecar *sc;
+
+    if (sidecar_open_reader(&sc, path, fingerprint, width, height) < 0)
+        return 0;
+    sidecar_close(&sc);
+    return 1;
+}
+
+void sidecar_set_blocking(Sidecar *sc, int blocking)
+{
+    sc->blocking = blocking;
+}
+
+int sidecar_is_reading(const Sidecar *sc)
+{
+    return sc->reading;
+}
+
+int sidecar_nb_entries(const Sidecar *sc)
+{
+    return sc->reading ? (int)sc->nb_entries : 0;
+}
+
+int64_t sidecar_entry_pts(const Sidecar *sc, int i)
+{
+    return sc->index[i].pts;
+}
+
+/* decode the record of e into cur and copy it to mask, with the mutex held */
+static int read_record(Sidecar *sc, const SidecarIndexEntry *e, AVFrame *mask)
+{
+    SidecarRecordHeader rh;
+    int64_t pos;
+    int ret, y, i;
+
+    /* continue the difference chain when the last record is on it */
+    if (sc->cur_key_offset == (int64_t)e->key_offset && sc->cur_offset >= 0 &&
+        sc->cur_offset <= (int64_t)e->offset)
+        pos = sc->cur_offset == (int64_t)e->offset ? -1 : sc->next_offset;
+    else
+        pos = e->key_offset;
+
+    while (pos >= 0 && sc->cur_offset != (int64_t)e->offset) {
+        if (pos > (int64_t)e->offset ||
+            pread(sc->fd, &rh, sizeof(rh), pos) != sizeof(rh)) {
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+        sc->payload.resize(rh.size);
+        if (pread(sc->fd, sc->payload.data(), rh.size, pos + sizeof(rh)) != (ssize_t)rh.size) {
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+        if (rh.key) {
+            if ((ret = rle_decode(sc->cur.data(), sc->frame_size, sc->payload.data(), rh.size)) < 0)
+                goto fail;
+            sc->cur_key_offset = pos;
+        } else {
+            if ((ret = rle_decode(sc->diff.data(), sc->frame_size, sc->payload.data(), rh.size)) < 0)
+                goto fail;
+            for (i = 0; i < sc->frame_size; i++)
+                sc->cur[i] += sc->diff[i];
+        }
+        sc->cur_offset = pos;
+        sc->next_offset = pos + sizeof(rh) + rh.size;
+        pos = sc->next_offset;
+    }
+
+    mask->format = AV_PIX_FMT_GRAY8;
+    mask->width  = sc->header.width;
+    mask->height = sc->header.height;
+    if ((ret = av_frame_get_buffer(mask, 0)) < 0)
+        return ret;
+    for (y = 0; y < mask->height; y++)
+        memcpy(mask->data[0] + y * mask->linesize[0], &sc->cur[y * mask->width], mask->width);
+    return 1;
+
+fail:
+    av_log(NULL, AV_LOG_ERROR, "Corrupt record in sidecar %s\n", sc->path.c_str());
+    sc->cur_offset = sc->cur_key_offset = -1;
+    return ret;
+}
+
+int sidecar_read(Sidecar *sc, int64_t pts, AVFrame *mask)
+{
+    const SidecarIndexEntry *e;
+    int ret;
+
+    if (!sc->reading)
+        return 0;
+    e = std::lower_bound(sc->index, sc->index + sc->nb_entries, pts,
+                         [](const SidecarIndexEntry &a, int64_t p) { return a.pts < p; });
+    if (e == sc->index + sc->nb_entries || e->pts != pts)
+        return 0;
+
+    /* the difference chain in cur is shared by the callers */
+    SDL_LockMutex(sc->mutex);
+    ret = read_record(sc, e, mask);
+    SDL_UnlockMutex(sc->mutex);
+    return ret;
+}
+
+int sidecar_write(Sidecar *sc, int64_t pts, const AVFrame *mask)
+{
+    AVFrame *ref;
+    int ret;
+
+    if (sc->reading || sc->error || pts == AV_NOPTS_VALUE)
+        return 0;
+    if (mask->format != AV_PIX_FMT_GRAY8 ||
+        mask->width != (int)sc->header.width || mask->height != (int)sc->header.height) {
+        if (!sc->nb_mismatched++)
+            av_log(NULL, AV_LOG_ERROR, "Sidecar %s holds %ux%u masks, not recording %dx%d ones\n",
+                   sc->path.c_str(), sc->header.width, sc->header.height, mask->width, mask->height);
+        return AVERROR(EINVAL);
+    }
+
+    SDL_LockMutex(sc->mutex);
+    while (sc->blocking && sc->size == SIDECAR_QUEUE_SIZE && !sc->error)
+        SDL_CondWait(sc->cond, sc->mutex);
+    if (sc->size == SIDECAR_QUEUE_SIZE) {
+        sc->nb_dropped++;
+        SDL_UnlockMutex(sc->mutex);
+        return 0;
+    }
+    if (!(ref = av_frame_alloc())) {
+        SDL_UnlockMutex(sc->mutex);
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = av_frame_ref(ref, mask)) < 0) {
+        av_frame_free(&ref);
+        SDL_UnlockMutex(sc->mutex);
+        return ret;
+    }
+    sc->queue[(sc->rindex + sc->size) % SIDECAR_QUEUE_SIZE].pts  = pts;
+    sc->queue[(sc->rindex + sc->size) % SIDECAR_QUEUE_SIZE].mask = ref;
+    sc->size++;
+    SDL_CondBroadcast(sc->cond);
+    SDL_UnlockMutex(sc->mutex);
+    return 0;
+}
+
+void sidecar_close(Sidecar **psc)
+{
+    Sidecar *sc = *psc;
+
+    if (!sc)
+        return;
+    if (sc->reading)
+        close_reader(sc);
+    else
+        close_writer(sc);
+    delete sc;
+    *psc = NULL;
+}
@@ -0,0 +1,111 @@
+/*
+ * Saliency sidecar: per-frame PoolNet masks stored next to a video
+ *
+ * The data file holds a header and one record per mask. A record is the
+ * PackBits RLE of the mask, either as is (key records) or as the byte wise
+ * difference to the previous record. Every SIDECAR_KEY_INTERVAL records
+ * starts a new key record. The index file (data path + ".idx") holds the
+ * same header followed by SidecarIndexEntry sorted by pts. It is written
+ * when the sidecar is closed, so a sidecar without an index is incomplete
+ * and gets recorded again.
+ *
+ * The header carries a fingerprint of the model weights, the network input
+ * size and whatever else changes the masks. A sidecar whose fingerprint
+ * does not match is stale and gets recorded again.
+ */
+
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C"
+{
+#include "libavutil/frame.h"
+}
+
+#define SIDECAR_MAGIC "PNSAL01"
+#define SIDECAR_KEY_INTERVAL 32
+
+typedef struct SidecarHeader {
+    char magic[8];
+    uint64_t fingerprint;
+    uint32_t width;
+    uint32_t height;
+    uint32_t key_interval;
+    uint32_t reserved;
+} SidecarHeader;
+
+typedef struct SidecarRecordHeader {
+    int64_t pts;
+    uint32_t size;          /* payload bytes following the record header */
+    uint32_t key;           /* payload is not a difference to the previous record */
+} SidecarRecordHeader;
+
+typedef struct SidecarIndexEntry {
+    int64_t pts;
+    uint64_t offset;        /* of the record header in the data file */
+    uint64_t key_offset;    /* of the key record its difference chain starts from */
+} SidecarIndexEntry;
+
+typedef struct Sidecar Sidecar;
+
+/**
+ * FNV-1a, continuing from h. Start with SIDECAR_HASH_INIT.
+ */
+#define SIDECAR_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t sidecar_hash(uint64_t h, const void *data, size_t size);
+int sidecar_hash_file(uint64_t *h, const char *path);
+
+/**
+ * Open path for reading if it is a complete sidecar with the given
+ * fingerprint and mask size, otherwise create it for writing.
+ *
+ * @return 0 when reading, 1 when writing, <0 on error
+ */
+int sidecar_open(Sidecar **sc, const char *path, uint64_t fingerprint, int width, int height);
+
+/**
+ * @return 1 if path is a complete sidecar with the given fingerprint and
+ * mask size, without creating anything when it is not
+ */
+int sidecar_is_complete(const char *path, uint64_t fingerprint, int width, int height);
+
+int sidecar_is_reading(const Sidecar *sc);
+
+/**
+ * Make sidecar_write wait for the writer instead of dropping masks, for
+ * offline processing where every mask has to reach the disk.
+ */
+void sidecar_set_blocking(Sidecar *sc, int blocking);
+
+/**
+ * Number of masks of a sidecar opened for reading, and the pts of the i-th
+ * one in increasing order.
+ */
+int sidecar_nb_entries(const Sidecar *sc);
+int64_t sidecar_entry_pts(const Sidecar *sc, int i);
+
+/**
+ * Decode the mask of pts into mask as GRAY8. Safe to call from several
+ * threads, which take turns on the decoding.
+ *
+ * @return 1 when found, 0 when the sidecar has no such pts, <0 on error
+ */
+int sidecar_read(Sidecar *sc, int64_t pts, AVFrame *mask);
+
+/**
+ * Queue a reference to mask for the writer thread. Masks queued while the
+ * writer is behind are dropped.
+ *
+ * @return 0, or AVERROR(EINVAL) for a mask of another size, logged once
+ */
+int sidecar_write(Sidecar *sc, int64_t pts, const AVFrame *mask);
+
+/**
+ * Flush pending writes, write the index and free everything.
+ */
+void sidecar_close(Sidecar **sc);
+
+#endif /* SIDECAR_H */
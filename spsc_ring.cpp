@@ -0,0 +1,158 @@
+/*
+ * Occupancy of a single producer, single consumer ring
+ *
+ * A waiter registers in the waiters count of its futex word, reads the
+ * word, checks the ring and sleeps only if the word did not move. The
+ * other side changes the ring, bumps the word and calls futex_wake if the
+ * count is not zero. All of these are sequentially consistent, so either
+ * the waiter sees the change or the waker sees the waiter.
+ *
+ * Without futexes (not Linux) a waiter polls every millisecond instead.
+ */
+
+#include "spsc_ring.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <new>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <SDL.h>
+
+/* checks before going to sleep, the other side is often just about to
+ * push or pop; only worth it when the other side runs on another core */
+#define SPSC_SPINS 100
+
+static int nb_spins = -1;
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(std::atomic<uint32_t> *word, uint32_t value, int timeout_ms)
+{
+#ifdef __linux__
+    struct timespec ts, *tsp = NULL;
+
+    if (timeout_ms >= 0) {
+        ts.tv_sec  = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, value, tsp, NULL, 0);
+#else
+    if (word->load() == value)
+        SDL_Delay(1);
+#endif
+}
+
+static void futex_wake(std::atomic<uint32_t> *word)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+void spsc_ring_init(SpscRing *r, int capacity)
+{
+    /* value-initialized, every atomic starts at 0 */
+    new (r) SpscRing();
+    r->capacity.store(capacity);
+    if (nb_spins < 0)
+        nb_spins = SDL_GetCPUCount() > 1 ? SPSC_SPINS : 0;
+}
+
+int spsc_ring_wait_writable(SpscRing *r, const volatile int *abort)
+{
+    uint32_t event;
+    int i;
+
+    for (i = 0; i < nb_spins; i++) {
+        if (spsc_ring_size(r) < r->capacity)
+            return *abort ? -1 : 0;
+        cpu_relax();
+    }
+
+    r->space_waiters++;
+    for (;;) {
+        event = r->space_event.load();
+        if (*abort || spsc_ring_size(r) < r->capacity)
+            break;
+        futex_wait(&r->space_event, event, -1);
+    }
+    r->space_waiters--;
+    return *abort ? -1 : 0;
+}
+
+int spsc_ring_wait_readable(SpscRing *r, int min, const volatile int *abort, int timeout_ms)
+{
+    uint32_t event;
+    int64_t deadline = timeout_ms >= 0 ? SDL_GetTicks() + timeout_ms : 0;
+    int ret = 0, i;
+
+    for (i = 0; i < nb_spins; i++) {
+        if (spsc_ring_size(r) > min)
+            return *abort ? -1 : 0;
+        cpu_relax();
+    }
+
+    r->data_waiters++;
+    for (;;) {
+        int64_t left = -1;
+
+        event = r->data_event.load();
+        if (*abort || spsc_ring_size(r) > min)
+            break;
+        if (timeout_ms >= 0 && (left = deadline - (int64_t)SDL_GetTicks()) <= 0) {
+            ret = 1;
+            break;
+        }
+        futex_wait(&r->data_event, event, (int)left);
+    }
+    r->data_waiters--;
+    return *abort ? -1 : ret;
+}
+
+void spsc_ring_set_capacity(SpscRing *r, int capacity)
+{
+    r->capacity = capacity;
+    r->space_event++;
+    if (r->space_waiters.load())
+        futex_wake(&r->space_event);
+}
+
+void spsc_ring_push(SpscRing *r)
+{
+    r->pushed++;
+    r->data_event++;
+    if (r->data_waiters.load())
+        futex_wake(&r->data_event);
+}
+
+void spsc_ring_pop(SpscRing *r)
+{
+    r->popped++;
+    r->space_event++;
+    if (r->space_waiters.load())
+        futex_wake(&r->space_event);
+}
+
+void spsc_ring_wake(SpscRing *r)
+{
+    r->data_event++;
+    r->space_event++;
+    futex_wake(&r->data_event);
+    futex_wake(&r->space_event);
+}
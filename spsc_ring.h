@@ -0,0 +1,88 @@
+/*
+ * Occupancy of a single producer, single consumer ring
+ *
+ * The ring only counts: the producer owns the write index and the slots
+ * it fills, the consumer the read index and the slots it drains, as in
+ * FrameQueue. The two counters are a cache line apart and are updated
+ * without a lock. The padding keeps them apart without alignas, which
+ * av_mallocz, where FrameQueue lives, does not honour. A side that finds the ring full or empty
+ * sleeps on a futex and is woken by the next push or pop, which only
+ * makes a system call when somebody sleeps.
+ *
+ * Producer (or consumer) calls may come from different threads as long as
+ * something else orders them, e.g. the replicas of the inference stage
+ * that take turns under infer_mutex.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct SpscRing {
+    std::atomic<uint32_t> pushed;   /* written by the producer */
+    char pad0[SPSC_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> popped;   /* written by the consumer */
+    char pad1[SPSC_CACHE_LINE - sizeof(std::atomic<uint32_t>)];
+    /* futex words, bumped on every event the other side may wait for */
+    std::atomic<uint32_t> data_event;
+    std::atomic<uint32_t> data_waiters;
+    char pad2[SPSC_CACHE_LINE - 2 * sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> space_event;
+    std::atomic<uint32_t> space_waiters;
+    char pad3[SPSC_CACHE_LINE - 2 * sizeof(std::atomic<uint32_t>)];
+    std::atomic<int> capacity;
+} SpscRing;
+
+/**
+ * Construct the ring in place, also in memory that was only zeroed or
+ * never initialized.
+ */
+void spsc_ring_init(SpscRing *r, int capacity);
+
+/**
+ * @return the number of pushed and not yet popped slots
+ */
+static inline int spsc_ring_size(const SpscRing *r)
+{
+    return (int)(r->pushed.load() - r->popped.load());
+}
+
+/**
+ * Wait until fewer than capacity slots are in use, or *abort is set.
+ * Producer side.
+ *
+ * @return 0, or -1 on abort
+ */
+int spsc_ring_wait_writable(SpscRing *r, const volatile int *abort);
+
+/**
+ * Wait until more than min slots are in use, or *abort is set, at most
+ * timeout_ms milliseconds when it is not negative. Consumer side.
+ *
+ * @return 0, -1 on abort, 1 on timeout
+ */
+int spsc_ring_wait_readable(SpscRing *r, int min, const volatile int *abort, int timeout_ms);
+
+/**
+ * Change how many slots the producer may fill. Slots already in use above
+ * a lower capacity stay until the consumer pops them.
+ */
+void spsc_ring_set_capacity(SpscRing *r, int capacity);
+
+/* publish the slot the producer filled */
+void spsc_ring_push(SpscRing *r);
+
+/* release the oldest slot back to the producer */
+void spsc_ring_pop(SpscRing *r);
+
+/**
+ * Wake both sides, e.g. after setting the abort flag they check.
+ */
+void spsc_ring_wake(SpscRing *r);
+
+#endif /* SPSC_RING_H */
@@ -0,0 +1,258 @@
+/*
+ * frame_queue_bench: the lock-free SpscRing against the SDL_mutex/SDL_cond
+ * queue FrameQueue used before.
+ *
+ * Frames cross a chain of queues, one thread per stage like
+ * decoder -> infq -> inference -> pictq -> display. Each implementation
+ * prints one JSON line (or CSV row) with the throughput, the p50/p99 time a
+ * frame takes through the chain and the context switches of the process.
+ */
+
+#include "../spsc_ring.h"
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define MAX_CAPACITY 16
+
+struct BenchOptions {
+    int stages = 2;
+    int capacity = 3;
+    int frames = 200000;
+    int work_us = 0;
+    bool csv = false;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+/* what a Frame carries here: its index and when it entered the chain */
+struct Item {
+    int index;
+    Clock::time_point start;
+};
+
+/* the queue logic of FrameQueue before SpscRing */
+struct MutexQueue {
+    Item queue[MAX_CAPACITY];
+    int rindex = 0, windex = 0, size = 0, max_size = 0;
+    SDL_mutex *mutex = nullptr;
+    SDL_cond *cond = nullptr;
+
+    Item *peek_writable() {
+        SDL_LockMutex(mutex);
+        while (size >= max_size)
+            SDL_CondWait(cond, mutex);
+        SDL_UnlockMutex(mutex);
+        return &queue[windex];
+    }
+    void push() {
+        if (++windex == max_size)
+            windex = 0;
+        SDL_LockMutex(mutex);
+        size++;
+        SDL_CondSignal(cond);
+        SDL_UnlockMutex(mutex);
+    }
+    Item *peek_readable() {
+        SDL_LockMutex(mutex);
+        while (size <= 0)
+            SDL_CondWait(cond, mutex);
+        SDL_UnlockMutex(mutex);
+        return &queue[rindex];
+    }
+    void next() {
+        if (++rindex == max_size)
+            rindex = 0;
+        SDL_LockMutex(mutex);
+        size--;
+        SDL_CondSignal(cond);
+        SDL_UnlockMutex(mutex);
+    }
+};
+
+struct RingQueue {
+    Item queue[MAX_CAPACITY];
+    SpscRing ring;
+    int rindex = 0, windex = 0, max_size = 0;
+    volatile int abort = 0;
+
+    Item *peek_writable() {
+        spsc_ring_wait_writable(&ring, &abort);
+        return &queue[windex];
+    }
+    void push() {
+        if (++windex == max_size)
+            windex = 0;
+        spsc_ring_push(&ring);
+    }
+    Item *peek_readable() {
+        spsc_ring_wait_readable(&ring, 0, &abort, -1);
+        return &queue[rindex];
+    }
+    void next() {
+        if (++rindex == max_size)
+            rindex = 0;
+        spsc_ring_pop(&ring);
+    }
+};
+
+static void show_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --stages n        queues in the chain (default 2, infq and pictq)\n"
+            "  --capacity n      frames per queue, at most %d (default 3)\n"
+            "  --frames n        frames sent through (default 200000)\n"
+            "  --work us         busy time per frame in every middle stage (default 0)\n"
+            "  --csv             print CSV instead of JSON lines\n", prog, MAX_CAPACITY);
+}
+
+static int parse_options(int argc, char **argv, BenchOptions& o) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (!strcmp(opt, "--csv")) {
+            o.csv = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            show_usage(argv[0]);
+            return -1;
+        }
+        const char *arg = argv[++i];
+        if (!strcmp(opt, "--stages")) {
+            o.stages = std::max(atoi(arg), 1);
+        } else if (!strcmp(opt, "--capacity")) {
+            o.capacity = std::min(std::max(atoi(arg), 1), MAX_CAPACITY);
+        } else if (!strcmp(opt, "--frames")) {
+            o.frames = std::max(atoi(arg), 1);
+        } else if (!strcmp(opt, "--work")) {
+            o.work_us = std::max(atoi(arg), 0);
+        } else {
+            show_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double percentile(const std::vector<double>& sorted, double q) {
+    size_t idx = (size_t)std::ceil(q * sorted.size());
+    return sorted[std::min(sorted.size() - 1, idx ? idx - 1 : 0)];
+}
+
+static long context_switches() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void spin(int us) {
+    auto end = Clock::now() + std::chrono::microseconds(us);
+    while (us > 0 && Clock::now() < end)
+        ;
+}
+
+/* frames through o.stages queues of type Q, latencies in microseconds */
+template <typename Q>
+static double run_chain(std::vector<Q>& queues, const BenchOptions& o, std::vector<double>& latency) {
+    std::vector<std::thread> threads;
+    auto begin = Clock::now();
+
+    threads.emplace_back([&] {
+        for (int i = 0; i < o.frames; i++) {
+            Item *it = queues[0].peek_writable();
+            it->index = i;
+            it->start = Clock::now();
+            queues[0].push();
+        }
+    });
+    for (int s = 1; s < o.stages; s++) {
+        threads.emplace_back([&, s] {
+            for (int i = 0; i < o.frames; i++) {
+                Item in = *queues[s - 1].peek_readable();
+                queues[s - 1].next();
+                spin(o.work_us);
+                *queues[s].peek_writable() = in;
+                queues[s].push();
+            }
+        });
+    }
+    latency.resize(o.frames);
+    for (int i = 0; i < o.frames; i++) {
+        Item *it = queues[o.stages - 1].peek_readable();
+        latency[i] = std::chrono::duration<double, std::micro>(Clock::now() - it->start).count();
+        queues[o.stages - 1].next();
+    }
+    for (auto& t : threads)
+        t.join();
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+static void report(const char *impl, const BenchOptions& o, double wall_ms,
+                   std::vector<double>& latency, long switches) {
+    std::sort(latency.begin(), latency.end());
+    double p50 = percentile(latency, 0.50), p99 = percentile(latency, 0.99);
+    double fps = wall_ms > 0 ? 1000.0 * o.frames / wall_ms : 0.0;
+
+    if (o.csv)
+        printf("%s,%d,%d,%d,%d,%.1f,%.0f,%.2f,%.2f,%ld\n",
+               impl, o.stages, o.capacity, o.frames, o.work_us, wall_ms, fps, p50, p99, switches);
+    else
+        printf("{\"impl\":\"%s\",\"stages\":%d,\"capacity\":%d,\"frames\":%d,\"work_us\":%d,"
+               "\"wall_ms\":%.1f,\"fps\":%.0f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"context_switches\":%ld}\n",
+               impl, o.stages, o.capacity, o.frames, o.work_us, wall_ms, fps, p50, p99, switches);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    BenchOptions o;
+    std::vector<double> latency;
+    double wall_ms;
+    long switches;
+
+    if (parse_options(argc, argv, o) < 0)
+        return 1;
+    if (o.csv)
+        printf("impl,stages,capacity,frames,work_us,wall_ms,fps,p50_us,p99_us,context_switches\n");
+
+    {
+        std::vector<MutexQueue> queues(o.stages);
+        for (auto& q : queues) {
+            q.max_size = o.capacity;
+            q.mutex = SDL_CreateMutex();
+            q.cond = SDL_CreateCond();
+            if (!q.mutex || !q.cond) {
+                fprintf(stderr, "SDL_CreateMutex/SDL_CreateCond failed: %s\n", SDL_GetError());
+                return 1;
+            }
+        }
+        switches = context_switches();
+        wall_ms = run_chain(queues, o, latency);
+        report("mutex", o, wall_ms, latency, context_switches() - switches);
+        for (auto& q : queues) {
+            SDL_DestroyMutex(q.mutex);
+            SDL_DestroyCond(q.cond);
+        }
+    }
+    {
+        std::vector<RingQueue> queues(o.stages);
+        for (auto& q : queues) {
+            q.max_size = o.capacity;
+            spsc_ring_init(&q.ring, o.capacity);
+        }
+        switches = context_switches();
+        wall_ms = run_chain(queues, o, latency);
+        report("spsc", o, wall_ms, latency, context_switches() - switches);
+    }
+    return 0;
+}
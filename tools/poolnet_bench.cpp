@@ -0,0 +1,218 @@
+/*
+ * poolnet_bench: time PoolNet forward on the CPU without SDL, FFmpeg or a video.
+ *
+ * Runs every combination of input size, thread count, precision and batch
+ * size, and prints one JSON object (or CSV row) per combination with
+ * p50/p95/p99 latency, throughput, peak RSS and weight load time.
+ */
+
+#include "../networks/poolnet.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+    std::string model;
+    std::vector<std::pair<int64_t, int64_t>> sizes = { { 300, 400 } };
+    std::vector<int> threads;
+    std::vector<std::string> precisions = { "fp32" };
+    std::vector<int> batches = { 1 };
+    int warmup = 5;
+    int iters = 30;
+    bool csv = false;
+};
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    size_t pos = 0, next;
+    while ((next = s.find(sep, pos)) != std::string::npos) {
+        out.push_back(s.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    out.push_back(s.substr(pos));
+    return out;
+}
+
+static std::vector<int> parse_ints(const char *arg) {
+    std::vector<int> out;
+    for (const auto& v : split(arg, ','))
+        out.push_back(atoi(v.c_str()));
+    return out;
+}
+
+static void show_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --model path      weights saved with torch::save (random weights if omitted)\n"
+            "  --sizes WxH,...   input sizes (default 300x400)\n"
+            "  --threads n,...   intra-op thread counts (default at::get_num_threads())\n"
+            "  --precision p,... fp32, bf16 (default fp32)\n"
+            "  --batch n,...     batch sizes (default 1)\n"
+            "  --warmup n        untimed iterations per combination (default 5)\n"
+            "  --iters n         timed iterations per combination (default 30)\n"
+            "  --csv             print CSV instead of JSON lines\n", prog);
+}
+
+static int parse_options(int argc, char **argv, BenchOptions& o) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (!strcmp(opt, "--csv")) {
+            o.csv = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            show_usage(argv[0]);
+            return -1;
+        }
+        const char *arg = argv[++i];
+        if (!strcmp(opt, "--model")) {
+            o.model = arg;
+        } else if (!strcmp(opt, "--sizes")) {
+            o.sizes.clear();
+            for (const auto& v : split(arg, ',')) {
+                int w, h;
+                if (sscanf(v.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                    fprintf(stderr, "Invalid size '%s'\n", v.c_str());
+                    return -1;
+                }
+                o.sizes.push_back({ w, h });
+            }
+        } else if (!strcmp(opt, "--threads")) {
+            o.threads = parse_ints(arg);
+        } else if (!strcmp(opt, "--precision")) {
+            o.precisions = split(arg, ',');
+        } else if (!strcmp(opt, "--batch")) {
+            o.batches = parse_ints(arg);
+        } else if (!strcmp(opt, "--warmup")) {
+            o.warmup = atoi(arg);
+        } else if (!strcmp(opt, "--iters")) {
+            o.iters = std::max(atoi(arg), 1);
+        } else {
+            show_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double peak_rss_mb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;
+}
+
+static double percentile(const std::vector<double>& sorted, double q) {
+    size_t idx = (size_t)std::ceil(q * sorted.size());
+    return sorted[std::min(sorted.size() - 1, idx ? idx - 1 : 0)];
+}
+
+static torch::Dtype parse_precision(const std::string& p) {
+    return p == "bf16" ? torch::kBFloat16 : torch::kFloat;
+}
+
+/* Build PoolNet in eval mode on the CPU, return the load time in ms */
+static double load_net(PoolNet& net, const std::string& model, torch::Dtype dtype) {
+    auto start = std::chrono::steady_clock::now();
+    net = PoolNet();
+    if (!model.empty())
+        torch::load(net, model);
+    net->to(torch::kCPU, dtype);
+    net->eval();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int main(int argc, char **argv) {
+    BenchOptions o;
+    if (parse_options(argc, argv, o) < 0)
+        return 1;
+    if (o.threads.empty())
+        o.threads.push_back(at::get_num_threads());
+
+    torch::NoGradGuard no_grad;
+    torch::manual_seed(0);
+
+    if (o.csv)
+        printf("width,height,threads,precision,batch,warmup,iters,"
+               "p50_ms,p95_ms,p99_ms,mean_ms,fps,peak_rss_mb,load_ms,error\n");
+
+    for (const auto& precision : o.precisions) {
+        if (precision != "fp32" && precision != "bf16") {
+            fprintf(stderr, "Unknown precision '%s'\n", precision.c_str());
+            return 1;
+        }
+        torch::Dtype dtype = parse_precision(precision);
+        PoolNet net(nullptr);
+        double load_ms = load_net(net, o.model, dtype);
+
+        for (const auto& size : o.sizes)
+        for (int threads : o.threads)
+        for (int batch : o.batches) {
+            std::vector<double> samples;
+            std::string error;
+            double wall_ms = 0.0;
+
+            torch::set_num_threads(threads);
+            /* same layout as the player: { N, 3, H, W } float in 0..255 */
+            torch::Tensor x = torch::rand({ batch, 3, size.second, size.first }).mul_(255.0).to(dtype);
+            try {
+                for (int i = 0; i < o.warmup; i++)
+                    net->forward(x);
+                auto begin = std::chrono::steady_clock::now();
+                for (int i = 0; i < o.iters; i++) {
+                    auto start = std::chrono::steady_clock::now();
+                    torch::Tensor out = net->forward(x);
+                    out.sigmoid_();
+                    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                    samples.push_back(elapsed.count());
+                }
+                std::chrono::duration<double, std::milli> wall = std::chrono::steady_clock::now() - begin;
+                wall_ms = wall.count();
+            } catch (const c10::Error& e) {
+                error = e.what_without_backtrace();
+                std::replace(error.begin(), error.end(), '"', '\'');
+                std::replace(error.begin(), error.end(), '\n', ' ');
+                std::replace(error.begin(), error.end(), ',', ';');
+            }
+
+            double p50 = 0, p95 = 0, p99 = 0, mean = 0, fps = 0;
+            if (error.empty()) {
+                std::sort(samples.begin(), samples.end());
+                p50 = percentile(samples, 0.50);
+                p95 = percentile(samples, 0.95);
+                p99 = percentile(samples, 0.99);
+                for (double s : samples)
+                    mean += s;
+                mean /= samples.size();
+                fps = wall_ms > 0 ? 1000.0 * batch * samples.size() / wall_ms : 0.0;
+            }
+
+            if (o.csv) {
+                printf("%" PRId64 ",%" PRId64 ",%d,%s,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.2f,%.1f,%.1f,%s\n",
+                       size.first, size.second, threads, precision.c_str(), batch, o.warmup, o.iters,
+                       p50, p95, p99, mean, fps, peak_rss_mb(), load_ms, error.c_str());
+            } else {
+                printf("{\"width\":%" PRId64 ",\"height\":%" PRId64 ",\"threads\":%d,\"precision\":\"%s\","
+                       "\"batch\":%d,\"warmup\":%d,\"iters\":%d,",
+                       size.first, size.second, threads, precision.c_str(), batch, o.warmup, o.iters);
+                if (error.empty())
+                    printf("\"p50_ms\":%.3f,\"p95_ms\":%.3f,\"p99_ms\":%.3f,\"mean_ms\":%.3f,\"fps\":%.2f,",
+                           p50, p95, p99, mean, fps);
+                else
+                    printf("\"error\":\"%s\",", error.c_str());
+                printf("\"peak_rss_mb\":%.1f,\"load_ms\":%.1f}\n", peak_rss_mb(), load_ms);
+            }
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * poolnet_compare: check an optimized PoolNet path against the eager module.
+ *
+ * Runs the reference PoolNet and one variant on the same input frames,
+ * compares every intermediate feature map the variant exposes and the final
+ * masks, and exits with status 1 when a threshold is exceeded. CPU only, no
+ * SDL or FFmpeg needed.
+ *
+ * Frames come from a raw RGB24 file holding back to back WxH frames, e.g.
+ *   ffmpeg -i test.mp4 -vf scale=300:400 -frames:v 16 -pix_fmt rgb24 -f rawvideo frames.rgb
+ * or, without --frames, from a fixed seeded set of synthetic frames.
+ */
+
+#include "../networks/poolnet.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <torch/script.h>
+
+struct CompareOptions {
+    std::string model;
+    std::string jit_model;
+    std::string frames;
+    std::string variant = "eager";
+    int64_t width = 300;
+    int64_t height = 400;
+    int count = 8;
+    int threads = 0;
+    double max_rel = 1e-4;      // intermediates: max |a - b| / max |ref|
+    double max_abs = 1e-3;      // final mask in [0, 1]
+    double max_mae = 1e-4;
+    double min_fmeasure = 0.99;
+};
+
+/* An optimized path under test. run() returns the score logits { N, 1, H, W }
+ * as float and fills trace when the variant can expose intermediates. */
+struct Variant {
+    std::function<torch::Tensor(torch::Tensor, FeatureTrace *)> run;
+    bool has_trace;
+};
+
+static void show_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --variant name    eager, bf16, threads or jit (default eager)\n"
+            "  --model path      weights saved with torch::save (seeded random weights if omitted)\n"
+            "  --jit path        traced model for the jit variant\n"
+            "  --frames path     raw rgb24 file of WxH frames (synthetic frames if omitted)\n"
+            "  --size WxH        frame size (default 300x400)\n"
+            "  --count n         number of frames (default 8)\n"
+            "  --threads n       intra-op threads of the threads variant\n"
+            "  --max-rel x       max relative error of intermediates (default 1e-4)\n"
+            "  --max-abs x       max abs error of the mask in [0,1] (default 1e-3)\n"
+            "  --max-mae x       max mean abs error of the mask (default 1e-4)\n"
+            "  --min-f x         min F-measure of the binarized mask (default 0.99)\n", prog);
+}
+
+static int parse_options(int argc, char **argv, CompareOptions& o) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        if (i + 1 >= argc) {
+            show_usage(argv[0]);
+            return -1;
+        }
+        const char *arg = argv[++i];
+        if (!strcmp(opt, "--variant")) {
+            o.variant = arg;
+        } else if (!strcmp(opt, "--model")) {
+            o.model = arg;
+        } else if (!strcmp(opt, "--jit")) {
+            o.jit_model = arg;
+        } else if (!strcmp(opt, "--frames")) {
+            o.frames = arg;
+        } else if (!strcmp(opt, "--size")) {
+            int w, h;
+            if (sscanf(arg, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                fprintf(stderr, "Invalid size '%s'\n", arg);
+                return -1;
+            }
+            o.width = w;
+            o.height = h;
+        } else if (!strcmp(opt, "--count")) {
+            o.count = std::max(atoi(arg), 1);
+        } else if (!strcmp(opt, "--threads")) {
+            o.threads = atoi(arg);
+        } else if (!strcmp(opt, "--max-rel")) {
+            o.max_rel = atof(arg);
+        } else if (!strcmp(opt, "--max-abs")) {
+            o.max_abs = atof(arg);
+        } else if (!strcmp(opt, "--max-mae")) {
+            o.max_mae = atof(arg);
+        } else if (!strcmp(opt, "--min-f")) {
+            o.min_fmeasure = atof(arg);
+        } else {
+            show_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Frames as the player feeds them: { 1, 3, H, W } float in 0..255 */
+static std::vector<torch::Tensor> load_frames(const CompareOptions& o) {
+    std::vector<torch::Tensor> frames;
+    if (o.frames.empty()) {
+        torch::manual_seed(1);
+        for (int i = 0; i < o.count; i++) {
+            /* low frequency noise looks more like a picture than white noise */
+            torch::Tensor small = torch::rand({ 1, 3, o.height / 16 + 1, o.width / 16 + 1 }).mul_(255.0);
+            frames.push_back(torch::nn::functional::interpolate(
+                small, torch::nn::functional::InterpolateFuncOptions()
+                           .size(std::vector<int64_t>({ o.height, o.width }))
+                           .mode(torch::kBilinear)
+                           .align_corners(true)).round_());
+        }
+        return frames;
+    }
+
+    FILE *f = fopen(o.frames.c_str(), "rb");
+    if (!f) {
+        fprintf(stderr, "Could not open %s\n", o.frames.c_str());
+        return frames;
+    }
+    std::vector<uint8_t> buf(o.width * o.height * 3);
+    for (int i = 0; i < o.count; i++) {
+        if (fread(buf.data(), 1, buf.size(), f) != buf.size())
+            break;
+        frames.push_back(torch::from_blob(buf.data(), { 1, o.height, o.width, 3 }, torch::kByte)
+                             .permute({ 0, 3, 1, 2 })
+                             .toType(torch::kFloat));
+    }
+    fclose(f);
+    return frames;
+}
+
+static void copy_weights(PoolNet& dst, PoolNet& src) {
+    auto params = src->named_parameters(/*recurse=*/true);
+    for (auto& p : dst->named_parameters(/*recurse=*/true))
+        p.value().copy_(params[p.key()]);
+    auto buffers = src->named_buffers(/*recurse=*/true);
+    for (auto& b : dst->named_buffers(/*recurse=*/true))
+        b.value().copy_(buffers[b.key()]);
+}
+
+static int make_variant(const CompareOptions& o, PoolNet& ref, Variant& v) {
+    if (o.variant == "eager") {
+        /* a second eager instance, checks determinism of the reference */
+        PoolNet net;
+        copy_weights(net, ref);
+        net->eval();
+        v.has_trace = true;
+        v.run = [net](torch::Tensor x, FeatureTrace *trace) mutable { return net->forward(x, trace); };
+    } else if (o.variant == "bf16") {
+        PoolNet net;
+        copy_weights(net, ref);
+        net->to(torch::kBFloat16);
+        net->eval();
+        v.has_trace = true;
+        v.run = [net](torch::Tensor x, FeatureTrace *trace) mutable {
+            torch::Tensor y = net->forward(x.to(torch::kBFloat16), trace);
+            if (trace)
+                for (auto& t : *trace)
+                    t.second = t.second.to(torch::kFloat);
+            return y.to(torch::kFloat);
+        };
+    } else if (o.variant == "threads") {
+        if (o.threads <= 0) {
+            fprintf(stderr, "The threads variant needs --threads\n");
+            return -1;
+        }
+        int threads = o.threads, ref_threads = at::get_num_threads();
+        v.has_trace = true;
+        v.run = [ref, threads, ref_threads](torch::Tensor x, FeatureTrace *trace) mutable {
+            torch::set_num_threads(threads);
+            torch::Tensor y = ref->forward(x, trace);
+            torch::set_num_threads(ref_threads);
+            return y;
+        };
+    } else if (o.variant == "jit") {
+        if (o.jit_model.empty()) {
+            fprintf(stderr, "The jit variant needs --jit\n");
+            return -1;
+        }
+        auto module = std::make_shared<torch::jit::Module>(torch::jit::load(o.jit_model));
+        module->eval();
+        v.has_trace = false;
+        v.run = [module](torch::Tensor x, FeatureTrace *) {
+            return module->forward({ x }).toTensor();
+        };
+    } else {
+        fprintf(stderr, "Unknown variant '%s'\n", o.variant.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/* F-measure with beta^2 = 0.3 of pred against ref, both binarized at 0.5 */
+static double fmeasure(const torch::Tensor& pred, const torch::Tensor& ref) {
+    const double beta2 = 0.3;
+    torch::Tensor p = pred > 0.5, g = ref > 0.5;
+    double tp = (p & g).sum().item<double>();
+    double np = p.sum().item<double>(), ng = g.sum().item<double>();
+    if (np == 0 && ng == 0)
+        return 1.0;
+    double precision = np > 0 ? tp / np : 0.0;
+    double recall = ng > 0 ? tp / ng : 0.0;
+    if (precision + recall == 0)
+        return 0.0;
+    return (1 + beta2) * precision * recall / (beta2 * precision + recall);
+}
+
+struct Worst {
+    double rel = 0.0, abs = 0.0, mae = 0.0, f = 1.0;
+};
+
+int main(int argc, char **argv) {
+    CompareOptions o;
+    if (parse_options(argc, argv, o) < 0)
+        return 2;
+
+    torch::NoGradGuard no_grad;
+    torch::manual_seed(0);
+
+    PoolNet ref;
+    if (!o.model.empty())
+        torch::load(ref, o.model);
+    ref->to(torch::kCPU);
+    ref->eval();
+
+    Variant variant;
+    if (make_variant(o, ref, variant) < 0)
+        return 2;
+
+    std::vector<torch::Tensor> frames = load_frames(o);
+    if (frames.empty()) {
+        fprintf(stderr, "No input frames\n");
+        return 2;
+    }
+
+    std::vector<std::string> order;
+    std::map<std::string, Worst> worst;
+    Worst mask;
+    for (size_t n = 0; n < frames.size(); n++) {
+        FeatureTrace ref_trace, var_trace;
+        torch::Tensor a = ref->forward(frames[n], &ref_trace);
+        torch::Tensor b = variant.run(frames[n], variant.has_trace ? &var_trace : nullptr);
+
+        for (size_t i = 0; i < ref_trace.size() && i < var_trace.size(); i++) {
+            const std::string& name = ref_trace[i].first;
+            torch::Tensor r = ref_trace[i].second, d = (var_trace[i].second - r).abs();
+            double scale = std::max(r.abs().max().item<double>(), 1e-12);
+            Worst& w = worst[name];
+            if (!n)
+                order.push_back(name);
+            w.abs = std::max(w.abs, d.max().item<double>());
+            w.rel = std::max(w.rel, d.max().item<double>() / scale);
+            w.mae = std::max(w.mae, d.mean().item<double>());
+        }
+
+        /* the player shows sigmoid(score) */
+        torch::Tensor ma = a.sigmoid(), mb = b.sigmoid(), d = (mb - ma).abs();
+        mask.abs = std::max(mask.abs, d.max().item<double>());
+        mask.mae = std::max(mask.mae, d.mean().item<double>());
+        mask.f = std::min(mask.f, fmeasure(mb, ma));
+    }
+
+    int failed = 0;
+    printf("variant %s, %d frames of %" PRId64 "x%" PRId64 "\n",
+           o.variant.c_str(), (int)frames.size(), o.width, o.height);
+    printf("%-24s %12s %12s %12s\n", "module", "max abs", "max rel", "mae");
+    for (const auto& name : order) {
+        const Worst& w = worst[name];
+        bool bad = w.rel > o.max_rel;
+        failed |= bad;
+        printf("%-24s %12.3e %12.3e %12.3e%s\n", name.c_str(), w.abs, w.rel, w.mae, bad ? "  FAIL" : "");
+    }
+    bool bad = mask.abs > o.max_abs || mask.mae > o.max_mae || mask.f < o.min_fmeasure;
+    failed |= bad;
+    printf("%-24s %12.3e %12s %12.3e  F=%.5f%s\n", "mask", mask.abs, "-", mask.mae, mask.f, bad ? "  FAIL" : "");
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
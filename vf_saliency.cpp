@@ -0,0 +1,612 @@
+/*
+ * "saliency" video filter: PoolNet inside the -vf filtergraph
+ *
+ * Only the public libavfilter API is used, so the player links against
+ * the shared libraries. The preprocessing is split into slices over
+ * threads of the pipeline, the forward pass itself runs on the torch
+ * intra-op threads.
+ */
+
+#include "vf_saliency.h"
+
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_thread.h>
+
+extern "C"
+{
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+}
+
+#define MAX_SLICE_THREADS 16
+
+enum SaliencyOutput {
+    SALIENCY_SIDE,      /* picture with the mask attached */
+    SALIENCY_GRAY,      /* the mask as the picture */
+};
+
+typedef struct SaliencyContext {
+    const AVClass *av_class;
+    int width, height;
+    int fit;
+    int output;
+
+    SaliencyFilterConfig config;
+    PreprocessContext **pre;    /* one per slice job */
+    int nb_pre;
+    float *input;
+    uint8_t *out;
+    int input_w, input_h;       /* size input and out were allocated for */
+} SaliencyContext;
+
+typedef int (*SliceFunc)(void *arg, int jobnr, int nb_jobs);
+
+/* the calling thread and nb_threads workers share the jobs of a call */
+typedef struct SliceThreads {
+    SDL_Thread *tids[MAX_SLICE_THREADS];
+    int nb_threads;
+    SDL_mutex *mutex;
+    SDL_cond *work_cond;
+    SDL_cond *done_cond;
+    SliceFunc func;
+    void *arg;
+    int *rets;
+    int nb_jobs, next_job, nb_done;
+    int abort_request;
+} SliceThreads;
+
+/* a piece of the chain from a buffer source to a buffersink, and the
+ * saliency entry run on what comes out of it */
+typedef struct SaliencyStage {
+    AVFilterGraph *graph;
+    AVFilterContext *src, *sink;
+    SaliencyContext s;
+    int eof;                    /* sink returned EOF, passed on */
+} SaliencyStage;
+
+struct SaliencyPipeline {
+    SaliencyStage *stages;
+    int nb_stages;
+    SliceThreads threads;
+    AVFrame *frame;
+};
+
+typedef struct SliceData {
+    SaliencyContext *s;
+    const AVFrame *in;
+    const PreprocessParams *params;
+} SliceData;
+
+#define OFFSET(x) offsetof(SaliencyContext, x)
+#define FLAGS AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_FILTERING_PARAM
+
+static const AVOption saliency_options[] = {
+    { "size",   "network input size", OFFSET(width), AV_OPT_TYPE_IMAGE_SIZE, { .str = NULL }, 0, 0, FLAGS },
+    { "fit",    "how the picture fits the input", OFFSET(fit), AV_OPT_TYPE_INT, { .i64 = PREPROCESS_FIT_STRETCH }, 0, PREPROCESS_FIT_CROP, FLAGS, "fit" },
+        { "stretch",   NULL, 0, AV_OPT_TYPE_CONST, { .i64 = PREPROCESS_FIT_STRETCH },   0, 0, FLAGS, "fit" },
+        { "letterbox", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = PREPROCESS_FIT_LETTERBOX }, 0, 0, FLAGS, "fit" },
+        { "crop",      NULL, 0, AV_OPT_TYPE_CONST, { .i64 = PREPROCESS_FIT_CROP },      0, 0, FLAGS, "fit" },
+    { "output", "what to output", OFFSET(output), AV_OPT_TYPE_INT, { .i64 = SALIENCY_SIDE }, 0, SALIENCY_GRAY, FLAGS, "output" },
+        { "side",      NULL, 0, AV_OPT_TYPE_CONST, { .i64 = SALIENCY_SIDE }, 0, 0, FLAGS, "output" },
+        { "gray",      NULL, 0, AV_OPT_TYPE_CONST, { .i64 = SALIENCY_GRAY }, 0, 0, FLAGS, "output" },
+    { NULL }
+};
+
+static const AVClass saliency_class = {
+    .class_name = "saliency",
+    .item_name  = av_default_item_name,
+    .option     = saliency_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+/* the options without a key, in order */
+static const char *const saliency_shorthand[] = { "size", "fit", "output", NULL };
+
+/* tags the opaque_ref buffers holding a mask */
+static const char saliency_mask_tag[] = "saliency";
+
+static const enum AVPixelFormat saliency_pix_fmts[] = {
+    AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_NV12, AV_PIX_FMT_NV21,
+    AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ444P,
+    AV_PIX_FMT_RGB24, AV_PIX_FMT_BGR24, AV_PIX_FMT_RGBA, AV_PIX_FMT_BGRA,
+    AV_PIX_FMT_ARGB, AV_PIX_FMT_ABGR, AV_PIX_FMT_GBRP,
+    AV_PIX_FMT_NONE
+};
+
+static void mask_free(void *opaque, uint8_t *data)
+{
+    AVFrame *mask = (AVFrame *)data;
+    av_frame_free(&mask);
+}
+
+const AVFrame *saliency_filter_get_mask(const AVFrame *frame)
+{
+    if (!frame->opaque_ref || av_buffer_get_opaque(frame->opaque_ref) != (void *)saliency_mask_tag)
+        return NULL;
+    return (const AVFrame *)frame->opaque_ref->data;
+}
+
+/* run the jobs of the current call until none is left, with the mutex held */
+static void slice_run_jobs(SliceThreads *t)
+{
+    int job, ret;
+
+    while (t->next_job < t->nb_jobs) {
+        job = t->next_job++;
+        SDL_UnlockMutex(t->mutex);
+        ret = t->func(t->arg, job, t->nb_jobs);
+        SDL_LockMutex(t->mutex);
+        t->rets[job] = ret;
+        if (++t->nb_done == t->nb_jobs)
+            SDL_CondSignal(t->done_cond);
+    }
+}
+
+static int slice_worker(void *arg)
+{
+    SliceThreads *t = (SliceThreads *)arg;
+
+    SDL_LockMutex(t->mutex);
+    for (;;) {
+        while (!t->abort_request && t->next_job >= t->nb_jobs)
+            SDL_CondWait(t->work_cond, t->mutex);
+        if (t->abort_request)
+            break;
+        slice_run_jobs(t);
+    }
+    SDL_UnlockMutex(t->mutex);
+    return 0;
+}
+
+static void slice_threads_uninit(SliceThreads *t)
+{
+    int i;
+
+    if (t->mutex) {
+        SDL_LockMutex(t->mutex);
+        t->abort_request = 1;
+        SDL_CondBroadcast(t->work_cond);
+        SDL_UnlockMutex(t->mutex);
+    }
+    for (i = 0; i < t->nb_threads; i++)
+        SDL_WaitThread(t->tids[i], NULL);
+    t->nb_threads = 0;
+    SDL_DestroyCond(t->done_cond);
+    SDL_DestroyCond(t->work_cond);
+    SDL_DestroyMutex(t->mutex);
+}
+
+/* nb_threads threads in total, 0 for one per CPU */
+static int slice_threads_init(SliceThreads *t, int nb_threads)
+{
+    int i;
+
+    if (nb_threads <= 0)
+        nb_threads = SDL_GetCPUCount();
+    nb_threads = av_clip(nb_threads, 1, MAX_SLICE_THREADS + 1);
+    t->mutex     = SDL_CreateMutex();
+    t->work_cond = SDL_CreateCond();
+    t->done_cond = SDL_CreateCond();
+    if (!t->mutex || !t->work_cond || !t->done_cond)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < nb_threads - 1; i++) {
+        if (!(t->tids[i] = SDL_CreateThread(slice_worker, "saliency_slice", t))) {
+            av_log(NULL, AV_LOG_ERROR, "SDL_CreateThread(): %s\n", SDL_GetError());
+            return AVERROR(ENOMEM);
+        }
+        t->nb_threads++;
+    }
+    return 0;
+}
+
+static void slice_execute(SliceThreads *t, SliceFunc func, void *arg, int *rets, int nb_jobs)
+{
+    SDL_LockMutex(t->mutex);
+    t->func     = func;
+    t->arg      = arg;
+    t->rets     = rets;
+    t->nb_jobs  = nb_jobs;
+    t->next_job = 0;
+    t->nb_done  = 0;
+    SDL_CondBroadcast(t->work_cond);
+    slice_run_jobs(t);
+    while (t->nb_done < t->nb_jobs)
+        SDL_CondWait(t->done_cond, t->mutex);
+    SDL_UnlockMutex(t->mutex);
+}
+
+static int saliency_init(SaliencyContext *s, const char *args, const SaliencyFilterConfig *config, int nb_jobs)
+{
+    int i, ret;
+
+    s->av_class = &saliency_class;
+    av_opt_set_defaults(s);
+    s->config = *config;
+    s->fit    = config->fit;
+    if (args && (ret = av_opt_set_from_string(s, args, saliency_shorthand, "=", ":")) < 0) {
+        av_log(s, AV_LOG_ERROR, "Invalid options '%s'\n", args);
+        return ret;
+    }
+    if (!s->config.forward) {
+        av_log(s, AV_LOG_ERROR, "The saliency filter only works in the player's -vf chain\n");
+        return AVERROR(EINVAL);
+    }
+    if (!s->width || !s->height) {
+        s->width  = s->config.width;
+        s->height = s->config.height;
+    }
+    if (s->width < 2 || s->height < 2)
+        return AVERROR(EINVAL);
+
+    if (!(s->pre = (PreprocessContext **)av_mallocz_array(nb_jobs, sizeof(*s->pre))))
+        return AVERROR(ENOMEM);
+    s->nb_pre = nb_jobs;
+    for (i = 0; i < nb_jobs; i++)
+        if (!(s->pre[i] = preprocess_alloc()))
+            return AVERROR(ENOMEM);
+    return 0;
+}
+
+static void saliency_uninit(SaliencyContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_pre; i++)
+        preprocess_freep(&s->pre[i]);
+    av_freep(&s->pre);
+    av_freep(&s->input);
+    av_freep(&s->out);
+    if (s->av_class)
+        av_opt_free(s);
+}
+
+static int preprocess_slice(void *arg, int jobnr, int nb_jobs)
+{
+    SliceData *td = (SliceData *)arg;
+
+    return preprocess_frame_slice(td->s->pre[jobnr], td->in, td->s->input, td->params, jobnr, nb_jobs);
+}
+
+/* run the saliency entry of st on frame, which is replaced by the output */
+static int stage_filter(SaliencyPipeline *p, SaliencyStage *st, AVFrame *frame)
+{
+    SaliencyContext *s = &st->s;
+    PreprocessParams params = { s->width, s->height };
+    AVRational sar = frame->sample_aspect_ratio.num ? frame->sample_aspect_ratio
+                                                    : av_buffersink_get_sample_aspect_ratio(st->sink);
+    SliceData td = { s, frame, &params };
+    std::vector<int> rets;
+    AVFrame *mask = NULL, *out;
+    AVBufferRef *buf;
+    int i, nb_jobs, ret;
+
+    params.nhwc = s->config.nhwc;
+    for (i = 0; i < 3; i++) {
+        params.mean[i]  = s->config.mean[i];
+        params.scale[i] = 1.0f / s->config.std[i];
+    }
+    preprocess_geometry(&params, (enum PreprocessFit)s->fit, frame->width, frame->height, sar);
+
+    if (s->input_w != s->width || s->input_h != s->height) {
+        av_freep(&s->input);
+        av_freep(&s->out);
+        s->input = (float *)av_malloc_array(3 * s->width * s->height, sizeof(*s->input));
+        s->out   = (uint8_t *)av_malloc(s->width * s->height);
+        if (!s->input || !s->out)
+            return AVERROR(ENOMEM);
+        s->input_w = s->width;
+        s->input_h = s->height;
+    }
+
+    nb_jobs = FFMAX(FFMIN(params.dst_h, s->nb_pre), 1);
+    rets.resize(nb_jobs);
+    slice_execute(&p->threads, preprocess_slice, &td, rets.data(), nb_jobs);
+    for (i = 0; i < nb_jobs; i++) {
+        if ((ret = rets[i]) < 0) {
+            av_log(s, AV_LOG_ERROR, "Cannot preprocess a %s picture\n",
+                   av_get_pix_fmt_name((enum AVPixelFormat)frame->format));
+            return ret;
+        }
+    }
+    if ((ret = s->config.forward(s->config.opaque, s->input, &params, s->out)) < 0)
+        return ret;
+
+    if (!(mask = av_frame_alloc()))
+        return AVERROR(ENOMEM);
+    if ((ret = preprocess_output_mask(&params, s->out, mask)) < 0)
+        goto fail;
+
+    if (s->output == SALIENCY_GRAY) {
+        /* the mask replaces the picture and stays attached to it too, so
+         * the player does not run the network on it again */
+        if (!(out = av_frame_clone(mask))) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        if ((ret = av_frame_copy_props(out, frame)) < 0) {
+            av_frame_free(&out);
+            goto fail;
+        }
+        out->sample_aspect_ratio = av_make_q(1, 1);
+        av_frame_unref(frame);
+        av_frame_move_ref(frame, out);
+        av_frame_free(&out);
+    }
+
+    if (!(buf = av_buffer_create((uint8_t *)mask, sizeof(*mask), mask_free, (void *)saliency_mask_tag, 0))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    av_buffer_unref(&frame->opaque_ref);
+    frame->opaque_ref = buf;
+    return 0;
+
+fail:
+    av_frame_free(&mask);
+    return ret;
+}
+
+/* Split a filter chain at its top level commas, leaving quoted and
+ * escaped characters alone. Sets *simple to 0 if the description is more
+ * than a single unlabeled chain. */
+static void split_chain(const char *filters, std::vector<std::string> &segments, int *simple)
+{
+    std::string cur;
+    int quoted = 0;
+    const char *p;
+
+    *simple = 1;
+    for (p = filters; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            cur += *p++;
+            cur += *p;
+            continue;
+        }
+        if (*p == '\'')
+            quoted = !quoted;
+        else if (!quoted && (*p == '[' || *p == ';'))
+            *simple = 0;
+        else if (!quoted && *p == ',') {
+            segments.push_back(cur);
+            cur.clear();
+            continue;
+        }
+        cur += *p;
+    }
+    segments.push_back(cur);
+}
+
+/* args of a saliency entry, NULL if the entry is another filter */
+static const char *saliency_args(const std::string &segment)
+{
+    const char *p = segment.c_str() + strspn(segment.c_str(), " \t\n\r");
+
+    if (!av_strstart(p, "saliency", &p))
+        return NULL;
+    p += strspn(p, " \t\n\r");
+    if (*p == '=')
+        return p + 1;
+    return *p ? NULL : p;
+}
+
+/* link from to to through chain, which has no saliency filter */
+static int parse_between(AVFilterGraph *graph, const char *chain,
+                         AVFilterContext *from, AVFilterContext *to)
+{
+    AVFilterInOut *outputs = NULL, *inputs = NULL;
+    int ret;
+
+    if (!*chain)
+        return avfilter_link(from, 0, to, 0);
+
+    outputs = avfilter_inout_alloc();
+    inputs  = avfilter_inout_alloc();
+    if (!outputs || !inputs) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = from;
+    outputs->pad_idx    = 0;
+    outputs->next       = NULL;
+
+    inputs->name        = av_strdup("out");
+    inputs->filter_ctx  = to;
+    inputs->pad_idx     = 0;
+    inputs->next        = NULL;
+
+    ret = avfilter_graph_parse_ptr(graph, chain, &inputs, &outputs, NULL);
+end:
+    avfilter_inout_free(&outputs);
+    avfilter_inout_free(&inputs);
+    return ret;
+}
+
+/* buffer source -> chain -> buffersink in a graph of its own, configured
+ * for the formats the saliency entry after it takes */
+static int stage_open(SaliencyStage *st, int index, const AVFilterGraph *like,
+                      const char *chain, const char *src_args)
+{
+    char name[64];
+    int ret;
+
+    if (!(st->graph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+    st->graph->nb_threads = like->nb_threads;
+    if (like->scale_sws_opts && !(st->graph->scale_sws_opts = av_strdup(like->scale_sws_opts)))
+        return AVERROR(ENOMEM);
+
+    snprintf(name, sizeof(name), "ffplay_saliency_buffer%d", index);
+    if ((ret = avfilter_graph_create_filter(&st->src, avfilter_get_by_name("buffer"),
+                                            name, src_args, NULL, st->graph)) < 0)
+        return ret;
+    snprintf(name, sizeof(name), "ffplay_saliency_buffersink%d", index);
+    if ((ret = avfilter_graph_create_filter(&st->sink, avfilter_get_by_name("buffersink"),
+                                            name, NULL, NULL, st->graph)) < 0)
+        return ret;
+    if ((ret = av_opt_set_int_list(st->sink, "pix_fmts", saliency_pix_fmts,
+                                   AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN)) < 0)
+        return ret;
+    if ((ret = parse_between(st->graph, chain, st->src, st->sink)) < 0)
+        return ret;
+    return avfilter_graph_config(st->graph, NULL);
+}
+
+/* buffer source args of the pictures out of the saliency entry of st */
+static void stage_output_args(SaliencyStage *st, char *args, size_t size)
+{
+    AVRational tb  = av_buffersink_get_time_base(st->sink);
+    AVRational fr  = av_buffersink_get_frame_rate(st->sink);
+    AVRational sar = av_buffersink_get_sample_aspect_ratio(st->sink);
+    int w = av_buffersink_get_w(st->sink), h = av_buffersink_get_h(st->sink);
+    int format = av_buffersink_get_format(st->sink);
+
+    if (st->s.output == SALIENCY_GRAY) {
+        /* masks have the display aspect ratio, their pixels are square */
+        PreprocessParams params = { st->s.width, st->s.height };
+        preprocess_geometry(&params, (enum PreprocessFit)st->s.fit, w, h, sar);
+        w      = params.mask_w;
+        h      = params.mask_h;
+        format = AV_PIX_FMT_GRAY8;
+        sar    = av_make_q(1, 1);
+    }
+    snprintf(args, size, "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             w, h, format, tb.num, tb.den, sar.num, FFMAX(sar.den, 1));
+    if (fr.num && fr.den)
+        av_strlcatf(args, size, ":frame_rate=%d/%d", fr.num, fr.den);
+}
+
+int saliency_pipeline_open(SaliencyPipeline **pp, const AVFilterGraph *like, const char *filters,
+                           const char *src_args, const SaliencyFilterConfig *config,
+                           char **tail, char *tail_args, size_t tail_args_size)
+{
+    std::vector<std::string> segments;
+    std::string chain, rest;
+    SaliencyPipeline *p;
+    char args[256];
+    const char *sal_args;
+    int simple, last = -1, nb = 0, ret;
+    size_t i;
+
+    *pp   = NULL;
+    *tail = NULL;
+    split_chain(filters, segments, &simple);
+    for (i = 0; i < segments.size(); i++) {
+        if (saliency_args(segments[i])) {
+            last = i;
+            nb++;
+        }
+    }
+    if (last < 0)
+        return 0;
+    if (!simple) {
+        av_log(NULL, AV_LOG_ERROR, "saliency only works in a simple -vf chain without labels\n");
+        return AVERROR(EINVAL);
+    }
+
+    if (!(p = (SaliencyPipeline *)av_mallocz(sizeof(*p))))
+        return AVERROR(ENOMEM);
+    if (!(p->stages = (SaliencyStage *)av_mallocz_array(nb, sizeof(*p->stages))) ||
+        !(p->frame = av_frame_alloc())) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = slice_threads_init(&p->threads, like->nb_threads)) < 0)
+        goto fail;
+
+    av_strlcpy(args, src_args, sizeof(args));
+    for (i = 0; (int)i <= last; i++) {
+        if (!(sal_args = saliency_args(segments[i]))) {
+            if (!chain.empty())
+                chain += ',';
+            chain += segments[i];
+            continue;
+        }
+        SaliencyStage *st = &p->stages[p->nb_stages++];
+        if ((ret = saliency_init(&st->s, *sal_args ? sal_args : NULL, config, p->threads.nb_threads + 1)) < 0 ||
+            (ret = stage_open(st, p->nb_stages - 1, like, chain.c_str(), args)) < 0)
+            goto fail;
+        stage_output_args(st, args, sizeof(args));
+        chain.clear();
+    }
+
+    for (i = last + 1; i < segments.size(); i++) {
+        if (!rest.empty())
+            rest += ',';
+        rest += segments[i];
+    }
+    if (!(*tail = av_strdup(rest.c_str()))) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    av_strlcpy(tail_args, args, tail_args_size);
+    *pp = p;
+    return 1;
+
+fail:
+    saliency_pipeline_free(&p);
+    return ret;
+}
+
+int saliency_pipeline_send(SaliencyPipeline *p, AVFrame *frame, AVFilterContext *dst)
+{
+    AVFilterContext *next;
+    int i, ret;
+
+    if ((ret = av_buffersrc_add_frame(p->stages[0].src, frame)) < 0)
+        return ret;
+
+    for (i = 0; i < p->nb_stages; i++) {
+        SaliencyStage *st = &p->stages[i];
+
+        next = i + 1 < p->nb_stages ? p->stages[i + 1].src : dst;
+        while (!st->eof) {
+            ret = av_buffersink_get_frame_flags(st->sink, p->frame, 0);
+            if (ret == AVERROR(EAGAIN))
+                break;
+            if (ret == AVERROR_EOF) {
+                st->eof = 1;
+                if ((ret = av_buffersrc_add_frame(next, NULL)) < 0)
+                    return ret;
+                break;
+            }
+            if (ret < 0)
+                return ret;
+            if ((ret = stage_filter(p, st, p->frame)) < 0 ||
+                (ret = av_buffersrc_add_frame(next, p->frame)) < 0) {
+                av_frame_unref(p->frame);
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+void saliency_pipeline_free(SaliencyPipeline **pp)
+{
+    SaliencyPipeline *p = *pp;
+    int i;
+
+    if (!p)
+        return;
+    if (p->stages) {
+        for (i = 0; i < p->nb_stages; i++) {
+            avfilter_graph_free(&p->stages[i].graph);
+            saliency_uninit(&p->stages[i].s);
+        }
+        av_freep(&p->stages);
+    }
+    slice_threads_uninit(&p->threads);
+    av_frame_free(&p->frame);
+    av_freep(pp);
+}
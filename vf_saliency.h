@@ -0,0 +1,84 @@
+/*
+ * "saliency" video filter: PoolNet inside the -vf filtergraph
+ *
+ * A filter of our own can only be built on the private libavfilter API,
+ * which the shared libraries do not export. The saliency entries of a -vf
+ * chain are therefore run between graphs instead of in one:
+ * saliency_pipeline_open splits a simple chain at its saliency entries and
+ * builds every piece up to the last one as a graph of its own, from a
+ * buffer source to a buffersink. The caller builds the rest behind a
+ * buffer source of its own and feeds the decoded pictures to
+ * saliency_pipeline_send, which runs each saliency entry on the pictures
+ * out of one graph and hands them to the next, so
+ * "scale=640:-1,saliency,fps=10" works as on the ffmpeg command line.
+ *
+ * Options: size (network input, default from -infer_size), fit
+ * (stretch|letterbox|crop) and output: "side" passes the picture through
+ * with the mask attached (see saliency_filter_get_mask), "gray" replaces
+ * the picture by the mask as a GRAY8 video.
+ */
+
+#ifndef VF_SALIENCY_H
+#define VF_SALIENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "preprocess.h"
+
+extern "C"
+{
+#include "libavfilter/avfilter.h"
+#include "libavutil/frame.h"
+}
+
+/**
+ * Run the network on a preprocessed input of params->width x
+ * params->height and write the saliency as that many bytes to out.
+ * Called on the thread that feeds the pipeline.
+ */
+typedef int (*SaliencyForwardFunc)(void *opaque, float *input, const PreprocessParams *params, uint8_t *out);
+
+typedef struct SaliencyFilterConfig {
+    SaliencyForwardFunc forward;
+    void *opaque;
+    int width, height;              /* defaults of the size option */
+    enum PreprocessFit fit;         /* default of the fit option */
+    int nhwc;
+    float mean[3];
+    float std[3];
+} SaliencyFilterConfig;
+
+typedef struct SaliencyPipeline SaliencyPipeline;
+
+/**
+ * Build the pieces of filters up to its last saliency entry, the first
+ * one fed by a buffer source with src_args. The graphs take the thread
+ * count and scale options of like, and so many threads preprocess each
+ * picture in slices.
+ *
+ * @param tail       set to the rest of the chain, to be freed with av_free,
+ *                   empty when the chain ends with a saliency entry
+ * @param tail_args  set to the buffer source args of the rest
+ * @return 1 and the pipeline, 0 and NULL if filters has no saliency entry,
+ *         <0 on error
+ */
+int saliency_pipeline_open(SaliencyPipeline **p, const AVFilterGraph *like, const char *filters,
+                           const char *src_args, const SaliencyFilterConfig *config,
+                           char **tail, char *tail_args, size_t tail_args_size);
+
+/**
+ * Filter frame, NULL at the end of the stream, through the pipeline and
+ * add what comes out to dst, the buffer source of the rest of the chain.
+ * Takes the references of frame like av_buffersrc_add_frame.
+ */
+int saliency_pipeline_send(SaliencyPipeline *p, AVFrame *frame, AVFilterContext *dst);
+
+void saliency_pipeline_free(SaliencyPipeline **p);
+
+/**
+ * @return the mask a saliency filter attached to frame, or NULL
+ */
+const AVFrame *saliency_filter_get_mask(const AVFrame *frame);
+
+#endif /* VF_SALIENCY_H */